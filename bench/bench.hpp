@@ -0,0 +1,186 @@
+/*
+ * Minimal microbenchmark harness
+ *
+ * Each benchmark is a lambda that performs 'ops' operations per call. The harness grows the
+ * call count until a sample takes long enough to time reliably, takes several samples and keeps
+ * the median, which is far less noisy than the mean on a shared machine.
+ *
+ * bench_keep() stops the compiler from deleting work whose result is otherwise unused.
+ *
+ * Results can be written as JSON (cod_bench --json out.json) for tracking across commits,
+ * the output only changes when the numbers do: fixed key order, run order, fixed precision.
+ */
+
+#pragma once
+#include "../src/containers.hpp"
+#include "../src/time.hpp"
+#include <cstdint>
+#include <cstdio>
+
+#define BENCH_MAX_RESULTS	512
+#define BENCH_SAMPLES		7
+#define BENCH_MIN_SAMPLE_NS 20000000.0
+
+struct BenchResult
+{
+	fixed_string<32> group;
+	fixed_string<64> name;
+	uint64_t		 iterations;
+	double			 ns_per_op;
+	double			 min_ns_per_op;
+	double			 max_ns_per_op;
+};
+
+struct BenchContext
+{
+	fixed_array<BenchResult, BENCH_MAX_RESULTS> results;
+	const char								   *group;
+	bool										group_printed; /* header is printed on the first selected bench */
+	const char								   *filter; /* substring match on "group/name", null = all */
+};
+
+template <typename T>
+inline void
+bench_keep(T const &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile const void *sink;
+	sink = &value;
+#endif
+}
+
+/* xorshift64, deterministic so runs are comparable */
+inline uint64_t
+bench_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+/* Uniform float in [lo, hi) */
+inline float
+bench_randf(uint64_t *state, float lo, float hi)
+{
+	return lo + (hi - lo) * (float)(bench_rand(state) >> 40) / (float)(1ull << 24);
+}
+
+inline double
+bench_elapsed_ns(TimePoint start)
+{
+	return std::chrono::duration<double, std::nano>(time_now() - start).count();
+}
+
+inline void
+bench_begin_group(BenchContext *ctx, const char *group)
+{
+	ctx->group = group;
+	ctx->group_printed = false;
+}
+
+inline bool
+bench_selected(BenchContext *ctx, const char *name)
+{
+	if (!ctx->filter)
+	{
+		return true;
+	}
+	char full[128];
+	snprintf(full, sizeof(full), "%s/%s", ctx->group, name);
+	return strstr(full, ctx->filter) != nullptr;
+}
+
+/*
+ * Records and prints one benchmark from per op timings, for benchmarks that can't be expressed
+ * as a closure run in a loop (anything involving threads). Sorts samples in place.
+ */
+inline void
+bench_report(BenchContext *ctx, const char *name, uint64_t iterations, double *samples, int count)
+{
+	if (!ctx->group_printed)
+	{
+		printf("\n%-48s %12s %12s %12s\n", ctx->group, "ns/op", "min", "max");
+		ctx->group_printed = true;
+	}
+
+	/* Insertion sort, there are only a handful of samples */
+	for (int i = 1; i < count; i++)
+	{
+		double v = samples[i];
+		int	   j = i - 1;
+		while (j >= 0 && samples[j] > v)
+		{
+			samples[j + 1] = samples[j];
+			j--;
+		}
+		samples[j + 1] = v;
+	}
+
+	BenchResult result = {};
+	result.group.set(ctx->group);
+	result.name.set(name);
+	result.iterations = iterations;
+	result.ns_per_op = samples[count / 2];
+	result.min_ns_per_op = samples[0];
+	result.max_ns_per_op = samples[count - 1];
+	ctx->results.push(result);
+
+	printf("  %-46s %12.3f %12.3f %12.3f\n", name, result.ns_per_op, result.min_ns_per_op, result.max_ns_per_op);
+}
+
+template <typename F>
+inline void
+bench_run(BenchContext *ctx, const char *name, uint64_t ops, F &&fn)
+{
+	if (!bench_selected(ctx, name))
+	{
+		return;
+	}
+
+	/* Calibrate: double the call count until one sample is long enough */
+	uint64_t calls = 1;
+	while (true)
+	{
+		TimePoint start = time_now();
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			fn();
+		}
+		if (bench_elapsed_ns(start) >= BENCH_MIN_SAMPLE_NS || calls >= (1ull << 40))
+		{
+			break;
+		}
+		calls *= 2;
+	}
+
+	double samples[BENCH_SAMPLES];
+	for (int s = 0; s < BENCH_SAMPLES; s++)
+	{
+		TimePoint start = time_now();
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			fn();
+		}
+		samples[s] = bench_elapsed_ns(start) / (double)(calls * ops);
+	}
+
+	bench_report(ctx, name, calls * ops, samples, BENCH_SAMPLES);
+}
+
+bool
+bench_write_json(BenchContext *ctx, const char *path);
+
+/* One entry point per benchmark file, called in order from bench_main.cpp */
+void
+bench_containers(BenchContext *ctx);
+
+void
+bench_math(BenchContext *ctx);
+
+void
+bench_physics(BenchContext *ctx);
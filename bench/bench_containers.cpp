@@ -0,0 +1,619 @@
+/*
+ * Container benchmarks, each custom container is measured next to the std equivalent
+ * doing the same work
+ */
+
+#include "bench.hpp"
+#include "../src/lock_free_queue.hpp"
+#include <atomic>
+#include <bitset>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+template <size_t N>
+static void
+bench_bitset_size(BenchContext *ctx)
+{
+	static fixed_bitset<N> a, b, c;
+	static std::bitset<N>  sa, sb, sc;
+
+	/* ~25% density, roughly what a relevancy or visibility set looks like */
+	uint64_t seed = 0x9e3779b97f4a7c15ull;
+	for (uint32_t i = 0; i < N; i++)
+	{
+		if ((bench_rand(&seed) & 3) == 0)
+		{
+			a.set(i);
+			sa.set(i);
+		}
+		if ((bench_rand(&seed) & 3) == 0)
+		{
+			b.set(i);
+			sb.set(i);
+		}
+	}
+
+	char name[64];
+
+	snprintf(name, sizeof(name), "fixed_bitset<%zu> and", N);
+	bench_run(ctx, name, 1, [&]() {
+		c = a;
+		c.and_with(b);
+		bench_keep(c.words[0]);
+	});
+	snprintf(name, sizeof(name), "std::bitset<%zu> and", N);
+	bench_run(ctx, name, 1, [&]() {
+		sc = sa;
+		sc &= sb;
+		bench_keep(sc);
+	});
+
+	snprintf(name, sizeof(name), "fixed_bitset<%zu> or", N);
+	bench_run(ctx, name, 1, [&]() {
+		c = a;
+		c.or_with(b);
+		bench_keep(c.words[0]);
+	});
+	snprintf(name, sizeof(name), "std::bitset<%zu> or", N);
+	bench_run(ctx, name, 1, [&]() {
+		sc = sa;
+		sc |= sb;
+		bench_keep(sc);
+	});
+
+	snprintf(name, sizeof(name), "fixed_bitset<%zu> andnot", N);
+	bench_run(ctx, name, 1, [&]() {
+		c = a;
+		c.and_not(b);
+		bench_keep(c.words[0]);
+	});
+	snprintf(name, sizeof(name), "std::bitset<%zu> andnot", N);
+	bench_run(ctx, name, 1, [&]() {
+		sc = sa;
+		sc &= ~sb;
+		bench_keep(sc);
+	});
+
+	snprintf(name, sizeof(name), "fixed_bitset<%zu> count", N);
+	bench_run(ctx, name, 1, [&]() {
+		bench_keep(a);
+		bench_keep(a.count());
+	});
+	snprintf(name, sizeof(name), "std::bitset<%zu> count", N);
+	bench_run(ctx, name, 1, [&]() {
+		bench_keep(sa);
+		bench_keep(sa.count());
+	});
+
+	/* Visit every set bit */
+	snprintf(name, sizeof(name), "fixed_bitset<%zu> iterate", N);
+	bench_run(ctx, name, 1, [&]() {
+		uint32_t sum = 0;
+		for (int32_t i = a.find_first(); i != -1; i = a.find_next(i))
+		{
+			sum += i;
+		}
+		bench_keep(sum);
+	});
+	snprintf(name, sizeof(name), "std::bitset<%zu> iterate", N);
+	bench_run(ctx, name, 1, [&]() {
+		uint32_t sum = 0;
+#ifdef __GLIBCXX__
+		for (size_t i = sa._Find_first(); i < N; i = sa._Find_next(i))
+		{
+			sum += i;
+		}
+#else
+		for (size_t i = 0; i < N; i++)
+		{
+			if (sa.test(i))
+			{
+				sum += i;
+			}
+		}
+#endif
+		bench_keep(sum);
+	});
+
+	/* Pick the middle set bit, e.g. choosing a random relevant peer */
+	uint32_t middle = a.count() / 2;
+	snprintf(name, sizeof(name), "fixed_bitset<%zu> select", N);
+	bench_run(ctx, name, 1, [&]() {
+		bench_keep(a);
+		bench_keep(a.select(middle));
+	});
+	snprintf(name, sizeof(name), "std::bitset<%zu> select", N);
+	bench_run(ctx, name, 1, [&]() {
+		bench_keep(sa);
+		uint32_t seen = 0;
+		size_t	 found = N;
+		for (size_t i = 0; i < N; i++)
+		{
+			if (sa.test(i) && seen++ == middle)
+			{
+				found = i;
+				break;
+			}
+		}
+		bench_keep(found);
+	});
+}
+
+static void
+bench_bitset(BenchContext *ctx)
+{
+	bench_begin_group(ctx, "bitset");
+	bench_bitset_size<64>(ctx);
+	bench_bitset_size<256>(ctx);
+	bench_bitset_size<1024>(ctx);
+	bench_bitset_size<4096>(ctx);
+}
+
+/*
+ * fixed_map against std::unordered_map, keyed like the peer and zone tables. The map is filled to
+ * 3/4 of capacity, then churned: every step removes a live key and inserts a fresh one, which is
+ * what connects and disconnects do to the peer map over a long session.
+ */
+#define MAP_CAPACITY 1024
+#define MAP_LIVE	 768
+#define MAP_KEYS	 4096
+
+static void
+bench_fixed_map(BenchContext *ctx)
+{
+	bench_begin_group(ctx, "fixed_map");
+
+	static fixed_map<uint64_t, uint32_t, MAP_CAPACITY> map;
+	static std::unordered_map<uint64_t, uint32_t>		 std_map;
+	static uint64_t										 live[MAP_LIVE];
+	static uint64_t										 missing[MAP_KEYS];
+
+	uint64_t seed = 0xda942042e4dd58b5ull;
+	map.clear();
+	std_map.clear();
+	std_map.reserve(MAP_CAPACITY);
+	for (uint32_t i = 0; i < MAP_LIVE; i++)
+	{
+		live[i] = bench_rand(&seed);
+		map.insert(live[i], i);
+		std_map[live[i]] = i;
+	}
+	for (uint32_t i = 0; i < MAP_KEYS; i++)
+	{
+		missing[i] = bench_rand(&seed);
+	}
+
+	uint32_t cursor = 0;
+
+	bench_run(ctx, "fixed_map lookup hit", MAP_LIVE, [&]() {
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < MAP_LIVE; i++)
+		{
+			sum += *map.get(live[i]);
+		}
+		bench_keep(sum);
+	});
+	bench_run(ctx, "unordered_map lookup hit", MAP_LIVE, [&]() {
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < MAP_LIVE; i++)
+		{
+			sum += std_map.find(live[i])->second;
+		}
+		bench_keep(sum);
+	});
+
+	bench_run(ctx, "fixed_map lookup miss", MAP_KEYS, [&]() {
+		uint32_t found = 0;
+		for (uint32_t i = 0; i < MAP_KEYS; i++)
+		{
+			found += map.get(missing[i]) != nullptr;
+		}
+		bench_keep(found);
+	});
+	bench_run(ctx, "unordered_map lookup miss", MAP_KEYS, [&]() {
+		uint32_t found = 0;
+		for (uint32_t i = 0; i < MAP_KEYS; i++)
+		{
+			found += std_map.find(missing[i]) != std_map.end();
+		}
+		bench_keep(found);
+	});
+
+	/* Both maps churn the same key sequence so they stay identical */
+	uint64_t churn_seed = 0x6a09e667f3bcc909ull;
+	bench_run(ctx, "fixed_map churn remove+insert", 1, [&]() {
+		uint32_t slot = cursor++ % MAP_LIVE;
+		map.remove(live[slot]);
+		live[slot] = bench_rand(&churn_seed);
+		map.insert(live[slot], slot);
+	});
+
+	/* The tombstones left behind by churn are what lookups have to walk past now */
+	bench_run(ctx, "fixed_map lookup hit after churn", MAP_LIVE, [&]() {
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < MAP_LIVE; i++)
+		{
+			sum += *map.get(live[i]);
+		}
+		bench_keep(sum);
+	});
+	bench_run(ctx, "fixed_map lookup miss after churn", MAP_KEYS, [&]() {
+		uint32_t found = 0;
+		for (uint32_t i = 0; i < MAP_KEYS; i++)
+		{
+			found += map.get(missing[i]) != nullptr;
+		}
+		bench_keep(found);
+	});
+	if (bench_selected(ctx, "fixed_map churn remove+insert"))
+	{
+		printf("  (%u tombstones in %u slots after churn)\n", map.tombstones(), map.table_capacity());
+	}
+
+	/* Rebuild the std map from the churned key set and churn it the same way */
+	std_map.clear();
+	for (uint32_t i = 0; i < MAP_LIVE; i++)
+	{
+		std_map[live[i]] = i;
+	}
+	bench_run(ctx, "unordered_map churn erase+insert", 1, [&]() {
+		uint32_t slot = cursor++ % MAP_LIVE;
+		std_map.erase(live[slot]);
+		live[slot] = bench_rand(&churn_seed);
+		std_map[live[slot]] = slot;
+	});
+}
+
+/* Roughly the size of a history snapshot entry */
+struct BenchFrame
+{
+	uint64_t tick;
+	float	 values[14];
+};
+
+#define RING_SIZE 1024
+
+static void
+bench_ring_buffer(BenchContext *ctx)
+{
+	bench_begin_group(ctx, "ring_buffer");
+
+	static ring_buffer<BenchFrame, RING_SIZE> ring;
+	static std::deque<BenchFrame>			  deque;
+
+	BenchFrame frame = {};
+	for (uint32_t i = 0; i < RING_SIZE; i++)
+	{
+		frame.tick = i;
+		ring.push(frame);
+		deque.push_back(frame);
+	}
+
+	/* Steady state of a full history: every push evicts the oldest entry */
+	bench_run(ctx, "ring_buffer push full", 1, [&]() {
+		frame.tick++;
+		ring.push(frame);
+	});
+	bench_run(ctx, "deque push_back+pop_front", 1, [&]() {
+		frame.tick++;
+		deque.pop_front();
+		deque.push_back(frame);
+	});
+
+	uint64_t seed = 0x3c6ef372fe94f82bull;
+	uint32_t indices[256];
+	for (uint32_t &idx : indices)
+	{
+		idx = bench_rand(&seed) % RING_SIZE;
+	}
+
+	bench_run(ctx, "ring_buffer at random", 256, [&]() {
+		uint64_t sum = 0;
+		for (uint32_t idx : indices)
+		{
+			sum += ring.at(idx)->tick;
+		}
+		bench_keep(sum);
+	});
+	bench_run(ctx, "deque at random", 256, [&]() {
+		uint64_t sum = 0;
+		for (uint32_t idx : indices)
+		{
+			sum += deque[idx].tick;
+		}
+		bench_keep(sum);
+	});
+
+	bench_run(ctx, "ring_buffer iterate", RING_SIZE, [&]() {
+		uint64_t sum = 0;
+		for (BenchFrame &f : ring)
+		{
+			sum += f.tick;
+		}
+		bench_keep(sum);
+	});
+	bench_run(ctx, "deque iterate", RING_SIZE, [&]() {
+		uint64_t sum = 0;
+		for (BenchFrame &f : deque)
+		{
+			sum += f.tick;
+		}
+		bench_keep(sum);
+	});
+}
+
+#define QUEUE_BATCH 64
+
+static void
+bench_fixed_queue(BenchContext *ctx)
+{
+	bench_begin_group(ctx, "fixed_queue");
+
+	static fixed_queue<uint64_t, 256> queue;
+	static std::queue<uint64_t>		  std_queue;
+
+	/* Fill a batch and drain it, like a frame's worth of events */
+	bench_run(ctx, "fixed_queue push+pop", QUEUE_BATCH, [&]() {
+		for (uint64_t i = 0; i < QUEUE_BATCH; i++)
+		{
+			queue.push(i);
+		}
+		uint64_t sum = 0;
+		while (uint64_t *v = queue.pop())
+		{
+			sum += *v;
+		}
+		bench_keep(sum);
+	});
+	bench_run(ctx, "std::queue push+pop", QUEUE_BATCH, [&]() {
+		for (uint64_t i = 0; i < QUEUE_BATCH; i++)
+		{
+			std_queue.push(i);
+		}
+		uint64_t sum = 0;
+		while (!std_queue.empty())
+		{
+			sum += std_queue.front();
+			std_queue.pop();
+		}
+		bench_keep(sum);
+	});
+}
+
+/*
+ * Cross thread queues
+ *
+ * These can't go through bench_run, each sample starts a producer and a consumer, pins them to
+ * different cores and times a fixed number of messages. The cores are 0 and half the core count,
+ * on the usual Linux numbering those are different physical cores rather than SMT siblings, which
+ * is the case that matters: the receive thread and the main thread are rarely on one core.
+ *
+ * Throughput is messages per ns with both threads streaming, round trip is one message there and
+ * one back, the latency of the receive thread handing a packet to the main thread and back.
+ */
+#define XTHREAD_MESSAGES	(1u << 20)
+#define XTHREAD_ROUND_TRIPS (1u << 16)
+#define XTHREAD_QUEUE_SIZE	1024
+
+static void
+pin_thread(uint32_t core)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+#else
+	(void)core;
+#endif
+}
+
+/* The std equivalent: a deque behind a mutex, what you would write first */
+template <typename T> struct mutex_queue
+{
+	std::mutex	  mutex;
+	std::deque<T> items;
+
+	bool
+	try_push(const T &item)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.size() >= XTHREAD_QUEUE_SIZE)
+		{
+			return false;
+		}
+		items.push_back(item);
+		return true;
+	}
+
+	bool
+	try_pop(T &item)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.empty())
+		{
+			return false;
+		}
+		item = items.front();
+		items.pop_front();
+		return true;
+	}
+};
+
+template <typename Queue>
+static double
+xthread_throughput_sample(Queue *queue, uint32_t producer_core, uint32_t consumer_core)
+{
+	std::atomic<bool> ready{false};
+	uint64_t		  sum = 0;
+
+	std::thread consumer([&]() {
+		pin_thread(consumer_core);
+		ready.store(true, std::memory_order_release);
+		uint64_t value;
+		for (uint32_t received = 0; received < XTHREAD_MESSAGES;)
+		{
+			if (queue->try_pop(value))
+			{
+				sum += value;
+				received++;
+			}
+		}
+	});
+
+	pin_thread(producer_core);
+	while (!ready.load(std::memory_order_acquire))
+	{
+	}
+
+	TimePoint start = time_now();
+	for (uint64_t i = 0; i < XTHREAD_MESSAGES;)
+	{
+		if (queue->try_push(i))
+		{
+			i++;
+		}
+	}
+	consumer.join();
+	double ns = bench_elapsed_ns(start);
+
+	bench_keep(sum);
+	return ns / XTHREAD_MESSAGES;
+}
+
+template <typename Queue>
+static double
+xthread_round_trip_sample(Queue *ping, Queue *pong, uint32_t main_core, uint32_t echo_core)
+{
+	std::atomic<bool> ready{false};
+
+	std::thread echo([&]() {
+		pin_thread(echo_core);
+		ready.store(true, std::memory_order_release);
+		uint64_t value;
+		for (uint32_t i = 0; i < XTHREAD_ROUND_TRIPS;)
+		{
+			if (ping->try_pop(value))
+			{
+				while (!pong->try_push(value))
+				{
+				}
+				i++;
+			}
+		}
+	});
+
+	pin_thread(main_core);
+	while (!ready.load(std::memory_order_acquire))
+	{
+	}
+
+	TimePoint start = time_now();
+	uint64_t  value;
+	for (uint64_t i = 0; i < XTHREAD_ROUND_TRIPS; i++)
+	{
+		while (!ping->try_push(i))
+		{
+		}
+		while (!pong->try_pop(value))
+		{
+		}
+	}
+	double ns = bench_elapsed_ns(start);
+	echo.join();
+
+	bench_keep(value);
+	return ns / XTHREAD_ROUND_TRIPS;
+}
+
+template <typename Queue>
+static void
+bench_xthread(BenchContext *ctx, const char *label, uint32_t core_a, uint32_t core_b)
+{
+	char   name[64];
+	double samples[BENCH_SAMPLES];
+
+	snprintf(name, sizeof(name), "%s throughput", label);
+	if (bench_selected(ctx, name))
+	{
+		for (int s = 0; s < BENCH_SAMPLES; s++)
+		{
+			Queue *queue = new Queue();
+			samples[s] = xthread_throughput_sample(queue, core_a, core_b);
+			delete queue;
+		}
+		bench_report(ctx, name, (uint64_t)XTHREAD_MESSAGES * BENCH_SAMPLES, samples, BENCH_SAMPLES);
+	}
+
+	snprintf(name, sizeof(name), "%s round trip", label);
+	if (bench_selected(ctx, name))
+	{
+		for (int s = 0; s < BENCH_SAMPLES; s++)
+		{
+			Queue *ping = new Queue();
+			Queue *pong = new Queue();
+			samples[s] = xthread_round_trip_sample(ping, pong, core_a, core_b);
+			delete ping;
+			delete pong;
+		}
+		bench_report(ctx, name, (uint64_t)XTHREAD_ROUND_TRIPS * BENCH_SAMPLES, samples, BENCH_SAMPLES);
+	}
+}
+
+static void
+bench_lock_free_queue(BenchContext *ctx)
+{
+	bench_begin_group(ctx, "lock_free_queue");
+
+	uint32_t cores = std::thread::hardware_concurrency();
+	if (cores < 2)
+	{
+		/* Spinning threads on one core measure the scheduler, not the queue */
+		if (bench_selected(ctx, "lock_free_queue"))
+		{
+			printf("\nlock_free_queue skipped, needs at least 2 cores\n");
+		}
+		return;
+	}
+
+	uint32_t core_a = 0;
+	uint32_t core_b = cores / 2;
+
+	bench_xthread<lock_free_queue<uint64_t, XTHREAD_QUEUE_SIZE>>(ctx, "lock_free_queue", core_a, core_b);
+	bench_xthread<mutex_queue<uint64_t>>(ctx, "mutex deque", core_a, core_b);
+
+	/* The benchmarks pinned the main thread, let the rest of the run go anywhere again */
+#if defined(__linux__)
+	cpu_set_t all;
+	CPU_ZERO(&all);
+	for (uint32_t i = 0; i < cores && i < CPU_SETSIZE; i++)
+	{
+		CPU_SET(i, &all);
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(all), &all);
+#elif defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), ~(DWORD_PTR)0 >> (sizeof(DWORD_PTR) * 8 - cores));
+#endif
+}
+
+void
+bench_containers(BenchContext *ctx)
+{
+	bench_bitset(ctx);
+	bench_fixed_map(ctx);
+	bench_ring_buffer(ctx);
+	bench_fixed_queue(ctx);
+	bench_lock_free_queue(ctx);
+}
@@ -0,0 +1,423 @@
+/*
+ * Physics crowd stress benchmark
+ *
+ * Hundreds of players with scripted inputs run the same apply_player_input + apply_player_physics
+ * the server runs every tick. The script is chosen so every expensive path shows up:
+ *
+ *   runners  sprint in wide arcs and hop, hitting walls at speed in the air, so they wallrun
+ *   jumpers  strafe and jump, double jumping at the top of the arc
+ *   crowders head for the middle of the map and push into each other
+ *
+ * Everything is derived from the player index and step number, no rand(), so the run is the same
+ * every time. The state of every player is hashed at intervals (outside the timed region) into a
+ * trajectory hash. Every run has to produce the same hash, and --expect-hash compares it against a
+ * recorded one, so a change meant to only make physics faster can prove it didn't change the
+ * result. Bit-identical only holds for the same compiler and flags: -ffast-math, FMA contraction
+ * and different libm builds all legitimately change the hash.
+ *
+ * --tick-rate runs the same script at another rate: the script is written in 60Hz steps and
+ * replayed on the same timeline, so a run covers the same seconds of play in more, shorter steps.
+ * Alongside the cost per step it prints the cost per player for a second of play and how many
+ * players one core could simulate at that rate, which is what the rate costs in capacity.
+ *
+ *   cod_crowd_bench [--players N] [--steps N] [--runs N] [--map default|dense|open]
+ *                   [--tick-rate HZ] [--expect-hash HEX]
+ */
+
+#include "../src/game_types.hpp"
+#include "../src/map.hpp"
+#include "../src/math.hpp"
+#include "../src/physics.hpp"
+#include "../src/time.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define CROWD_MAX_PLAYERS 2048
+#define CROWD_MAX_RUNS	  32
+#define HASH_INTERVAL	  32
+#define SCRIPT_RATE		  60   /* the rate the input script's step counts are written for */
+#define CORE_BUDGET		  0.8f /* of each tick, the matchmaker's budget for a match's tick */
+
+#define ROLE_RUNNER	 0
+#define ROLE_JUMPER	 1
+#define ROLE_CROWDER 2
+
+struct CrowdConfig
+{
+	uint32_t	players = 256;
+	uint32_t	steps = 600;
+	uint32_t	runs = 5;
+	uint32_t	tick_rate = SCRIPT_RATE;
+	const char *map = "default";
+	uint64_t	expect_hash = 0;
+	bool		check_hash = false;
+};
+
+static CrowdConfig CONFIG;
+static Map		   MAP;
+static Player	   PLAYERS[CROWD_MAX_PLAYERS];
+static glm::vec3   SPAWNS[CROWD_MAX_PLAYERS];
+
+static uint32_t
+hash_u32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/* [0, 1) from a hash, for scripted inputs */
+static float
+hash_unit(uint32_t a, uint32_t b)
+{
+	return (hash_u32(a * 0x9e3779b9u ^ hash_u32(b)) >> 8) / 16777216.0f;
+}
+
+static uint64_t
+hash_state(uint64_t h, const Player *players, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const float values[6] = {players[i].position.x, players[i].position.y, players[i].position.z,
+								 players[i].velocity.x, players[i].velocity.y, players[i].velocity.z};
+		const uint8_t *bytes = (const uint8_t *)values;
+		for (size_t b = 0; b < sizeof(values); b++)
+		{
+			h ^= bytes[b];
+			h *= 0x100000001b3ull;
+		}
+	}
+	return h;
+}
+
+/*
+ * The dense map is the default map with a grid of pillars and short walls filling the open
+ * ground, up to the obstacle limit. More boxes per sphere test and far more walls to run along.
+ */
+static Map
+generate_crowd_map(const char *name)
+{
+	Map map = generate_map();
+
+	if (strcmp(name, "open") == 0)
+	{
+		map.obb_geometry.clear();
+		map.obb_geometry.push(obb_from_center_size(glm::vec3(0, -1.0f, 0), glm::vec3(60, 0.5f, 60)));
+	}
+	else if (strcmp(name, "dense") == 0)
+	{
+		uint32_t cell = 0;
+		for (float x = -50.0f; x <= 50.0f; x += 10.0f)
+		{
+			for (float z = -50.0f; z <= 50.0f; z += 10.0f)
+			{
+				glm::vec3 center(x + 5.0f, 2.5f, z + 5.0f);
+				glm::vec3 extents = (cell % 3 == 0)	  ? glm::vec3(1.0f, 5.0f, 1.0f)
+									: (cell % 3 == 1) ? glm::vec3(4.0f, 5.0f, 0.5f)
+													  : glm::vec3(0.5f, 5.0f, 4.0f);
+				map.obb_geometry.push(obb_from_center_size(center, extents));
+				cell++;
+			}
+		}
+	}
+
+	return map;
+}
+
+static bool
+is_clear(glm::vec3 position)
+{
+	Sphere	s = {position, PLAYER_RADIUS * 1.5f};
+	Contact contact;
+	for (OBB &box : MAP.obb_geometry)
+	{
+		if (sphere_vs_obb(s, box, &contact))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Crowders start close to the middle, everyone else anywhere clear on the map */
+static void
+generate_spawns()
+{
+	for (uint32_t i = 0; i < CONFIG.players; i++)
+	{
+		bool  crowder = i % 4 >= 2;
+		float range = crowder ? 15.0f : 50.0f;
+
+		glm::vec3 p(0, PLAYER_RADIUS + 0.5f, 0);
+		for (uint32_t attempt = 0; attempt < 1000; attempt++)
+		{
+			glm::vec3 candidate((hash_unit(i, attempt * 2) * 2.0f - 1.0f) * range, PLAYER_RADIUS + 0.5f,
+								(hash_unit(i, attempt * 2 + 1) * 2.0f - 1.0f) * range);
+			if (is_clear(candidate))
+			{
+				p = candidate;
+				break;
+			}
+		}
+		SPAWNS[i] = p;
+	}
+}
+
+static void
+reset_players()
+{
+	for (uint32_t i = 0; i < CONFIG.players; i++)
+	{
+		Player p = {};
+		/* Matched by address in apply_player_physics, player_idx is only 8 bits */
+		p.player_idx = -1;
+		p.health = 100;
+		p.wall_index = -1;
+		p.position = SPAWNS[i];
+		p.yaw = hash_unit(i, 0xffff) * 6.2831853f;
+		PLAYERS[i] = p;
+	}
+}
+
+/*
+ * Steps run at CONFIG.tick_rate, the script counts in SCRIPT_RATE steps. Buttons are only pressed on
+ * the first step of a script step, so a 128Hz run doesn't press jump twice where a 60Hz run presses it
+ * once (which would be a double jump)
+ */
+static InputMessage
+scripted_input(uint32_t i, uint32_t tick, Player *p)
+{
+	float	 dt = 1.0f / CONFIG.tick_rate;
+	uint32_t step = (uint32_t)((uint64_t)tick * SCRIPT_RATE / CONFIG.tick_rate);
+	bool	 step_start = tick == 0 || (uint32_t)((uint64_t)(tick - 1) * SCRIPT_RATE / CONFIG.tick_rate) != step;
+	uint32_t role = i % 4 >= 2 ? ROLE_CROWDER : i % 4;
+	uint32_t phase = hash_u32(i) % 64;
+	float	 yaw = p->yaw;
+	float	 move_x = 0.0f;
+	float	 move_z = -1.0f;
+	uint8_t	 buttons = 0;
+
+	switch (role)
+	{
+	case ROLE_RUNNER:
+		/* Wide arcs, turning direction every few seconds, hopping so wall hits happen in the air */
+		yaw += ((step / 180 + i) % 2 ? 1.0f : -1.0f) * 0.6f * dt;
+		if (step_start && (step + phase) % 45 == 0)
+		{
+			buttons |= INPUT_BUTTON_JUMP;
+		}
+		break;
+
+	case ROLE_JUMPER:
+		/* Strafing, jump then double jump near the top */
+		move_x = ((step / 90 + i) % 2) ? 1.0f : -1.0f;
+		move_z = -0.5f;
+		yaw += 0.3f * dt;
+		if (step_start && ((step + phase) % 40 == 0 || (step + phase) % 40 == 20))
+		{
+			buttons |= INPUT_BUTTON_JUMP;
+		}
+		break;
+
+	default:
+		/* Head for a point near the middle, a little jitter so they don't line up */
+		glm::vec3 to = glm::vec3(hash_unit(i, 1) * 6.0f - 3.0f, 0, hash_unit(i, 2) * 6.0f - 3.0f) - p->position;
+		yaw = atan2f(to.z, to.x);
+		move_x = hash_unit(i, step) * 0.6f - 0.3f;
+		break;
+	}
+
+	return make_input_message(tick, move_x, move_z, yaw, 0.0f, buttons);
+}
+
+struct CrowdRun
+{
+	double	 seconds;
+	uint64_t hash;
+	uint64_t wallrunning;
+	uint64_t airborne;
+	uint64_t obb_tests;
+	uint64_t sphere_tests;
+	uint64_t contacts;
+};
+
+static CrowdRun
+run_crowd()
+{
+	CrowdRun run = {};
+	run.hash = 0xcbf29ce484222325ull;
+
+	reset_players();
+	PHYSICS_COUNTERS = {};
+	float dt = 1.0f / CONFIG.tick_rate;
+
+	for (uint32_t step = 0; step < CONFIG.steps; step++)
+	{
+		TimePoint start = time_now();
+		for (uint32_t i = 0; i < CONFIG.players; i++)
+		{
+			Player		*p = &PLAYERS[i];
+			InputMessage input = scripted_input(i, step, p);
+			apply_player_input(p, &input, dt);
+			apply_player_physics(p, MAP, PLAYERS, CONFIG.players, dt);
+		}
+		run.seconds += time_elapsed_seconds(start);
+
+		for (uint32_t i = 0; i < CONFIG.players; i++)
+		{
+			run.wallrunning += PLAYERS[i].wall_running;
+			run.airborne += !PLAYERS[i].on_ground;
+		}
+		if (step % HASH_INTERVAL == 0 || step == CONFIG.steps - 1)
+		{
+			run.hash = hash_state(run.hash, PLAYERS, CONFIG.players);
+		}
+	}
+
+	run.obb_tests = PHYSICS_COUNTERS.sphere_vs_obb;
+	run.sphere_tests = PHYSICS_COUNTERS.sphere_vs_sphere;
+	run.contacts = PHYSICS_COUNTERS.player_contacts;
+	return run;
+}
+
+static bool
+parse_args(int argc, char **argv)
+{
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const char *arg = argv[i];
+		const char *value = argv[i + 1];
+
+		if (strcmp(arg, "--players") == 0)
+		{
+			CONFIG.players = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--steps") == 0)
+		{
+			CONFIG.steps = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--runs") == 0)
+		{
+			CONFIG.runs = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--tick-rate") == 0)
+		{
+			CONFIG.tick_rate = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--map") == 0)
+		{
+			CONFIG.map = value;
+		}
+		else if (strcmp(arg, "--expect-hash") == 0)
+		{
+			CONFIG.expect_hash = strtoull(value, nullptr, 16);
+			CONFIG.check_hash = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if (argc % 2 == 0)
+	{
+		return false;
+	}
+	if (CONFIG.players < 1 || CONFIG.players > CROWD_MAX_PLAYERS)
+	{
+		printf("--players must be between 1 and %d\n", CROWD_MAX_PLAYERS);
+		return false;
+	}
+	if (CONFIG.runs < 1 || CONFIG.runs > CROWD_MAX_RUNS || CONFIG.steps < 1)
+	{
+		printf("--runs must be between 1 and %d, --steps at least 1\n", CROWD_MAX_RUNS);
+		return false;
+	}
+	if (CONFIG.tick_rate < MIN_TICK_RATE || CONFIG.tick_rate > MAX_TICK_RATE)
+	{
+		printf("--tick-rate must be between %d and %d\n", MIN_TICK_RATE, MAX_TICK_RATE);
+		return false;
+	}
+	if (strcmp(CONFIG.map, "default") != 0 && strcmp(CONFIG.map, "dense") != 0 && strcmp(CONFIG.map, "open") != 0)
+	{
+		printf("--map must be default, dense or open\n");
+		return false;
+	}
+	return true;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (!parse_args(argc, argv))
+	{
+		printf("usage: cod_crowd_bench [--players N] [--steps N] [--runs N] [--map default|dense|open]\n"
+			   "                       [--tick-rate HZ] [--expect-hash HEX]\n");
+		return 1;
+	}
+
+	MAP = generate_crowd_map(CONFIG.map);
+	generate_spawns();
+
+	printf("%u players, %u steps at %uHz, %s map (%u obstacles), %u runs\n", CONFIG.players, CONFIG.steps,
+		   CONFIG.tick_rate, CONFIG.map, MAP.obb_geometry.size(), CONFIG.runs);
+
+	CrowdRun runs[CROWD_MAX_RUNS];
+	bool	 deterministic = true;
+	for (uint32_t r = 0; r < CONFIG.runs; r++)
+	{
+		runs[r] = run_crowd();
+		if (runs[r].hash != runs[0].hash)
+		{
+			deterministic = false;
+		}
+	}
+
+	/* Median by time, the counters are identical across runs when the hashes are */
+	for (uint32_t i = 1; i < CONFIG.runs; i++)
+	{
+		CrowdRun v = runs[i];
+		int32_t	 j = i - 1;
+		while (j >= 0 && runs[j].seconds > v.seconds)
+		{
+			runs[j + 1] = runs[j];
+			j--;
+		}
+		runs[j + 1] = v;
+	}
+
+	CrowdRun &median = runs[CONFIG.runs / 2];
+	double	  player_steps = (double)CONFIG.players * CONFIG.steps;
+
+	printf("\n");
+	printf("  ns per player-step       %.1f (min %.1f, max %.1f)\n", median.seconds * 1e9 / player_steps,
+		   runs[0].seconds * 1e9 / player_steps, runs[CONFIG.runs - 1].seconds * 1e9 / player_steps);
+	printf("  ms per step              %.3f\n", median.seconds * 1e3 / CONFIG.steps);
+	printf("  us per player-second     %.1f\n", median.seconds * 1e6 / player_steps * CONFIG.tick_rate);
+	printf("  players per core         %.0f (%.0f%% of every tick)\n",
+		   CORE_BUDGET / (median.seconds / player_steps * CONFIG.tick_rate), CORE_BUDGET * 100.0f);
+	printf("  obb tests per step       %.0f\n", (double)median.obb_tests / CONFIG.steps);
+	printf("  sphere tests per step    %.0f\n", (double)median.sphere_tests / CONFIG.steps);
+	printf("  player contacts per step %.1f\n", (double)median.contacts / CONFIG.steps);
+	printf("  wallrunning              %.1f%% of player-steps\n", 100.0 * median.wallrunning / player_steps);
+	printf("  airborne                 %.1f%% of player-steps\n", 100.0 * median.airborne / player_steps);
+	printf("  trajectory hash          %016llx\n", (unsigned long long)median.hash);
+
+	if (!deterministic)
+	{
+		printf("\nFAIL: runs produced different trajectories\n");
+		return 1;
+	}
+	if (CONFIG.check_hash && median.hash != CONFIG.expect_hash)
+	{
+		printf("\nFAIL: trajectory hash %016llx, expected %016llx\n", (unsigned long long)median.hash,
+			   (unsigned long long)CONFIG.expect_hash);
+		return 1;
+	}
+	return 0;
+}
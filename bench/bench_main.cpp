@@ -0,0 +1,66 @@
+/*
+ * cod_bench [--json path] [filter]
+ *
+ * filter is a substring of "group/name", e.g. "math/raycast" or "bitset<1024>"
+ */
+
+#include "bench.hpp"
+#include <cstring>
+
+#define BENCH_JSON_SCHEMA 1
+
+bool
+bench_write_json(BenchContext *ctx, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+	{
+		printf("Failed to open %s\n", path);
+		return false;
+	}
+
+	fprintf(f, "{\n  \"schema\": %d,\n  \"results\": [\n", BENCH_JSON_SCHEMA);
+	for (uint32_t i = 0; i < ctx->results.size(); i++)
+	{
+		BenchResult &r = ctx->results[i];
+		fprintf(f,
+				"    {\"group\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, "
+				"\"max_ns_per_op\": %.3f, \"iterations\": %llu}%s\n",
+				r.group.c_str(), r.name.c_str(), r.ns_per_op, r.min_ns_per_op, r.max_ns_per_op,
+				(unsigned long long)r.iterations, i + 1 < ctx->results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+	return true;
+}
+
+int
+main(int argc, char **argv)
+{
+	static BenchContext ctx = {};
+	const char		   *json_path = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			json_path = argv[++i];
+		}
+		else
+		{
+			ctx.filter = argv[i];
+		}
+	}
+
+	bench_containers(&ctx);
+	bench_math(&ctx);
+	bench_physics(&ctx);
+
+	printf("\n%u benchmarks run\n", ctx.results.size());
+
+	if (json_path && !bench_write_json(&ctx, json_path))
+	{
+		return 1;
+	}
+	return 0;
+}
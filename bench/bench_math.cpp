@@ -0,0 +1,143 @@
+/*
+ * Collision and raycast kernels from math.cpp
+ *
+ * Inputs are a fixed pseudo random spread over the play area, so each kernel sees the same mix
+ * of broadphase rejects, near misses and hits it would in a match, rather than one case the
+ * branch predictor learns.
+ */
+
+#include "bench.hpp"
+#include "../src/game_types.hpp"
+#include "../src/map.hpp"
+#include "../src/math.hpp"
+
+#define BENCH_SHAPES 1024
+
+static struct
+{
+	Map		  map;
+	Sphere	  spheres[BENCH_SHAPES];
+	Sphere	  others[BENCH_SHAPES];
+	Ray		  rays[BENCH_SHAPES];
+	AABB	  box;
+	OBB		  rotated;
+	glm::vec3 target;
+} DATA;
+
+static void
+generate_data()
+{
+	uint64_t seed = 0x2545f4914f6cdd1dull;
+
+	DATA.map = generate_map();
+	DATA.box = {glm::vec3(-2.0f), glm::vec3(2.0f)};
+	DATA.rotated = obb_from_center_size_rotation(glm::vec3(0, 1, 0), glm::vec3(5.0f, 0.5f, 8.0f),
+												 glm::angleAxis(glm::radians(30.0f), glm::vec3(1, 0, 0)));
+	DATA.target = glm::vec3(0, 1, 0);
+
+	for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+	{
+		glm::vec3 p(bench_randf(&seed, MAP_BOUNDS_MIN, MAP_BOUNDS_MAX), bench_randf(&seed, 0.0f, 6.0f),
+					bench_randf(&seed, MAP_BOUNDS_MIN, MAP_BOUNDS_MAX));
+		DATA.spheres[i] = {p, PLAYER_RADIUS};
+
+		/* Partners close by, so roughly half of the sphere pairs overlap */
+		glm::vec3 offset(bench_randf(&seed, -3, 3), bench_randf(&seed, -3, 3), bench_randf(&seed, -3, 3));
+		DATA.others[i] = {p + offset, PLAYER_RADIUS};
+
+		float	  yaw = bench_randf(&seed, 0.0f, 6.2831853f);
+		float	  pitch = bench_randf(&seed, -0.5f, 0.5f);
+		glm::vec3 dir(cosf(yaw) * cosf(pitch), sinf(pitch), sinf(yaw) * cosf(pitch));
+		DATA.rays[i] = {p, dir, MAX_SHOOT_RANGE};
+	}
+}
+
+void
+bench_math(BenchContext *ctx)
+{
+	generate_data();
+	bench_begin_group(ctx, "math");
+
+	bench_run(ctx, "sphere_vs_sphere", BENCH_SHAPES, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			Contact c;
+			hits += sphere_vs_sphere(DATA.spheres[i], DATA.others[i], &c);
+		}
+		bench_keep(hits);
+	});
+
+	/* Spheres near the origin box, so most reach the narrowphase */
+	bench_run(ctx, "sphere_vs_aabb", BENCH_SHAPES, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			Sphere	s = {DATA.others[i].center - DATA.spheres[i].center, PLAYER_RADIUS};
+			Contact c;
+			hits += sphere_vs_aabb(s, DATA.box, &c);
+		}
+		bench_keep(hits);
+	});
+
+	bench_run(ctx, "sphere_vs_obb rotated", BENCH_SHAPES, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			Sphere	s = {DATA.others[i].center - DATA.spheres[i].center, PLAYER_RADIUS};
+			Contact c;
+			hits += sphere_vs_obb(s, DATA.rotated, &c);
+		}
+		bench_keep(hits);
+	});
+
+	/* What apply_player_physics does per axis: one sphere against every obstacle */
+	uint32_t obstacle_count = DATA.map.obb_geometry.size();
+	bench_run(ctx, "sphere_vs_obb map", (uint64_t)BENCH_SHAPES * obstacle_count, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			for (OBB &box : DATA.map.obb_geometry)
+			{
+				Contact c;
+				hits += sphere_vs_obb(DATA.spheres[i], box, &c);
+			}
+		}
+		bench_keep(hits);
+	});
+
+	bench_run(ctx, "raycast_sphere", BENCH_SHAPES, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			RayHit hit;
+			hits += raycast_sphere(DATA.rays[i], DATA.others[i].center, PLAYER_RADIUS, &hit);
+		}
+		bench_keep(hits);
+	});
+
+	bench_run(ctx, "raycast_aabb", BENCH_SHAPES, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			Ray	   r = {DATA.rays[i].origin * 0.1f, DATA.rays[i].direction, DATA.rays[i].length};
+			RayHit hit;
+			hits += raycast_aabb(r, DATA.box, &hit);
+		}
+		bench_keep(hits);
+	});
+
+	/* What trace_shot and line of sight checks do: one ray against every obstacle */
+	bench_run(ctx, "raycast_obb map", (uint64_t)BENCH_SHAPES * obstacle_count, [&]() {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < BENCH_SHAPES; i++)
+		{
+			for (OBB &box : DATA.map.obb_geometry)
+			{
+				RayHit hit;
+				hits += raycast_obb(DATA.rays[i], box, &hit);
+			}
+		}
+		bench_keep(hits);
+	});
+}
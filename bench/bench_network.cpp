@@ -0,0 +1,605 @@
+/*
+ * Loopback transport benchmark
+ *
+ * Starts one server NetworkClient and a number of client NetworkClients on 127.0.0.1, each driven by
+ * its own thread the way the game drives them (send, network_poll, network_update on a fixed tick).
+ * Clients stream messages of a given size and rate to the server, the server echoes every message
+ * back with the same reliability. Each message carries its send time, so the server measures one
+ * way latency and the client measures the round trip, both on the same clock.
+ *
+ * The latencies include however long a message waits for its owner to poll, which is part of
+ * the cost in the game too. Idle threads sleep for IDLE_SLEEP_US between polls, unless the rate is
+ * 0 (send as fast as possible), in which case everything spins and the CPU figure is meaningless.
+ *
+ * Reliable senders keep at most half the window in flight, past that network_send would drop
+ * the message and print about it, which would measure printf.
+ *
+ * With --channels, reliable messages are spread round robin over that many channels, and with
+ * --ordered those channels deliver in order. The server counts any message that arrives behind a
+ * later one from the same channel, which must stay 0 for ordered channels.
+ *
+ *   cod_net_bench [--clients N] [--size bytes] [--rate msgs/sec/client] [--seconds S]
+ *                 [--reliable] [--channels N] [--ordered] [--loss percent] [--port base] [--json path]
+ */
+
+#include "../src/network_client.hpp"
+#include "../src/time.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define IDLE_SLEEP_US 50
+#define DRAIN_SECONDS 0.25f
+#define UPDATE_HZ	  60
+
+/*
+ * Log-linear latency histogram: 16 buckets per power of two, so any percentile is within ~6% of the
+ * true value, in a fixed 8KB per thread instead of storing every sample
+ */
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS	  (64 * HISTOGRAM_SUB_BUCKETS)
+
+struct LatencyHistogram
+{
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t max_ns;
+};
+
+static uint32_t
+histogram_bucket(uint64_t ns)
+{
+	if (ns < HISTOGRAM_SUB_BUCKETS)
+	{
+		return (uint32_t)ns;
+	}
+#ifdef _MSC_VER
+	unsigned long msb;
+	_BitScanReverse64(&msb, ns);
+#else
+	uint32_t msb = 63 - __builtin_clzll(ns);
+#endif
+	uint32_t shift = msb - 4;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (uint32_t)((ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Midpoint of the range a bucket covers */
+static uint64_t
+histogram_bucket_value(uint32_t bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+	return ((HISTOGRAM_SUB_BUCKETS + sub) << shift) + ((1ull << shift) >> 1);
+}
+
+static void
+histogram_add(LatencyHistogram *h, uint64_t ns)
+{
+	h->buckets[histogram_bucket(ns)]++;
+	h->count++;
+	if (ns > h->max_ns)
+	{
+		h->max_ns = ns;
+	}
+}
+
+static void
+histogram_merge(LatencyHistogram *into, const LatencyHistogram *from)
+{
+	for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		into->buckets[i] += from->buckets[i];
+	}
+	into->count += from->count;
+	if (from->max_ns > into->max_ns)
+	{
+		into->max_ns = from->max_ns;
+	}
+}
+
+static double
+histogram_percentile_us(const LatencyHistogram *h, double percentile)
+{
+	if (h->count == 0)
+	{
+		return 0.0;
+	}
+	uint64_t target = (uint64_t)(percentile / 100.0 * (double)(h->count - 1)) + 1;
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += h->buckets[i];
+		if (seen >= target)
+		{
+			return histogram_bucket_value(i) / 1000.0;
+		}
+	}
+	return h->max_ns / 1000.0;
+}
+
+struct NetBenchConfig
+{
+	uint32_t	clients = 2;
+	uint32_t	size = 64;
+	uint32_t	rate = 1000;
+	float		seconds = 5.0f;
+	bool		reliable = false;
+	uint32_t	channels = 1;
+	bool		ordered = false;
+	uint32_t	loss_percent = 0;
+	uint16_t	port = 27015;
+	const char *json_path = nullptr;
+};
+
+/* Payload header, the rest of the message up to the configured size is filler */
+struct NetBenchMessage
+{
+	uint32_t client;
+	uint32_t sequence;
+	int64_t	 send_ns;
+	uint32_t channel;
+};
+
+#define MAX_PAYLOAD (MAX_PACKET_SIZE - sizeof(PacketHeader))
+
+struct NetBenchThread
+{
+	NetworkClient	*net;
+	std::thread		 thread;
+	uint32_t		 index;
+	uint64_t		 sent;
+	uint64_t		 received;
+	uint64_t		 out_of_order;
+	LatencyHistogram latency;
+};
+
+static NetBenchConfig	 CONFIG;
+static NetworkClient	*SERVER_NET;
+static std::atomic<bool> SENDING;
+static std::atomic<int>	 CLIENTS_RUNNING;
+static std::atomic<int>	 READY;
+static uint32_t			 LAST_SEQUENCE[MAX_PEERS][MAX_CHANNELS]; /* server thread only */
+
+static int64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(time_now().time_since_epoch()).count();
+}
+
+static bool
+accept_peer(sockaddr_in from)
+{
+	return network_add_peer(SERVER_NET, from) != 0;
+}
+
+static void
+update_network(NetworkClient *net, TimePoint *last_update)
+{
+	if (time_elapsed_seconds(*last_update) >= 1.0f / UPDATE_HZ)
+	{
+		*last_update += std::chrono::duration_cast<Duration>(std::chrono::duration<float>(1.0f / UPDATE_HZ));
+		network_update(net, 1.0f / UPDATE_HZ);
+	}
+}
+
+static void
+server_thread(NetBenchThread *t)
+{
+	uint8_t	  packet[MAX_PACKET_SIZE];
+	TimePoint last_update = time_now();
+	READY++;
+
+	while (CLIENTS_RUNNING.load() > 0)
+	{
+		bool   busy = false;
+		Polled polled;
+		while (network_poll(t->net, polled))
+		{
+			busy = true;
+			if (polled.size >= sizeof(NetBenchMessage))
+			{
+				NetBenchMessage msg;
+				memcpy(&msg, polled.buffer, sizeof(msg));
+				histogram_add(&t->latency, (uint64_t)(now_ns() - msg.send_ns));
+				t->received++;
+
+				uint32_t *last = &LAST_SEQUENCE[msg.client][msg.channel];
+				if (msg.sequence < *last)
+				{
+					t->out_of_order++;
+				}
+				*last = msg.sequence;
+
+				memcpy(packet + sizeof(PacketHeader), polled.buffer, polled.size);
+				network_send_packet(t->net, polled.from, packet, sizeof(PacketHeader) + polled.size, CONFIG.reliable,
+									(uint8_t)msg.channel);
+				t->sent++;
+			}
+			network_release_buffer(t->net, polled.buffer_index);
+		}
+
+		update_network(t->net, &last_update);
+		if (!busy && CONFIG.rate > 0)
+		{
+			sleep_microseconds(IDLE_SLEEP_US);
+		}
+	}
+}
+
+static void
+client_thread(NetBenchThread *t)
+{
+	uint8_t	 packet[MAX_PACKET_SIZE] = {};
+	uint32_t server_peer = network_add_peer(t->net, "127.0.0.1", CONFIG.port);
+
+	int64_t interval_ns = CONFIG.rate ? 1000000000ll / CONFIG.rate : 0;
+	READY++;
+	while (!SENDING.load())
+	{
+		sleep_microseconds(10);
+	}
+
+	int64_t	  next_send = now_ns();
+	TimePoint last_update = time_now();
+	TimePoint drain_start = {};
+	bool	  draining = false;
+
+	while (true)
+	{
+		if (!draining && !SENDING.load())
+		{
+			draining = true;
+			drain_start = time_now();
+		}
+		if (draining && time_elapsed_seconds(drain_start) >= DRAIN_SECONDS)
+		{
+			break;
+		}
+
+		bool	busy = false;
+		int64_t now = now_ns();
+		bool	window_open = !CONFIG.reliable || t->sent - t->received < WINDOW_SIZE / 2;
+
+		if (!draining && now >= next_send && window_open)
+		{
+			NetBenchMessage msg = {t->index, (uint32_t)t->sent, now, (uint32_t)(t->sent % CONFIG.channels)};
+			memcpy(packet + sizeof(PacketHeader), &msg, sizeof(msg));
+			network_send_packet(t->net, server_peer, packet, sizeof(PacketHeader) + CONFIG.size, CONFIG.reliable,
+								(uint8_t)msg.channel);
+			t->sent++;
+			next_send += interval_ns;
+			busy = true;
+
+			/* Don't burst to catch up after a stall, just carry on at the rate */
+			if (now - next_send > 100 * interval_ns)
+			{
+				next_send = now;
+			}
+		}
+
+		Polled polled;
+		while (network_poll(t->net, polled))
+		{
+			busy = true;
+			if (polled.size >= sizeof(NetBenchMessage))
+			{
+				NetBenchMessage msg;
+				memcpy(&msg, polled.buffer, sizeof(msg));
+				histogram_add(&t->latency, (uint64_t)(now_ns() - msg.send_ns));
+				t->received++;
+			}
+			network_release_buffer(t->net, polled.buffer_index);
+		}
+
+		update_network(t->net, &last_update);
+		if (!busy && CONFIG.rate > 0)
+		{
+			sleep_microseconds(IDLE_SLEEP_US);
+		}
+	}
+
+	CLIENTS_RUNNING--;
+}
+
+/* User + system CPU time of the whole process, all threads, in seconds */
+static double
+process_cpu_seconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (k + u) * 1e-7;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec +
+		   usage.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+static void
+set_channel_modes(NetworkClient *net)
+{
+	for (uint8_t i = 0; i < MAX_CHANNELS; i++)
+	{
+		network_set_channel_mode(net, i, CONFIG.ordered ? DELIVERY_ORDERED : DELIVERY_UNORDERED);
+	}
+}
+
+static void
+print_usage()
+{
+	printf("usage: cod_net_bench [--clients N] [--size bytes] [--rate msgs/sec/client] [--seconds S]\n"
+		   "                     [--reliable] [--channels N] [--ordered] [--loss percent] [--port base]\n"
+		   "                     [--json path]\n"
+		   "  --rate 0 sends as fast as possible\n");
+}
+
+static bool
+parse_args(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--reliable") == 0)
+		{
+			CONFIG.reliable = true;
+			continue;
+		}
+		if (strcmp(arg, "--ordered") == 0)
+		{
+			CONFIG.ordered = true;
+			continue;
+		}
+		if (!value)
+		{
+			return false;
+		}
+		i++;
+
+		if (strcmp(arg, "--clients") == 0)
+		{
+			CONFIG.clients = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--size") == 0)
+		{
+			CONFIG.size = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--rate") == 0)
+		{
+			CONFIG.rate = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--seconds") == 0)
+		{
+			CONFIG.seconds = (float)atof(value);
+		}
+		else if (strcmp(arg, "--channels") == 0)
+		{
+			CONFIG.channels = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--loss") == 0)
+		{
+			CONFIG.loss_percent = (uint32_t)atoi(value);
+		}
+		else if (strcmp(arg, "--port") == 0)
+		{
+			CONFIG.port = (uint16_t)atoi(value);
+		}
+		else if (strcmp(arg, "--json") == 0)
+		{
+			CONFIG.json_path = value;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if (CONFIG.clients < 1 || CONFIG.clients > MAX_PEERS)
+	{
+		printf("--clients must be between 1 and %d\n", MAX_PEERS);
+		return false;
+	}
+	if (CONFIG.size < sizeof(NetBenchMessage) || CONFIG.size > MAX_PAYLOAD)
+	{
+		printf("--size must be between %zu and %zu\n", sizeof(NetBenchMessage), MAX_PAYLOAD);
+		return false;
+	}
+	if (CONFIG.channels < 1 || CONFIG.channels > MAX_CHANNELS)
+	{
+		printf("--channels must be between 1 and %d\n", MAX_CHANNELS);
+		return false;
+	}
+	if ((CONFIG.channels > 1 || CONFIG.ordered) && !CONFIG.reliable)
+	{
+		printf("--channels and --ordered only apply to --reliable\n");
+		return false;
+	}
+	if (CONFIG.loss_percent > 100)
+	{
+		printf("--loss must be a percentage\n");
+		return false;
+	}
+	return true;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (!parse_args(argc, argv))
+	{
+		print_usage();
+		return 1;
+	}
+
+	static NetBenchThread server = {};
+	static NetBenchThread clients[MAX_PEERS] = {};
+
+	/* NetworkClient carries its packet pool inline, too big for the stack */
+	server.net = new NetworkClient();
+	if (!network_init(server.net, "127.0.0.1", CONFIG.port))
+	{
+		return 1;
+	}
+	server.net->socket.loss_percent = CONFIG.loss_percent;
+	set_channel_modes(server.net);
+	SERVER_NET = server.net;
+	server.net->on_unrecognised = accept_peer;
+
+	for (uint32_t i = 0; i < CONFIG.clients; i++)
+	{
+		clients[i].index = i;
+		clients[i].net = new NetworkClient();
+		if (!network_init(clients[i].net, "127.0.0.1", CONFIG.port + 1 + i))
+		{
+			return 1;
+		}
+		clients[i].net->socket.loss_percent = CONFIG.loss_percent;
+		set_channel_modes(clients[i].net);
+	}
+
+	printf("%u clients, %u byte %s%s messages, %s%u/s each, %.1fs, %u%% loss", CONFIG.clients, CONFIG.size,
+		   CONFIG.ordered ? "ordered " : "", CONFIG.reliable ? "reliable" : "unreliable", CONFIG.rate ? "" : "unthrottled ",
+		   CONFIG.rate, CONFIG.seconds, CONFIG.loss_percent);
+	if (CONFIG.channels > 1)
+	{
+		printf(", %u channels", CONFIG.channels);
+	}
+	printf("\n");
+
+	CLIENTS_RUNNING = CONFIG.clients;
+	server.thread = std::thread(server_thread, &server);
+	for (uint32_t i = 0; i < CONFIG.clients; i++)
+	{
+		clients[i].thread = std::thread(client_thread, &clients[i]);
+	}
+	while (READY.load() < (int)CONFIG.clients + 1)
+	{
+		sleep_microseconds(100);
+	}
+
+	double	  cpu_start = process_cpu_seconds();
+	TimePoint start = time_now();
+	SENDING = true;
+	sleep_seconds(CONFIG.seconds);
+	SENDING = false;
+	float send_seconds = time_elapsed_seconds(start);
+
+	for (uint32_t i = 0; i < CONFIG.clients; i++)
+	{
+		clients[i].thread.join();
+	}
+	server.thread.join();
+	double cpu_seconds = process_cpu_seconds() - cpu_start;
+
+	LatencyHistogram round_trip = {};
+	NetworkStats	 totals = {};
+	uint64_t		 sent = 0;
+	uint64_t		 echoed = 0;
+
+	for (uint32_t i = 0; i <= CONFIG.clients; i++)
+	{
+		NetBenchThread *t = i < CONFIG.clients ? &clients[i] : &server;
+		if (t != &server)
+		{
+			histogram_merge(&round_trip, &t->latency);
+			sent += t->sent;
+			echoed += t->received;
+		}
+		NetworkStats &s = t->net->stats;
+		totals.packets_sent += s.packets_sent;
+		totals.bytes_sent += s.bytes_sent;
+		totals.packets_received += s.packets_received;
+		totals.bytes_received += s.bytes_received;
+		totals.retransmits += s.retransmits;
+		totals.duplicates_received += s.duplicates_received;
+		totals.sends_dropped += s.sends_dropped;
+		totals.packets_held += s.packets_held;
+		network_shutdown(t->net);
+	}
+
+	uint64_t delivered = server.received + echoed;
+	double	 msgs_per_sec = server.received / send_seconds;
+	double	 cpu_us_per_msg = delivered ? cpu_seconds * 1e6 / delivered : 0.0;
+	double	 lost_percent = sent ? 100.0 * (1.0 - (double)server.received / sent) : 0.0;
+
+	printf("\n");
+	printf("  messages sent            %llu\n", (unsigned long long)sent);
+	printf("  received by server       %llu (%.2f%% lost)\n", (unsigned long long)server.received, lost_percent);
+	printf("  echoes received          %llu\n", (unsigned long long)echoed);
+	printf("  throughput               %.0f msgs/s, %.2f MB/s\n", msgs_per_sec,
+		   msgs_per_sec * (CONFIG.size + sizeof(PacketHeader)) / (1024.0 * 1024.0));
+	printf("  packets sent / received  %llu / %llu\n", (unsigned long long)totals.packets_sent,
+		   (unsigned long long)totals.packets_received);
+	printf("  retransmits              %llu\n", (unsigned long long)totals.retransmits);
+	printf("  duplicates received      %llu\n", (unsigned long long)totals.duplicates_received);
+	printf("  sends dropped            %llu\n", (unsigned long long)totals.sends_dropped);
+	printf("  held for ordering        %llu\n", (unsigned long long)totals.packets_held);
+	printf("  out of order at server   %llu\n", (unsigned long long)server.out_of_order);
+	printf("  cpu per message          %.2f us\n", cpu_us_per_msg);
+	printf("\n  latency (us)          p50       p90       p99     p99.9       max\n");
+
+	const LatencyHistogram *histograms[] = {&server.latency, &round_trip};
+	const char			   *labels[] = {"one way", "round trip"};
+	for (int i = 0; i < 2; i++)
+	{
+		const LatencyHistogram *h = histograms[i];
+		printf("  %-14s %10.1f%10.1f%10.1f%10.1f%10.1f\n", labels[i], histogram_percentile_us(h, 50),
+			   histogram_percentile_us(h, 90), histogram_percentile_us(h, 99), histogram_percentile_us(h, 99.9),
+			   h->max_ns / 1000.0);
+	}
+
+	if (CONFIG.json_path)
+	{
+		FILE *f = fopen(CONFIG.json_path, "w");
+		if (!f)
+		{
+			printf("Failed to open %s\n", CONFIG.json_path);
+			return 1;
+		}
+		fprintf(f, "{\n  \"schema\": 1,\n");
+		fprintf(f, "  \"config\": {\"clients\": %u, \"size\": %u, \"rate\": %u, \"seconds\": %.1f, \"reliable\": %s, "
+				   "\"channels\": %u, \"ordered\": %s, \"loss_percent\": %u},\n",
+				CONFIG.clients, CONFIG.size, CONFIG.rate, CONFIG.seconds, CONFIG.reliable ? "true" : "false",
+				CONFIG.channels, CONFIG.ordered ? "true" : "false", CONFIG.loss_percent);
+		fprintf(f, "  \"messages_sent\": %llu,\n  \"messages_received\": %llu,\n  \"echoes_received\": %llu,\n",
+				(unsigned long long)sent, (unsigned long long)server.received, (unsigned long long)echoed);
+		fprintf(f, "  \"msgs_per_sec\": %.1f,\n  \"retransmits\": %llu,\n  \"sends_dropped\": %llu,\n", msgs_per_sec,
+				(unsigned long long)totals.retransmits, (unsigned long long)totals.sends_dropped);
+		fprintf(f, "  \"packets_held\": %llu,\n  \"out_of_order\": %llu,\n", (unsigned long long)totals.packets_held,
+				(unsigned long long)server.out_of_order);
+		fprintf(f, "  \"cpu_us_per_msg\": %.3f,\n", cpu_us_per_msg);
+		for (int i = 0; i < 2; i++)
+		{
+			const LatencyHistogram *h = histograms[i];
+			fprintf(f, "  \"%s_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}%s\n",
+					i == 0 ? "one_way" : "round_trip", histogram_percentile_us(h, 50), histogram_percentile_us(h, 90),
+					histogram_percentile_us(h, 99), histogram_percentile_us(h, 99.9), h->max_ns / 1000.0,
+					i == 0 ? "," : "");
+		}
+		fprintf(f, "}\n");
+		fclose(f);
+	}
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Shared simulation code: the per tick player update and snapshot quantization
+ */
+
+#include "bench.hpp"
+#include "../src/game_types.hpp"
+#include "../src/map.hpp"
+#include "../src/physics.hpp"
+#include "../src/quantization.hpp"
+
+#define BENCH_INPUTS	256
+#define BENCH_TICK_TIME (1.0f / DEFAULT_TICK_RATE)
+
+static struct
+{
+	Map								 map;
+	fixed_array<Player, MAX_PLAYERS> players;
+	InputMessage					 inputs[BENCH_INPUTS];
+	Shot							 shots[BENCH_INPUTS];
+	QuantizedPlayer					 quantized_players[MAX_PLAYERS];
+	QuantizedShot					 quantized_shots[BENCH_INPUTS];
+} DATA;
+
+static void
+generate_data()
+{
+	uint64_t seed = 0x853c49e6748fea9bull;
+
+	srand(1);
+	DATA.map = generate_map();
+
+	DATA.players.clear();
+	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	{
+		Player p = {};
+		p.player_idx = i;
+		p.health = 100;
+		p.wall_index = -1;
+		p.position = get_spawn_point(DATA.map);
+		DATA.players.push(p);
+	}
+
+	/* Mostly running, some strafing, the odd jump */
+	for (uint32_t i = 0; i < BENCH_INPUTS; i++)
+	{
+		uint8_t buttons = (bench_rand(&seed) % 16 == 0) ? INPUT_BUTTON_JUMP : 0;
+		DATA.inputs[i] = make_input_message(i, bench_randf(&seed, -1, 1), bench_randf(&seed, -1, 0.2f),
+											bench_randf(&seed, 0, 6.2831853f), bench_randf(&seed, -0.3f, 0.3f),
+											buttons);
+
+		DATA.shots[i].shooter_idx = i % MAX_PLAYERS;
+		DATA.shots[i].ray.origin = glm::vec3(bench_randf(&seed, MAP_BOUNDS_MIN, MAP_BOUNDS_MAX), 1.5f,
+											 bench_randf(&seed, MAP_BOUNDS_MIN, MAP_BOUNDS_MAX));
+		DATA.shots[i].ray.direction = glm::normalize(glm::vec3(bench_randf(&seed, -1, 1), 0.1f, bench_randf(&seed, -1, 1)));
+		DATA.shots[i].ray.length = bench_randf(&seed, 1.0f, MAX_SHOOT_RANGE);
+	}
+}
+
+void
+bench_physics(BenchContext *ctx)
+{
+	generate_data();
+	bench_begin_group(ctx, "physics");
+
+	uint32_t input_idx = 0;
+
+	bench_run(ctx, "apply_player_input", MAX_PLAYERS, [&]() {
+		for (Player &p : DATA.players)
+		{
+			apply_player_input(&p, &DATA.inputs[input_idx++ & (BENCH_INPUTS - 1)], BENCH_TICK_TIME);
+		}
+		bench_keep(DATA.players[0].velocity);
+	});
+
+	/* One server tick worth of movement, players keep moving about the map as it runs */
+	bench_run(ctx, "apply_player_physics", MAX_PLAYERS, [&]() {
+		for (Player &p : DATA.players)
+		{
+			apply_player_input(&p, &DATA.inputs[input_idx++ & (BENCH_INPUTS - 1)], BENCH_TICK_TIME);
+			apply_player_physics(&p, DATA.map, DATA.players, BENCH_TICK_TIME);
+		}
+		bench_keep(DATA.players[0].position);
+	});
+
+	bench_begin_group(ctx, "quantization");
+
+	bench_run(ctx, "quantize player", MAX_PLAYERS, [&]() {
+		for (uint32_t i = 0; i < MAX_PLAYERS; i++)
+		{
+			DATA.quantized_players[i] = quantize(DATA.players[i]);
+		}
+		bench_keep(DATA.quantized_players[0]);
+	});
+
+	bench_run(ctx, "dequantize player", MAX_PLAYERS, [&]() {
+		for (uint32_t i = 0; i < MAX_PLAYERS; i++)
+		{
+			DATA.players[i] = dequantize(DATA.quantized_players[i]);
+		}
+		bench_keep(DATA.players[0]);
+	});
+
+	bench_run(ctx, "quantize shot", BENCH_INPUTS, [&]() {
+		for (uint32_t i = 0; i < BENCH_INPUTS; i++)
+		{
+			DATA.quantized_shots[i] = quantize(DATA.shots[i]);
+		}
+		bench_keep(DATA.quantized_shots[0]);
+	});
+
+	bench_run(ctx, "dequantize shot", BENCH_INPUTS, [&]() {
+		Shot last;
+		for (uint32_t i = 0; i < BENCH_INPUTS; i++)
+		{
+			last = dequantize(DATA.quantized_shots[i]);
+		}
+		bench_keep(last);
+	});
+}
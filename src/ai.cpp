@@ -18,10 +18,14 @@
 
 #include "ai.hpp"
 #include "game_types.hpp"
+#include "log.hpp"
 #include "math.hpp"
 #include "network_client.hpp"
 #include "map.hpp"
+#include "matchmaker.hpp"
 #include "quantization.hpp"
+#include "startup.hpp"
+#include "threads.hpp"
 #include "time.hpp"
 #include <cstdio>
 #include <glm/glm.hpp>
@@ -68,7 +72,7 @@
 
 #define COVER_STANDOFF_MULT	 1.5f
 #define LOS_BUFFER_DIST		 1.0f
-#define STUCK_MOVE_THRESHOLD 0.1f
+#define STUCK_SPEED			 6.0f /* units a second, slower than this with somewhere to go is stuck */
 #define ERROR_RANGE			 200
 #define ERROR_DIVISOR		 100.0f
 
@@ -343,21 +347,38 @@ find_closest_visible_enemy(fixed_array<Player, MAX_PLAYERS> &players, int8_t my_
  * rather polling window input, the inputs are generated by the decision making.
  */
 static void
-run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
+run_npc(const char *server_ip, uint16_t server_port, const char *npc_name, int32_t bind_port, StartupTimer *startup,
+		bool measure_startup)
 {
-	NetworkClient network = {};
+	startup_begin(startup);
+	if (server_port == 0)
+	{
+		if (!(server_port = matchmaker_find_match(server_ip, bind_port)))
+		{
+			LOG("%s has nowhere to play\n", npc_name);
+			return;
+		}
+		startup_phase(startup, "matchmaker");
+	}
+
+	/* NetworkClient carries its packet pool and peer table inline, too big for a thread's stack */
+	NetworkClient *heap_network = new NetworkClient();
+	NetworkClient &network = *heap_network;
 	if (!network_init(&network, nullptr, bind_port))
 	{
-		printf("NPC failed to initialize\n");
+		LOG("NPC failed to initialize\n");
+		delete heap_network;
 		return;
 	}
 
-	uint32_t server_peer_id = network_add_peer(&network, server_ip, SERVER_PORT);
+	network_set_channel_mode(&network, CHANNEL_CONTROL, DELIVERY_ORDERED);
+	uint32_t server_peer_id = network_add_peer(&network, server_ip, server_port);
+	startup_phase(startup, "network");
 
 	SendPacket<ConnectRequest> connect_req = {};
 	connect_req.payload.type = MSG_CONNECT_REQUEST;
 	strncpy(connect_req.payload.player_name, npc_name, 31);
-	network_send_reliable(&network, server_peer_id, connect_req);
+	network_send_reliable(&network, server_peer_id, connect_req, CHANNEL_CONTROL);
 
 	int8_t	  my_idx = -1;
 	glm::vec3 my_pos(0);
@@ -365,8 +386,9 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 	uint8_t	  my_health = 100;
 	float	  yaw = 0, pitch = 0;
 	float	  shoot_cooldown = 0;
-	float	  server_time = 0;
+	Tick	  server_tick = 0;
 	uint32_t  input_seq = 0;
+	float	  tick_time = 1.0f / DEFAULT_TICK_RATE; /* the server's once it accepts us */
 
 	NPCState state = NPC_WANDER;
 
@@ -375,17 +397,20 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 	float	  stuck_timer = 0;
 	float	  state_timer = 0;
 
+	/* The connect request is already out, the handshake overlaps these */
 	Map								 map = generate_map();
 	fixed_array<OBB, MAX_OBSTACLES>	 obbs = map.obb_geometry;
 	fixed_array<Player, MAX_PLAYERS> players;
+	startup_phase(startup, "map");
 
 	SpatialData spatial = generate_spatial_data(map);
+	startup_phase(startup, "spatial data");
 
 	while (1)
 	{
 		TimePoint frame_start = time_now();
 
-		network_update(&network, TICK_TIME);
+		network_update(&network, tick_time);
 
 		Polled polled;
 		while (network_poll(&network, polled))
@@ -402,18 +427,27 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 			{
 				ConnectAccept *accept = (ConnectAccept *)polled.buffer;
 				my_idx = accept->player_index;
-				server_time = accept->server_time;
-				printf("%s connected as player index %d\n", npc_name, my_idx);
+				server_tick = accept->server_tick;
+				tick_time = 1.0f / (accept->tick_rate ? accept->tick_rate : DEFAULT_TICK_RATE);
+				startup_phase(startup, "handshake");
+				startup_milestone(startup, "connected");
+				LOG("%s connected as player index %d after %.1fms\n", npc_name, my_idx, startup_elapsed_ms(startup));
 			}
 			else if (msg_type == MSG_SERVER_SNAPSHOT)
 			{
 				SnapshotMessage *snap = (SnapshotMessage *)polled.buffer;
-				server_time = snap->server_time;
+				if (polled.size < sizeof(SnapshotMessage) || polled.size < snapshot_size(snap->player_count, 0))
+				{
+					network_release_buffer(&network, polled.buffer_index);
+					continue;
+				}
+				server_tick = snap->server_tick;
 
+				QuantizedPlayer *snap_players = snapshot_players(snap);
 				players.clear();
 				for (uint8_t i = 0; i < snap->player_count; i++)
 				{
-					Player p = dequantize(snap->players[i]);
+					Player p = dequantize(snap_players[i]);
 					players.push(p);
 					if (p.player_idx == my_idx)
 					{
@@ -426,6 +460,11 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 			network_release_buffer(&network, polled.buffer_index);
 		}
 
+		if (measure_startup && my_idx >= 0)
+		{
+			break;
+		}
+
 		/* waiting to connect */
 		if (my_idx < 0)
 		{
@@ -433,14 +472,14 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 			continue;
 		}
 
-		server_time += TICK_TIME;
-		shoot_cooldown -= TICK_TIME;
-		state_timer += TICK_TIME;
+		server_tick++;
+		shoot_cooldown -= tick_time;
+		state_timer += tick_time;
 
 		float movement = glm::length(my_pos - last_pos);
-		if (movement < STUCK_MOVE_THRESHOLD * TICK_RATE && has_target_position)
+		if (movement < STUCK_SPEED * tick_time && has_target_position)
 		{
-			stuck_timer += TICK_RATE;
+			stuck_timer += tick_time;
 			if (stuck_timer > TIME_STUCK_THRESHOLD)
 			{
 				has_target_position = false;
@@ -495,7 +534,7 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 				{
 					target_position = spatial.cover_points[cover_idx].position;
 					has_target_position = true;
-					printf("%s retreating to cover\n", npc_name);
+					LOG("%s retreating to cover\n", npc_name);
 				}
 			}
 		}
@@ -607,12 +646,14 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 		input.payload.look_yaw = yaw;
 		input.payload.look_pitch = pitch;
 		input.payload.buttons = buttons;
-		input.payload.shot_time = (buttons & 1) ? server_time : 0;
-		input.payload.time = server_time;
+		input.payload.shot_tick = (buttons & 1) ? server_tick : 0;
+		/* Decided once a tick, so everything happens at its start */
+		input.payload.press_yaw = yaw;
+		input.payload.press_pitch = pitch;
 
 		network_send_unreliable(&network, server_peer_id, input);
 		float frame_time = time_elapsed_seconds(frame_start);
-		float sleep_time = TICK_TIME - frame_time;
+		float sleep_time = tick_time - frame_time;
 
 		if (sleep_time > 0.001f)
 		{
@@ -621,12 +662,15 @@ run_npc(const char *server_ip, const char *npc_name, int32_t bind_port)
 	}
 
 	network_shutdown(&network);
+	delete heap_network;
 }
 
 void
-ai_run_npcs(const char *server_ip, const char *base_name, int32_t count)
+ai_run_npcs(const char *server_ip, uint16_t server_port, const char *base_name, int32_t count, const int16_t *cpus,
+			uint32_t cpu_count, bool measure_startup)
 {
-	std::vector<std::thread> threads;
+	std::vector<std::thread>	threads;
+	std::vector<StartupTimer> startups(count);
 	threads.reserve(count);
 
 	for (int32_t i = 0; i < count; i++)
@@ -634,7 +678,14 @@ ai_run_npcs(const char *server_ip, const char *base_name, int32_t count)
 		char npc_name[64];
 		snprintf(npc_name, sizeof(npc_name), "%s_%d", base_name, i);
 
-		threads.emplace_back([server_ip, npc_name]() { run_npc(server_ip, npc_name, 0); });
+		StartupTimer *startup = &startups[i];
+		threads.emplace_back([server_ip, server_port, npc_name, startup, measure_startup]() {
+			run_npc(server_ip, server_port, npc_name, 0, startup, measure_startup);
+		});
+		if (cpu_count)
+		{
+			thread_pin(threads.back(), cpus[i % cpu_count]);
+		}
 	}
 
 	printf("Waiting for %zu NPC threads \n", threads.size());
@@ -646,4 +697,7 @@ ai_run_npcs(const char *server_ip, const char *base_name, int32_t count)
 			thread.join();
 		}
 	}
+
+	/* Only once they've all stopped, which is straight after connecting when measuring */
+	startup_print_report(startups.data(), startups.size(), "NPCs");
 }
@@ -1,3 +1,11 @@
 #pragma once
+#include <cstdint>
+
+/*
+ * server_port 0 means each NPC asks the matchmaker at server_ip where to play.
+ * With cpus, NPC threads are pinned to them round robin.
+ * measure_startup stops each NPC once it's connected, and reports how long they took (see startup.hpp)
+ */
 void
-ai_run_npcs(const char *server_ip, const char *base_name, int count);
+ai_run_npcs(const char *server_ip, uint16_t server_port, const char *base_name, int count, const int16_t *cpus,
+			uint32_t cpu_count, bool measure_startup);
@@ -0,0 +1,91 @@
+#pragma once
+/*
+ * Match checkpoint file, written by the server (see checkpoint_match in server.cpp) for crash
+ * recovery and offline analysis. Everything is packed and fixed width so it can be read by anything,
+ * not just the build that wrote it:
+ *
+ *   CheckpointHeader
+ *   CheckpointClient[max_players]   who held each slot
+ *   CheckpointPlayer[max_players]   the simulation state at 'tick'
+ *   history_count times:
+ *     CheckpointFrame
+ *     CheckpointPlayer[player_count]
+ *   CheckpointRespawn[respawn_count]
+ *
+ * The file is written next to its final name and renamed over it, so a reader never sees half of one.
+ */
+#include "game_types.hpp"
+#include <cstdint>
+
+#define CHECKPOINT_VERSION 2
+
+#pragma pack(push, 1)
+
+struct CheckpointHeader
+{
+	char	 magic[4]; /* "CODC" */
+	uint16_t version;
+	uint8_t	 max_players;
+	uint64_t tick;
+	uint16_t tick_rate; /* what a tick is worth */
+	uint16_t history_count;
+	uint8_t	 respawn_count;
+};
+
+struct CheckpointClient
+{
+	uint8_t	 active;
+	char	 name[32];
+	uint32_t last_processed_input;
+};
+
+struct CheckpointPlayer
+{
+	int8_t	 player_idx;
+	uint32_t last_processed_seq;
+	float	 position[3];
+	float	 velocity[3];
+	float	 yaw, pitch;
+	uint8_t	 on_ground;
+	int8_t	 health;
+	uint8_t	 wall_running;
+	float	 wall_normal[3];
+	int16_t	 wall_index;
+	uint8_t	 jumps_remaining;
+};
+
+struct CheckpointFrame
+{
+	uint64_t tick;
+	uint8_t	 player_count;
+};
+
+struct CheckpointRespawn
+{
+	int8_t	 player_index;
+	uint64_t respawn_tick;
+};
+
+#pragma pack(pop)
+
+inline CheckpointPlayer
+checkpoint_player(const Player &p)
+{
+	CheckpointPlayer out = {};
+	out.player_idx = p.player_idx;
+	out.last_processed_seq = p.last_processed_seq;
+	for (int i = 0; i < 3; i++)
+	{
+		out.position[i] = p.position[i];
+		out.velocity[i] = p.velocity[i];
+		out.wall_normal[i] = p.wall_normal[i];
+	}
+	out.yaw = p.yaw;
+	out.pitch = p.pitch;
+	out.on_ground = p.on_ground;
+	out.health = p.health;
+	out.wall_running = p.wall_running;
+	out.wall_index = p.wall_index;
+	out.jumps_remaining = p.jumps_remaining;
+	return out;
+}
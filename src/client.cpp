@@ -25,11 +25,18 @@
  * latency, which feels unbearable, so we run the simulation on the client, just for our
  * player using the inputs we send to the server.
  *
+ * Everything received can also be recorded to a demo (demo.hpp) and played back later, playback
+ * feeds the recorded messages through the same handlers instead of the network. Spectating a relay
+ * (relay.cpp) is the same again with the messages coming live: no input, no prediction, just a
+ * camera following whoever we're watching.
+ *
  */
 #include "client.hpp"
 #include "client_extended.hpp"
 #include "containers.hpp"
+#include "demo.hpp"
 #include "game_types.hpp"
+#include "log.hpp"
 #include "map.hpp"
 #include "math.hpp"
 #include "network_client.hpp"
@@ -37,6 +44,7 @@
 #include "profiler.hpp"
 #include "quantization.hpp"
 #include "renderer.hpp"
+#include "startup.hpp"
 #include "time.hpp"
 #include "window.hpp"
 #include <cmath>
@@ -58,6 +66,9 @@
 
 #define TELEPORT_THRESHOLD 10.0f
 
+#define DEMO_SEEK_STEP	   5.0f
+#define KEEPALIVE_INTERVAL 0.5f
+
 /*
  * before player 1: pos(0,0,0)
  * after  player 1: pos(0,0,1)
@@ -83,6 +94,8 @@ static struct
 	 */
 	int8_t player_idx;
 	bool   connected;
+	/* Whose eyes the camera is behind, ours unless we're watching a demo or spectating */
+	int8_t view_idx;
 	/*
 	 * Both client and server will have a copy of this in
 	 * order to do physics
@@ -90,9 +103,16 @@ static struct
 	Map map;
 	/*
 	 * When we connect, we set our time as the server time and incremented it with
-	 * dt, so our server time will be roughly half the rtt behind the servers actual time
+	 * dt, so our server time will be roughly half the rtt behind the servers actual time.
+	 *
+	 * The server counts in ticks, we keep float seconds relative to the tick we connected on,
+	 * so precision depends on how long we've been connected rather than on server uptime
 	 */
+	Tick  epoch_tick;
 	float server_time;
+	/* The server's, from the connect accept. We send an input per tick so we step at it too */
+	uint16_t tick_rate;
+	float	 tick_time;
 	/*
 	 * We keep the last n snapshots and render some time before
 	 * the server_time, which allows us to interpolate between
@@ -122,6 +142,11 @@ static struct
 	 */
 	ring_buffer<InputMessage, 64> input_history;
 	uint32_t					  input_sequence; /* increments per input aka per frame */
+	/*
+	 * The last input the server says it processed, kept for when it's left input_history. The server
+	 * splits the first input after it against this one, so replaying has to as well
+	 */
+	InputMessage confirmed_input;
 	Player						  local_player;
 
 	Window	 window;
@@ -130,12 +155,25 @@ static struct
 	ClientRenderState				 visuals;
 	fixed_array<Player, MAX_PLAYERS> frame;
 
+	/* Set with --record, the demo is opened once we know our player index */
+	const char *record_path;
+	DemoWriter	demo;
+	/*
+	 * What demo records are stamped with, the newest snapshot's tick. Not server_time, which jumps back
+	 * when we resync, and seeking needs the records in time order
+	 */
+	float record_time;
+	DemoPlayer	playback;
+
+	/* From the start of run_client to the first frame shown */
+	StartupTimer startup;
+
 } CLIENT;
 
 Player *
 find_local(fixed_array<Player, MAX_PLAYERS> *players)
 {
-	if (CLIENT.player_idx < 0 && CLIENT.player_idx >= MAX_PLAYERS)
+	if (CLIENT.player_idx < 0 || CLIENT.player_idx >= MAX_PLAYERS)
 	{
 		return nullptr;
 	}
@@ -147,36 +185,99 @@ find_local(Snapshot *snapshot)
 	return find_local(&snapshot->players);
 }
 
+float
+tick_to_client_time(Tick tick)
+{
+	return ticks_to_seconds((int64_t)(tick - CLIENT.epoch_tick), CLIENT.tick_rate);
+}
+
+Tick
+client_time_to_tick(float time)
+{
+	int64_t ticks = seconds_to_ticks(time, CLIENT.tick_rate);
+	return ticks > 0 ? CLIENT.epoch_tick + ticks : CLIENT.epoch_tick;
+}
+
+/* The tick before 'time', and how far on from it towards the next 'time' is */
+Tick
+client_time_to_subtick(float time, uint8_t *fraction)
+{
+	float ticks = time * CLIENT.tick_rate;
+	if (ticks <= 0.0f)
+	{
+		*fraction = 0;
+		return CLIENT.epoch_tick;
+	}
+	float whole = floorf(ticks);
+	*fraction = fraction_to_subtick(ticks - whole);
+	return CLIENT.epoch_tick + (int64_t)whole;
+}
+
 void
 process_connect_accept(ConnectAccept *msg)
 {
 	CLIENT.player_idx = msg->player_index;
-	CLIENT.server_time = msg->server_time;
+	CLIENT.view_idx = msg->player_index;
+	CLIENT.epoch_tick = msg->server_tick;
+	CLIENT.server_time = 0.0f;
+	CLIENT.record_time = 0.0f;
+	CLIENT.tick_rate = msg->tick_rate ? msg->tick_rate : DEFAULT_TICK_RATE;
+	CLIENT.tick_time = 1.0f / CLIENT.tick_rate;
 	CLIENT.connected = true;
+	startup_phase(&CLIENT.startup, "handshake");
 	CLIENT.map = generate_map();
+	startup_phase(&CLIENT.startup, "map");
+	startup_milestone(&CLIENT.startup, "connected");
+
+	LOG("Connected player index: %d, %u ticks a second\n", CLIENT.player_idx, CLIENT.tick_rate);
 
-	printf("Connected player index: %d\n", CLIENT.player_idx);
+	if (CLIENT.record_path)
+	{
+		demo_writer_open(&CLIENT.demo, CLIENT.record_path, CLIENT.player_idx, CLIENT.epoch_tick, CLIENT.tick_rate);
+	}
 }
 
 void
-process_snapshot(SnapshotMessage *snap)
+process_snapshot(SnapshotMessage *snap, uint16_t size)
 {
+	if (size < sizeof(SnapshotMessage) || size < snapshot_size(snap->player_count, snap->shot_count))
+	{
+		return;
+	}
+
 	/* ideally 0.0f, but will drift over time */
-	float time_diff = snap->server_time = CLIENT.server_time;
+	float snapshot_time = tick_to_client_time(snap->server_tick);
+	float time_diff = snapshot_time - CLIENT.server_time;
 	if (std::abs(time_diff) > TIME_SYNC_LARGE_CORRECTION)
 	{
-		CLIENT.server_time = snap->server_time;
+		CLIENT.server_time = snapshot_time;
 	}
+	CLIENT.record_time = fmaxf(CLIENT.record_time, snapshot_time);
 
-	Snapshot snapshot = {.timestamp = snap->server_time};
+	Snapshot snapshot = {.tick = snap->server_tick};
 
+	QuantizedPlayer *players = snapshot_players(snap);
 	for (int32_t i = 0; i < snap->player_count; i++)
 	{
-		snapshot.players.push(dequantize(snap->players[i]));
+		snapshot.players.push(dequantize(players[i]));
 	}
 
 	CLIENT.snapshots.push(snapshot);
 
+	QuantizedShot *shots = snapshot_shots(snap);
+	for (uint8_t i = 0; i < snap->shot_count; i++)
+	{
+		Shot shot = dequantize(shots[i]);
+		/* To our client, the rays are just visuals, so we can adjust them */
+		if (shot.shooter_idx == CLIENT.player_idx)
+		{
+			shot.ray.origin = calculate_gun_position(CLIENT.visuals.camera, CLIENT.visuals.gun);
+		}
+
+		add_shot_trail(&CLIENT.visuals.effects, shot, CLIENT.server_time);
+	}
+
+	/* Spectators have nobody to reconcile */
 	Player *local = find_local(&snapshot);
 
 	if (!local)
@@ -198,6 +299,10 @@ process_snapshot(SnapshotMessage *snap)
 	for (uint32_t i = 0; i < CLIENT.input_history.size(); i++)
 	{
 		InputMessage *input = CLIENT.input_history.at(i);
+		if (input->sequence_num == local->last_processed_seq)
+		{
+			CLIENT.confirmed_input = *input;
+		}
 
 		/*
 		 * For every input that the server has not processed, reapply, hopefully
@@ -205,8 +310,16 @@ process_snapshot(SnapshotMessage *snap)
 		 */
 		if (input->sequence_num > local->last_processed_seq)
 		{
-			apply_player_input(&corrected_state, input, TICK_TIME);
-			apply_player_physics(&corrected_state, CLIENT.map, CLIENT.snapshots.end().data->players, TICK_TIME);
+			InputMessage *previous = i > 0 ? CLIENT.input_history.at(i - 1) : nullptr;
+			InputMessage *confirmed = &CLIENT.confirmed_input;
+			if (!replayed && confirmed->type && confirmed->sequence_num == local->last_processed_seq)
+			{
+				previous = confirmed;
+			}
+			float rest = apply_held_input(&corrected_state, previous, input, CLIENT.map,
+										  CLIENT.snapshots.end().data->players, CLIENT.tick_time);
+			apply_player_input(&corrected_state, input, rest);
+			apply_player_physics(&corrected_state, CLIENT.map, CLIENT.snapshots.end().data->players, rest);
 			replayed++;
 		}
 	}
@@ -225,19 +338,49 @@ process_snapshot(SnapshotMessage *snap)
 
 	if (error >= 0.4f)
 	{
-		printf("Correction error: %.3f, replayed %u/%zu inputs\n", error, replayed, CLIENT.input_history.size());
+		LOG("Correction error: %.3f, replayed %u/%zu inputs\n", error, replayed, CLIENT.input_history.size());
 	}
+}
 
-	for (uint8_t i = 0; i < snap->shot_count; i++)
+/*
+ * Messages from the server, or from a demo during playback, which is why the
+ * buffer is const and the handlers don't know where it came from
+ */
+void
+dispatch_message(const uint8_t *buffer, uint16_t size)
+{
+	uint8_t msg_type = buffer[0];
+
+	switch (msg_type)
 	{
-		Shot shot = dequantize(snap->shots[i]);
-		/* To our client, the rays are just visuals, so we can adjust them */
-		if (shot.shooter_idx == CLIENT.player_idx)
+	case MSG_SERVER_SNAPSHOT:
+		process_snapshot((SnapshotMessage *)buffer, size);
+		break;
+	case MSG_PLAYER_DIED: {
+		if (size < sizeof(PlayerKilledEvent))
 		{
-			shot.ray.origin = calculate_gun_position(CLIENT.visuals.camera, CLIENT.visuals.gun);
+			break;
 		}
-
-		add_shot_trail(&CLIENT.visuals.effects, shot, CLIENT.server_time);
+		PlayerKilledEvent *event = (PlayerKilledEvent *)buffer;
+		ui_add_kill(&CLIENT.visuals.ui, event->killer_idx, event->killed_idx, CLIENT.server_time);
+		break;
+	}
+	case MSG_PLAYER_LEFT: {
+		if (size < sizeof(PlayerLeftEvent))
+		{
+			break;
+		}
+		PlayerLeftEvent *e = (PlayerLeftEvent *)buffer;
+		ui_add_player_left(&CLIENT.visuals.ui, e->player_idx, CLIENT.server_time);
+		break;
+	}
+	case MSG_CONNECT_ACCEPT:
+		process_connect_accept((ConnectAccept *)buffer);
+		break;
+	case MSG_KEEPALIVE:
+		break;
+	default:
+		assert(false && "Unhandled Message\n");
 	}
 }
 
@@ -254,28 +397,17 @@ client_process_packets()
 	while (network_poll(&CLIENT.net, polled))
 	{
 		assert(polled.size >= 1);
-		uint8_t msg_type = polled.buffer[0];
+		dispatch_message(polled.buffer, polled.size);
 
-		switch (msg_type)
+		/* The connect accept is already in the demo header, everything else is kept as it arrived */
+		uint8_t msg_type = polled.buffer[0];
+		if (msg_type == MSG_SERVER_SNAPSHOT)
 		{
-		case MSG_SERVER_SNAPSHOT:
-			process_snapshot((SnapshotMessage *)polled.buffer);
-			break;
-		case MSG_PLAYER_DIED: {
-			PlayerKilledEvent *event = (PlayerKilledEvent *)polled.buffer;
-			ui_add_kill(&CLIENT.visuals.ui, event->killer_idx, event->killed_idx, CLIENT.server_time);
-			break;
-		}
-		case MSG_PLAYER_LEFT: {
-			PlayerLeftEvent *e = (PlayerLeftEvent *)polled.buffer;
-			ui_add_player_left(&CLIENT.visuals.ui, e->player_idx, CLIENT.server_time);
-			break;
+			demo_write_snapshot(&CLIENT.demo, CLIENT.record_time, polled.buffer, polled.size);
 		}
-		case MSG_CONNECT_ACCEPT:
-			process_connect_accept((ConnectAccept *)polled.buffer);
-			break;
-		default:
-			assert(false && "Unhandled Message\n");
+		else if (msg_type != MSG_CONNECT_ACCEPT)
+		{
+			demo_write_event(&CLIENT.demo, CLIENT.record_time, polled.buffer, polled.size);
 		}
 
 		/* We've done what we need to with the packet data, release it for reuse */
@@ -299,7 +431,10 @@ get_interpolated_snapshot(float render_time)
 		Snapshot *current = snapshots.at(i);
 		Snapshot *next = snapshots.at(i + 1);
 
-		if (next->timestamp >= render_time && current->timestamp <= render_time)
+		float current_time = tick_to_client_time(current->tick);
+		float next_time = tick_to_client_time(next->tick);
+
+		if (next_time >= render_time && current_time <= render_time)
 		{
 			/*
 			 * Find two snapshots for before and after our render_time (server_time - some time),
@@ -313,10 +448,10 @@ get_interpolated_snapshot(float render_time)
 			result.before = current;
 			result.after = next;
 
-			float duration = next->timestamp - current->timestamp;
+			float duration = next_time - current_time;
 			if (duration > 0.001f)
 			{
-				result.t = glm::clamp((render_time - current->timestamp) / duration, 0.0f, 1.0f);
+				result.t = glm::clamp((render_time - current_time) / duration, 0.0f, 1.0f);
 			}
 			break;
 		}
@@ -418,7 +553,7 @@ update_render_time()
 	 * Here the future_buffer acts as an indicator for network quality
 	 */
 
-	float newest_time = CLIENT.snapshots.back()->timestamp;
+	float newest_time = tick_to_client_time(CLIENT.snapshots.back()->tick);
 	float future_buffer = newest_time - CLIENT.render_time;
 
 	if (future_buffer < MIN_DELAY)
@@ -456,17 +591,33 @@ sync_render_time(float dt)
 }
 
 void
-apply_input(float move_x, float move_z, uint8_t buttons)
+apply_input(PlayerInput *player_input, float dt)
 {
 	SendPacket<InputMessage> input;
 	input.payload.type = MSG_CLIENT_INPUT;
 	input.payload.sequence_num = CLIENT.input_sequence++;
-	input.payload.move_x = move_x;
-	input.payload.move_z = move_z;
+	input.payload.move_x = player_input->move_x;
+	input.payload.move_z = player_input->move_z;
 	input.payload.look_yaw = CLIENT.visuals.camera.yaw;
 	input.payload.look_pitch = CLIENT.visuals.camera.pitch;
-	input.payload.buttons = buttons;
-	input.payload.time = CLIENT.render_time;
+	input.payload.buttons = player_input->buttons;
+
+	/*
+	 * Whatever changed did so partway through the frame that's just gone, with the crosshair wherever the
+	 * mouse had got to by then. Without this a click is as if it happened at the frame's start, up to a
+	 * whole tick early, aiming where the mouse was a tick before
+	 */
+	input.payload.press_fraction = fraction_to_subtick(player_input->press_fraction);
+	camera_look_after(&CLIENT.visuals.camera, player_input->press_mouse_dx, player_input->press_mouse_dy,
+					  &input.payload.press_yaw, &input.payload.press_pitch);
+
+	/* What we're seeing is render_time, so that's when the server should test our shot, as of the click */
+	float press_time = CLIENT.render_time;
+	if (player_input->press_fraction > 0.0f)
+	{
+		press_time -= (1.0f - player_input->press_fraction) * dt;
+	}
+	input.payload.shot_tick = client_time_to_subtick(press_time, &input.payload.shot_fraction);
 
 	/*
 	 * Older games would buffer inputs and send them in batches 1-4 frames,
@@ -476,11 +627,19 @@ apply_input(float move_x, float move_z, uint8_t buttons)
 	network_send_unreliable(&CLIENT.net, CLIENT.server_peer_id, input);
 
 	/* Sent to server, but immediately apply it */
+	InputMessage previous;
+	bool		 has_previous = !CLIENT.input_history.empty();
+	if (has_previous)
+	{
+		previous = *CLIENT.input_history.back();
+	}
 	CLIENT.input_history.push(input.payload);
 
-	/* Functions shared with the server */
-	apply_player_input(&CLIENT.local_player, &input.payload, TICK_TIME);
-	apply_player_physics(&CLIENT.local_player, CLIENT.map, CLIENT.snapshots.end().data->players, TICK_TIME);
+	/* Functions shared with the server, split the same way it will */
+	float rest = apply_held_input(&CLIENT.local_player, has_previous ? &previous : nullptr, &input.payload, CLIENT.map,
+								  CLIENT.snapshots.end().data->players, CLIENT.tick_time);
+	apply_player_input(&CLIENT.local_player, &input.payload, rest);
+	apply_player_physics(&CLIENT.local_player, CLIENT.map, CLIENT.snapshots.end().data->players, rest);
 }
 
 void
@@ -497,7 +656,7 @@ update(float dt)
 		window_set_cursor_lock(&CLIENT.window, false);
 	}
 
-	apply_input(input.move_x, input.move_z, input.buttons);
+	apply_input(&input, dt);
 	client_process_packets();
 
 	update_camera(&CLIENT.visuals.camera, CLIENT.local_player.position, input.mouse_dx, input.mouse_dy, input.move_x,
@@ -526,7 +685,7 @@ render()
 		render_setup_camera(&CLIENT.renderer, CLIENT.visuals.camera);
 		render_space_skybox(&CLIENT.renderer);
 		render_world(&CLIENT.renderer, CLIENT.map);
-		render_entities(&CLIENT.renderer, CLIENT.frame, CLIENT.player_idx);
+		render_entities(&CLIENT.renderer, CLIENT.frame, CLIENT.view_idx);
 		render_shot_trails(&CLIENT.renderer, CLIENT.visuals.effects, CLIENT.server_time);
 		render_first_person_gun(&CLIENT.renderer, CLIENT.visuals.camera, CLIENT.visuals.gun);
 	}
@@ -535,8 +694,12 @@ render()
 	render_ui(&CLIENT.renderer, CLIENT.visuals.ui, CLIENT.server_time);
 }
 
+/*
+ * Sends 'request' (its header left blank) to ip:remote_port and waits for the connect accept, which is
+ * how playing (a ConnectRequest to the server) and spectating (a SpectateRequest to a relay) both start
+ */
 bool
-init(const char *server_ip, const char *player_name, int port)
+init(const char *ip, uint16_t remote_port, int port, void *request, uint16_t request_size)
 {
 	CLIENT.player_idx = -1;
 
@@ -554,14 +717,13 @@ init(const char *server_ip, const char *player_name, int port)
 		printf("Failed to initialize network\n");
 		return false;
 	}
+	startup_phase(&CLIENT.startup, "network");
 
-	CLIENT.server_peer_id = network_add_peer(&CLIENT.net, server_ip, 7777);
+	network_set_channel_mode(&CLIENT.net, CHANNEL_CONTROL, DELIVERY_ORDERED);
+	CLIENT.server_peer_id = network_add_peer(&CLIENT.net, ip, remote_port);
 
-	SendPacket<ConnectRequest> req = {};
-	req.payload.type = MSG_CONNECT_REQUEST;
-	strncpy(req.payload.player_name, player_name, 31);
-	printf("Connecting to %s:7777 \n", server_ip);
-	network_send_reliable(&CLIENT.net, CLIENT.server_peer_id, req);
+	printf("Connecting to %s:%u \n", ip, remote_port);
+	network_send_packet(&CLIENT.net, CLIENT.server_peer_id, request, request_size, true, CHANNEL_CONTROL);
 
 	TimePoint start_time = time_now();
 	while (!CLIENT.connected)
@@ -583,34 +745,78 @@ init(const char *server_ip, const char *player_name, int port)
 void
 shutdown()
 {
+	demo_writer_close(&CLIENT.demo);
 	network_shutdown(&CLIENT.net);
 }
 
-void
-run_client(const char *server_ip, const char *player_name, int port, int x, int y, int width, int height)
+bool
+open_window(const char *title, int x, int y, int width, int height)
 {
-	if (!window_init(&CLIENT.window, width, height, "Game Client"))
+	if (!window_init(&CLIENT.window, width, height, title))
 	{
 		printf("Failed to initialize window\n");
-		return;
+		return false;
 	}
 
 	window_set_position(&CLIENT.window, x, y);
+	startup_phase(&CLIENT.startup, "window and GL context");
 
 	if (!renderer_init(&CLIENT.renderer, window_get_handle(&CLIENT.window)))
 	{
 		printf("Failed to initialize renderer\n");
 		window_shutdown(&CLIENT.window);
-		return;
+		return false;
 	}
 
 	renderer_set_light(&CLIENT.renderer, glm::vec3(0, 20, 0), glm::vec3(1, 1, 1), 1.0f);
+	startup_phase(&CLIENT.startup, "renderer");
+	return true;
+}
 
-	if (!init(server_ip, player_name, port))
+void
+close_window()
+{
+	renderer_shutdown(&CLIENT.renderer);
+	window_shutdown(&CLIENT.window);
+}
+
+/*
+ * Called after each frame is swapped, the first one finishes the startup report.
+ * True when that was all we were running for
+ */
+static bool
+startup_frame_shown(uint32_t frame_count, bool measure_startup)
+{
+	if (frame_count != 1)
+	{
+		return false;
+	}
+
+	startup_phase(&CLIENT.startup, "first frame");
+	startup_milestone(&CLIENT.startup, "first frame shown");
+	startup_print_report(&CLIENT.startup, 1, "client");
+	return measure_startup;
+}
+
+void
+run_client(const char *server_ip, uint16_t server_port, const char *player_name, int port, const char *record_path,
+		   bool measure_startup, int x, int y, int width, int height)
+{
+	startup_begin(&CLIENT.startup);
+	if (!open_window("Game Client", x, y, width, height))
+	{
+		return;
+	}
+
+	SendPacket<ConnectRequest> req = {};
+	req.payload.type = MSG_CONNECT_REQUEST;
+	strncpy(req.payload.player_name, player_name, 31);
+
+	CLIENT.record_path = record_path;
+	if (!init(server_ip, server_port, port, &req, sizeof(req)))
 	{
 		printf("Failed to connect to server\n");
-		renderer_shutdown(&CLIENT.renderer);
-		window_shutdown(&CLIENT.window);
+		close_window();
 		return;
 	}
 
@@ -625,10 +831,9 @@ run_client(const char *server_ip, const char *player_name, int port, int x, int
 
 		TimePoint frame_start = time_now();
 
-		window_begin_frame(&CLIENT.window);
 		window_poll_events(&CLIENT.window);
 
-		adjustment_timer += TICK_TIME;
+		adjustment_timer += CLIENT.tick_time;
 		if (adjustment_timer > NETWORK_UPDATE_TIMER)
 		{
 			update_render_time();
@@ -637,9 +842,12 @@ run_client(const char *server_ip, const char *player_name, int port, int x, int
 		}
 		{
 			PROFILE_ZONE(&profiler, "Update");
-			update(TICK_TIME);
+			update(CLIENT.tick_time);
 			PROFILE_ZONE_END(profiler);
 		}
+
+		/* The input's been sent, whatever comes in from here is timed against now */
+		window_begin_frame(&CLIENT.window);
 		{
 			PROFILE_ZONE(&profiler, "Rendering");
 			render();
@@ -647,6 +855,10 @@ run_client(const char *server_ip, const char *player_name, int port, int x, int
 		}
 
 		window_swap_buffers(&CLIENT.window);
+		if (startup_frame_shown(profiler.frame_count, measure_startup))
+		{
+			break;
+		}
 
 		if (window_key(&CLIENT.window, GLFW_KEY_ESCAPE))
 		{
@@ -654,7 +866,7 @@ run_client(const char *server_ip, const char *player_name, int port, int x, int
 		}
 
 		float frame_time = time_elapsed_seconds(frame_start);
-		float sleep_time = TICK_TIME - frame_time;
+		float sleep_time = CLIENT.tick_time - frame_time;
 
 		if (profiler.frame_count % 300 == 0)
 		{
@@ -662,12 +874,278 @@ run_client(const char *server_ip, const char *player_name, int port, int x, int
 			profiler_reset_stats(&profiler);
 		}
 		if (sleep_time > 0.001f)
+		{
+			window_wait_events(&CLIENT.window, sleep_time);
+		}
+	}
+
+	shutdown();
+	close_window();
+}
+
+/*
+ * Feeds every recorded message up to 'until' through the handlers, with the clock set to when
+ * each arrived so shot trails and the kill feed age the way they did live
+ */
+void
+play_demo_until(float until)
+{
+	DemoMessage msg;
+	while (demo_next(&CLIENT.playback, until, &msg))
+	{
+		if (msg.time > CLIENT.server_time)
+		{
+			CLIENT.server_time = msg.time;
+		}
+		dispatch_message(msg.data, msg.size);
+	}
+}
+
+/*
+ * Jumping means starting from the keyframe before 'time', so everything derived from the
+ * snapshots we had is thrown away and rebuilt by replaying from there
+ */
+void
+seek_demo(float time)
+{
+	time = glm::clamp(time, 0.0f, CLIENT.playback.duration);
+
+	float keyframe_time = demo_seek(&CLIENT.playback, time);
+	CLIENT.snapshots.clear();
+	CLIENT.visuals.effects.shot_trails.clear();
+	CLIENT.visuals.ui.events.clear();
+
+	CLIENT.server_time = keyframe_time;
+	play_demo_until(time);
+	CLIENT.server_time = time;
+	CLIENT.render_time = time - CLIENT.current_delay;
+}
+
+/*
+ * Watching rather than playing, the camera sits behind view_idx. They're interpolated like everyone
+ * else since there's nothing to predict, and stand in for local_player so the death screen still works
+ */
+void
+follow_view_player(float dt)
+{
+	for (Player &player : CLIENT.frame)
+	{
+		if (player.player_idx == CLIENT.view_idx)
+		{
+			CLIENT.local_player = player;
+			break;
+		}
+	}
+
+	Player *viewer = &CLIENT.local_player;
+	CLIENT.visuals.camera.yaw = viewer->yaw;
+	CLIENT.visuals.camera.pitch = viewer->pitch;
+	update_camera(&CLIENT.visuals.camera, viewer->position, 0.0f, 0.0f, 0.0f, dt, false, glm::vec3(0));
+
+	bool is_moving = glm::length(viewer->velocity) > 0.1f;
+	update_gun_animation(&CLIENT.visuals.gun, 0.0f, 0.0f, false, is_moving, dt);
+	update_visual_effects(&CLIENT.visuals.effects, CLIENT.server_time);
+}
+
+/*
+ * Playback is the client without input or prediction: the messages come from the demo,
+ * and the camera is wherever the recording player was looking
+ */
+void
+update_playback(float dt)
+{
+	if (window_key_pressed(&CLIENT.window, GLFW_KEY_RIGHT))
+	{
+		seek_demo(CLIENT.server_time + DEMO_SEEK_STEP);
+	}
+	if (window_key_pressed(&CLIENT.window, GLFW_KEY_LEFT))
+	{
+		seek_demo(CLIENT.server_time - DEMO_SEEK_STEP);
+	}
+
+	sync_render_time(dt);
+	ui_update(&CLIENT.visuals.ui, CLIENT.server_time);
+	CLIENT.server_time += dt;
+
+	play_demo_until(CLIENT.server_time);
+
+	InterpolatedSnapshot snap = get_interpolated_snapshot(CLIENT.render_time);
+	set_interpolated_players(&snap);
+	follow_view_player(dt);
+}
+
+void
+run_demo(const char *path, float speed, int x, int y, int width, int height)
+{
+	if (!demo_player_open(&CLIENT.playback, path))
+	{
+		return;
+	}
+
+	if (!open_window("Demo Playback", x, y, width, height))
+	{
+		demo_player_close(&CLIENT.playback);
+		return;
+	}
+
+	printf("Playing %s, %.1fs, %u keyframes. Left/Right to skip %.0fs\n", path, CLIENT.playback.duration,
+		   CLIENT.playback.index_count, DEMO_SEEK_STEP);
+
+	render_state_init(&CLIENT.visuals);
+	CLIENT.target_delay = 0.1f;
+	CLIENT.current_delay = 0.1f;
+
+	ConnectAccept accept = {};
+	accept.type = MSG_CONNECT_ACCEPT;
+	accept.player_index = CLIENT.playback.header.player_idx;
+	accept.server_tick = CLIENT.playback.header.epoch_tick;
+	accept.tick_rate = CLIENT.playback.header.tick_rate;
+	process_connect_accept(&accept);
+	CLIENT.render_time = CLIENT.server_time - CLIENT.current_delay;
+
+	/* Past the last message by the render delay, so the last snapshots are seen too */
+	while (!window_should_close(&CLIENT.window) && CLIENT.render_time < CLIENT.playback.duration)
+	{
+		TimePoint frame_start = time_now();
+
+		window_begin_frame(&CLIENT.window);
+		window_poll_events(&CLIENT.window);
+
+		update_render_time();
+		update_playback(CLIENT.tick_time * speed);
+		render();
+
+		window_swap_buffers(&CLIENT.window);
+
+		if (window_key(&CLIENT.window, GLFW_KEY_ESCAPE))
+		{
+			break;
+		}
+
+		float sleep_time = CLIENT.tick_time - time_elapsed_seconds(frame_start);
+		if (sleep_time > 0.001f)
+		{
+			sleep_seconds(sleep_time);
+		}
+	}
+
+	demo_player_close(&CLIENT.playback);
+	close_window();
+}
+
+/*
+ * Next or previous player in the frame after the one we're watching, wrapping around
+ */
+void
+cycle_view_player(int32_t direction)
+{
+	int32_t count = CLIENT.frame.size();
+	if (count == 0)
+	{
+		return;
+	}
+
+	int32_t current = -1;
+	for (int32_t i = 0; i < count; i++)
+	{
+		if (CLIENT.frame[i].player_idx == CLIENT.view_idx)
+		{
+			current = i;
+			break;
+		}
+	}
+
+	int32_t next = current < 0 ? 0 : (current + direction + count) % count;
+	CLIENT.view_idx = CLIENT.frame[next].player_idx;
+}
+
+void
+update_spectator(float dt)
+{
+	sync_render_time(dt);
+	ui_update(&CLIENT.visuals.ui, CLIENT.server_time);
+	CLIENT.server_time += dt;
+
+	client_process_packets();
+
+	InterpolatedSnapshot snap = get_interpolated_snapshot(CLIENT.render_time);
+	set_interpolated_players(&snap);
+
+	if (window_key_pressed(&CLIENT.window, GLFW_KEY_RIGHT))
+	{
+		cycle_view_player(1);
+	}
+	if (window_key_pressed(&CLIENT.window, GLFW_KEY_LEFT))
+	{
+		cycle_view_player(-1);
+	}
+	/* Nobody picked yet, or who we were watching left */
+	cycle_view_player(0);
+
+	follow_view_player(dt);
+}
+
+void
+run_spectator(const char *relay_ip, uint16_t relay_port, int port, uint8_t delay_bucket, int x, int y, int width,
+			  int height)
+{
+	if (!open_window("Spectator", x, y, width, height))
+	{
+		return;
+	}
+
+	SendPacket<SpectateRequest> req = {};
+	req.payload.type = MSG_SPECTATE_REQUEST;
+	req.payload.delay_bucket = delay_bucket;
+
+	if (!init(relay_ip, relay_port, port, &req, sizeof(req)))
+	{
+		printf("Failed to connect to relay\n");
+		close_window();
+		return;
+	}
+	window_set_cursor_lock(&CLIENT.window, false);
+	printf("Spectating, Left/Right to switch player\n");
+
+	SendPacket<Keepalive> keepalive = {};
+	keepalive.payload.type = MSG_KEEPALIVE;
+	float keepalive_timer = 0.0f;
+
+	while (!window_should_close(&CLIENT.window))
+	{
+		TimePoint frame_start = time_now();
+
+		window_begin_frame(&CLIENT.window);
+		window_poll_events(&CLIENT.window);
+
+		update_render_time();
+		network_update(&CLIENT.net, CLIENT.tick_time);
+
+		/* We never send inputs, the relay still needs to hear from us */
+		keepalive_timer += CLIENT.tick_time;
+		if (keepalive_timer >= KEEPALIVE_INTERVAL)
+		{
+			network_send_unreliable(&CLIENT.net, CLIENT.server_peer_id, keepalive);
+			keepalive_timer = 0.0f;
+		}
+
+		update_spectator(CLIENT.tick_time);
+		render();
+
+		window_swap_buffers(&CLIENT.window);
+
+		if (window_key(&CLIENT.window, GLFW_KEY_ESCAPE))
+		{
+			break;
+		}
+
+		float sleep_time = CLIENT.tick_time - time_elapsed_seconds(frame_start);
+		if (sleep_time > 0.001f)
 		{
 			sleep_seconds(sleep_time);
 		}
 	}
 
 	shutdown();
-	renderer_shutdown(&CLIENT.renderer);
-	window_shutdown(&CLIENT.window);
+	close_window();
 }
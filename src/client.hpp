@@ -1,4 +1,18 @@
 #pragma once
+#include <cstdint>
 
+/*
+ * record_path may be null, otherwise everything received is written to a demo there.
+ * measure_startup quits once the first frame is shown, after the startup report (see startup.hpp)
+ */
 void
-run_client(const char *server_ip, const char *player_name, int port, int x, int y, int width, int height);
+run_client(const char *server_ip, uint16_t server_port, const char *player_name, int port, const char *record_path,
+		   bool measure_startup, int x, int y, int width, int height);
+
+void
+run_demo(const char *path, float speed, int x, int y, int width, int height);
+
+/* Watches the game through the relay at relay_ip:relay_port, delay_bucket picks how far behind live (see relay.cpp) */
+void
+run_spectator(const char *relay_ip, uint16_t relay_port, int port, uint8_t delay_bucket, int x, int y, int width,
+			  int height);
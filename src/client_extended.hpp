@@ -37,6 +37,8 @@ struct PlayerInput
 	float	move_y;
 	float	mouse_dx, mouse_dy;
 	uint8_t buttons;
+	float	press_fraction;				/* how far through the frame buttons or keys changed, 0 if none did */
+	float	press_mouse_dx, press_mouse_dy; /* how far the mouse had moved by then */
 	bool	toggle_free_camera;
 	bool	toggle_prediction;
 	bool	unlock_cursor;
@@ -88,13 +90,20 @@ render_state_init(ClientRenderState *state)
 	state->gun.gun_fov = 50.0f;
 }
 
+/* Where the camera points once turned by a mouse delta, without turning it */
+inline void
+camera_look_after(CameraState *cam, float mouse_dx, float mouse_dy, float *yaw, float *pitch)
+{
+	*yaw = cam->yaw + mouse_dx * 0.002f;
+	*pitch = glm::clamp(cam->pitch - mouse_dy * 0.002f, -1.5f, 1.5f);
+}
+
 inline void
 update_camera(CameraState *cam, glm::vec3 &player_pos, float mouse_dx, float mouse_dy, float move_x, float dt,
 			  bool wall_running, glm::vec3 wall_normal)
 {
 
-	cam->yaw += mouse_dx * 0.002f;
-	cam->pitch = glm::clamp(cam->pitch - mouse_dy * 0.002f, -1.5f, 1.5f);
+	camera_look_after(cam, mouse_dx, mouse_dy, &cam->yaw, &cam->pitch);
 
 	cam->forward = glm::vec3(cos(cam->yaw) * cos(cam->pitch), sin(cam->pitch), sin(cam->yaw) * cos(cam->pitch));
 
@@ -407,6 +416,8 @@ gather_player_input(Window *w)
 		input.move_z /= mag;
 	}
 	window_get_mouse_delta(w, &input.mouse_dx, &input.mouse_dy);
+	input.press_fraction = window_change_fraction(w);
+	window_get_press_mouse_delta(w, &input.press_mouse_dx, &input.press_mouse_dy);
 	if (window_mouse_button(w, GLFW_MOUSE_BUTTON_LEFT))
 	{
 		input.buttons |= INPUT_BUTTON_SHOOT;
@@ -13,7 +13,19 @@
 #include <cstring>
 #include <initializer_list>
 #include <string_view>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 /*
  * The ring_buffer is particularly useful in this project
@@ -37,6 +49,14 @@ template <typename T, size_t N> class ring_buffer
 	size_t tail = 0;
 
   public:
+	void
+	clear()
+	{
+		size_ = 0;
+		head = 0;
+		tail = 0;
+	}
+
 	void
 	push(const T &item)
 	{
@@ -161,6 +181,82 @@ template <typename T, size_t N> class ring_buffer
 	}
 };
 
+/*
+ * A ring_buffer answers 'what was pushed i entries ago', a keyed_ring answers 'what was stored
+ * for key k', where keys only ever grow (tick numbers, sequence numbers).
+ *
+ * Entry k lives in slot k & (N - 1), so a lookup is a single index and compare rather than a scan.
+ * Storing a key overwrites whatever was N keys behind it.
+ */
+template <typename T, size_t N> struct keyed_ring
+{
+	static_assert(N > 0, "Capacity must be greater than 0");
+	static_assert((N & (N - 1)) == 0, "Capacity must be power of 2");
+
+	T		 data[N];
+	uint64_t keys[N] = {}; /* key + 1, so 0 marks a never written slot */
+	uint64_t newest = 0;
+	bool	 has_any = false;
+
+	T *
+	put(uint64_t key)
+	{
+		size_t slot = key & (N - 1);
+		keys[slot] = key + 1;
+		if (!has_any || key > newest)
+		{
+			newest = key;
+			has_any = true;
+		}
+		return &data[slot];
+	}
+
+	void
+	put(uint64_t key, const T &value)
+	{
+		*put(key) = value;
+	}
+
+	T *
+	get(uint64_t key)
+	{
+		size_t slot = key & (N - 1);
+		return keys[slot] == key + 1 ? &data[slot] : nullptr;
+	}
+
+	bool
+	contains(uint64_t key)
+	{
+		return get(key) != nullptr;
+	}
+
+	uint64_t
+	newest_key()
+	{
+		return newest;
+	}
+
+	bool
+	empty()
+	{
+		return !has_any;
+	}
+
+	void
+	clear()
+	{
+		memset(keys, 0, sizeof(keys));
+		newest = 0;
+		has_any = false;
+	}
+
+	static constexpr size_t
+	capacity()
+	{
+		return N;
+	}
+};
+
 template <size_t N> struct fixed_string
 {
 	char data[N];
@@ -294,6 +390,17 @@ template <typename T, size_t N> struct fixed_array
 		m_size = 0;
 	}
 
+	/* O(1), the last element moves into the hole so order is not preserved */
+	void
+	erase_swap(uint32_t index)
+	{
+		if (index >= m_size)
+		{
+			return;
+		}
+		data[index] = data[--m_size];
+	}
+
 	T *
 	get(uint32_t index)
 	{
@@ -350,6 +457,200 @@ template <typename T, size_t N> struct fixed_array
 	}
 };
 
+/*
+ * fixed_array stores an array of structs (AoS), which is the natural way to write
+ * game code, but means a loop that only reads positions still drags every other field
+ * through the cache, and can't be vectorized without gathering.
+ *
+ * soa_array stores each field in its own column (SoA). Each column is aligned to a cache line
+ * and padded to a multiple of SOA_PAD_ELEMENTS, so a SIMD loop can run to padded_size() without
+ * a scalar tail and without reading past the end of the column. The padding is kept zeroed.
+ *
+ * Columns are addressed by index, an enum per use site keeps that readable:
+ *
+ *	enum { COL_X, COL_Y, COL_Z, COL_RADIUS };
+ *	soa_array<MAX_OBSTACLES, float, float, float, float> spheres;
+ *	spheres.push(x, y, z, r);
+ *	float *xs = spheres.column<COL_X>().data;
+ *	spheres.at(i).get<COL_RADIUS>() = 2.0f;
+ */
+#define SOA_PAD_ELEMENTS 16
+#define SOA_ALIGNMENT	 64
+
+template <typename T> struct column_span
+{
+	T		*data;
+	uint32_t count;
+
+	T &
+	operator[](uint32_t index)
+	{
+		return data[index];
+	}
+
+	T *
+	begin()
+	{
+		return data;
+	}
+	T *
+	end()
+	{
+		return data + count;
+	}
+	uint32_t
+	size()
+	{
+		return count;
+	}
+};
+
+template <size_t N, typename... Fields> struct soa_array
+{
+	static_assert(N > 0, "Capacity must be greater than 0");
+	static_assert(sizeof...(Fields) > 0, "soa_array needs at least one column");
+	static_assert((std::is_trivially_copyable_v<Fields> && ...), "Columns must be trivially copyable");
+
+	static constexpr size_t padded_capacity = (N + SOA_PAD_ELEMENTS - 1) / SOA_PAD_ELEMENTS * SOA_PAD_ELEMENTS;
+
+	template <typename T> struct alignas(SOA_ALIGNMENT) column_storage
+	{
+		T data[padded_capacity];
+	};
+
+	std::tuple<column_storage<Fields>...> m_columns = {};
+	uint32_t							  m_size = 0;
+
+	template <size_t I> using field_type = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+	/*
+	 * A row viewed as if it were a struct, it holds no data itself
+	 */
+	struct row_ref
+	{
+		soa_array *owner;
+		uint32_t   index;
+
+		template <size_t I>
+		field_type<I> &
+		get()
+		{
+			return std::get<I>(owner->m_columns).data[index];
+		}
+	};
+
+  private:
+	template <size_t... I>
+	void
+	store_row(uint32_t index, std::index_sequence<I...>, const Fields &...values)
+	{
+		((std::get<I>(m_columns).data[index] = values), ...);
+	}
+
+	template <size_t... I>
+	void
+	move_row(uint32_t to, uint32_t from, std::index_sequence<I...>)
+	{
+		((std::get<I>(m_columns).data[to] = std::get<I>(m_columns).data[from]), ...);
+	}
+
+	template <size_t... I>
+	void
+	zero_row(uint32_t index, std::index_sequence<I...>)
+	{
+		((std::get<I>(m_columns).data[index] = field_type<I>{}), ...);
+	}
+
+  public:
+	bool
+	push(const Fields &...values)
+	{
+		if (m_size >= N)
+		{
+			return false;
+		}
+		store_row(m_size++, std::index_sequence_for<Fields...>{}, values...);
+		return true;
+	}
+
+	/*
+	 * O(1) removal that keeps every column in step: the last row moves into the hole,
+	 * so order is not preserved
+	 */
+	void
+	erase_swap(uint32_t index)
+	{
+		if (index >= m_size)
+		{
+			return;
+		}
+		uint32_t last = --m_size;
+		if (index != last)
+		{
+			move_row(index, last, std::index_sequence_for<Fields...>{});
+		}
+		zero_row(last, std::index_sequence_for<Fields...>{});
+	}
+
+	void
+	clear()
+	{
+		for (uint32_t i = 0; i < m_size; i++)
+		{
+			zero_row(i, std::index_sequence_for<Fields...>{});
+		}
+		m_size = 0;
+	}
+
+	template <size_t I>
+	column_span<field_type<I>>
+	column()
+	{
+		return {std::get<I>(m_columns).data, m_size};
+	}
+
+	template <size_t I>
+	field_type<I> &
+	get(uint32_t index)
+	{
+		return std::get<I>(m_columns).data[index];
+	}
+
+	row_ref
+	at(uint32_t index)
+	{
+		return {this, index};
+	}
+
+	row_ref
+	operator[](uint32_t index)
+	{
+		return {this, index};
+	}
+
+	bool
+	empty()
+	{
+		return m_size == 0;
+	}
+	uint32_t
+	size()
+	{
+		return m_size;
+	}
+	/* size() rounded up to the SIMD padding, safe to iterate to */
+	uint32_t
+	padded_size()
+	{
+		return (m_size + SOA_PAD_ELEMENTS - 1) / SOA_PAD_ELEMENTS * SOA_PAD_ELEMENTS;
+	}
+	constexpr uint32_t
+	capacity()
+	{
+		return N;
+	}
+};
+
 template <typename T, size_t N> struct fixed_queue
 {
 	T		 data[N];
@@ -533,6 +834,14 @@ hash_int(uint64_t x)
 	return static_cast<uint32_t>(x) ? static_cast<uint32_t>(x) : 1;
 }
 
+/*
+ * Open addressing with linear probing. Removing leaves a tombstone so that keys further along
+ * the probe chain stay reachable, which means a map that sees constant insert/remove churn (peers
+ * connecting and disconnecting) slowly trades its empty slots for tombstones. Two things keep that
+ * in check: a run of tombstones that ends in an empty slot is turned back into empty slots on
+ * remove, and every probe is bounded by the table size so a lookup never spins on a table with
+ * no empty slots left.
+ */
 template <typename K, typename V, size_t N> struct fixed_map
 {
 
@@ -609,7 +918,7 @@ template <typename K, typename V, size_t N> struct fixed_map
 		uint32_t mask = table_size - 1;
 		uint32_t idx = hash & mask;
 
-		while (true)
+		for (uint32_t probe = 0; probe < table_size; probe++)
 		{
 			entry &e = m_data[idx];
 			if (e.state == 0)
@@ -622,6 +931,7 @@ template <typename K, typename V, size_t N> struct fixed_map
 			}
 			idx = (idx + 1) & mask;
 		}
+		return nullptr;
 	}
 
 	V *
@@ -637,7 +947,7 @@ template <typename K, typename V, size_t N> struct fixed_map
 		uint32_t idx = hash & mask;
 		int32_t first_deleted = -1;
 
-		while (true)
+		for (uint32_t probe = 0; probe < table_size; probe++)
 		{
 			entry &e = m_data[idx];
 
@@ -669,6 +979,20 @@ template <typename K, typename V, size_t N> struct fixed_map
 
 			idx = (idx + 1) & mask;
 		}
+
+		/* Walked the whole table without an empty slot, only tombstones and live keys */
+		if (first_deleted == -1)
+		{
+			return nullptr;
+		}
+		entry *target = &m_data[first_deleted];
+		target->key = key;
+		target->value = value;
+		target->hash = hash;
+		target->state = 1;
+		m_tombstones--;
+		m_size++;
+		return &target->value;
 	}
 
 	bool
@@ -683,7 +1007,7 @@ template <typename K, typename V, size_t N> struct fixed_map
 		uint32_t mask = table_size - 1;
 		uint32_t idx = hash & mask;
 
-		while (true)
+		for (uint32_t probe = 0; probe < table_size; probe++)
 		{
 			entry &e = m_data[idx];
 			if (e.state == 0)
@@ -695,10 +1019,25 @@ template <typename K, typename V, size_t N> struct fixed_map
 				e.state = 2;
 				m_size--;
 				m_tombstones++;
+
+				/*
+				 * No probe chain runs through an empty slot, so if the next one is empty this
+				 * tombstone and any directly before it guard nothing and can be emptied
+				 */
+				if (m_data[(idx + 1) & mask].state == 0)
+				{
+					while (m_data[idx].state == 2)
+					{
+						m_data[idx].state = 0;
+						m_tombstones--;
+						idx = (idx - 1) & mask;
+					}
+				}
 				return true;
 			}
 			idx = (idx + 1) & mask;
 		}
+		return false;
 	}
 
 	void
@@ -801,6 +1140,11 @@ template <typename K, typename V, size_t N> struct fixed_map
 	{
 		return table_size;
 	}
+	uint32_t
+	tombstones()
+	{
+		return m_tombstones;
+	}
 	bool
 	contains(const K &key)
 	{
@@ -814,3 +1158,310 @@ template <typename K, typename V, size_t N> struct fixed_map
 };
 
 template <typename K, size_t N> using fixed_hash_set = fixed_map<K, char, N>;
+
+/*
+ * Word level bit helpers, the compiler builtins lower to single instructions (tzcnt/popcnt)
+ * when the target supports them
+ */
+inline int
+bit_ctz64(uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+inline int
+bit_popcount64(uint64_t word)
+{
+#ifdef _MSC_VER
+	return (int)__popcnt64(word);
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+/* Index of the nth (0 based) set bit of word, word must have more than n bits set */
+inline int
+bit_select64(uint64_t word, uint32_t n)
+{
+#if defined(__BMI2__)
+	return bit_ctz64(_pdep_u64(1ull << n, word));
+#else
+	for (uint32_t i = 0; i < n; i++)
+	{
+		word &= word - 1;
+	}
+	return bit_ctz64(word);
+#endif
+}
+
+/*
+ * The ack_bits and window_mask style uint32_t masks cap out at 32 entries. fixed_bitset is the
+ * same idea for 64-4096 bits: relevancy sets, visibility tables, peers with pending work.
+ *
+ * Storage is padded to whole 256 bit lanes so the set operations run as straight AVX2 (or SSE2)
+ * loops with no tail. Bits beyond N are always zero, which lets count() and the searches
+ * ignore the padding.
+ *
+ * Searches return -1 when there is no such bit, like the other 'find' helpers.
+ */
+template <size_t N> struct fixed_bitset
+{
+	static_assert(N >= 64 && N <= 4096, "fixed_bitset is sized for 64-4096 bits");
+
+	static constexpr uint32_t word_count = (N + 255) / 256 * 4;
+	static constexpr uint32_t used_words = (N + 63) / 64;
+
+	alignas(32) uint64_t words[word_count] = {};
+
+	void
+	set(uint32_t index)
+	{
+		words[index >> 6] |= 1ull << (index & 63);
+	}
+
+	void
+	reset(uint32_t index)
+	{
+		words[index >> 6] &= ~(1ull << (index & 63));
+	}
+
+	bool
+	test(uint32_t index) const
+	{
+		return (words[index >> 6] >> (index & 63)) & 1;
+	}
+
+	void
+	clear()
+	{
+		memset(words, 0, sizeof(words));
+	}
+
+	void
+	set_all()
+	{
+		for (uint32_t i = 0; i < used_words; i++)
+		{
+			words[i] = ~0ull;
+		}
+		if (N & 63)
+		{
+			words[used_words - 1] = (1ull << (N & 63)) - 1;
+		}
+	}
+
+	/* this &= other */
+	void
+	and_with(const fixed_bitset &other)
+	{
+#if defined(__AVX2__)
+		for (uint32_t i = 0; i < word_count; i += 4)
+		{
+			__m256i a = _mm256_load_si256((const __m256i *)&words[i]);
+			__m256i b = _mm256_load_si256((const __m256i *)&other.words[i]);
+			_mm256_store_si256((__m256i *)&words[i], _mm256_and_si256(a, b));
+		}
+#elif defined(__SSE2__)
+		for (uint32_t i = 0; i < word_count; i += 2)
+		{
+			__m128i a = _mm_load_si128((const __m128i *)&words[i]);
+			__m128i b = _mm_load_si128((const __m128i *)&other.words[i]);
+			_mm_store_si128((__m128i *)&words[i], _mm_and_si128(a, b));
+		}
+#else
+		for (uint32_t i = 0; i < word_count; i++)
+		{
+			words[i] &= other.words[i];
+		}
+#endif
+	}
+
+	/* this |= other */
+	void
+	or_with(const fixed_bitset &other)
+	{
+#if defined(__AVX2__)
+		for (uint32_t i = 0; i < word_count; i += 4)
+		{
+			__m256i a = _mm256_load_si256((const __m256i *)&words[i]);
+			__m256i b = _mm256_load_si256((const __m256i *)&other.words[i]);
+			_mm256_store_si256((__m256i *)&words[i], _mm256_or_si256(a, b));
+		}
+#elif defined(__SSE2__)
+		for (uint32_t i = 0; i < word_count; i += 2)
+		{
+			__m128i a = _mm_load_si128((const __m128i *)&words[i]);
+			__m128i b = _mm_load_si128((const __m128i *)&other.words[i]);
+			_mm_store_si128((__m128i *)&words[i], _mm_or_si128(a, b));
+		}
+#else
+		for (uint32_t i = 0; i < word_count; i++)
+		{
+			words[i] |= other.words[i];
+		}
+#endif
+	}
+
+	/* this &= ~other */
+	void
+	and_not(const fixed_bitset &other)
+	{
+#if defined(__AVX2__)
+		for (uint32_t i = 0; i < word_count; i += 4)
+		{
+			__m256i a = _mm256_load_si256((const __m256i *)&words[i]);
+			__m256i b = _mm256_load_si256((const __m256i *)&other.words[i]);
+			/* andnot computes ~first & second */
+			_mm256_store_si256((__m256i *)&words[i], _mm256_andnot_si256(b, a));
+		}
+#elif defined(__SSE2__)
+		for (uint32_t i = 0; i < word_count; i += 2)
+		{
+			__m128i a = _mm_load_si128((const __m128i *)&words[i]);
+			__m128i b = _mm_load_si128((const __m128i *)&other.words[i]);
+			_mm_store_si128((__m128i *)&words[i], _mm_andnot_si128(b, a));
+		}
+#else
+		for (uint32_t i = 0; i < word_count; i++)
+		{
+			words[i] &= ~other.words[i];
+		}
+#endif
+	}
+
+	fixed_bitset &
+	operator&=(const fixed_bitset &other)
+	{
+		and_with(other);
+		return *this;
+	}
+
+	fixed_bitset &
+	operator|=(const fixed_bitset &other)
+	{
+		or_with(other);
+		return *this;
+	}
+
+	uint32_t
+	count() const
+	{
+#if defined(__AVX2__)
+		if constexpr (word_count >= 8)
+		{
+			/*
+			 * Nibble lookup popcount (Mula et al.), 4 words per step with the per byte
+			 * counts summed by sad against zero
+			 */
+			const __m256i lookup =
+				_mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+			const __m256i low_mask = _mm256_set1_epi8(0x0f);
+			__m256i		  total = _mm256_setzero_si256();
+
+			for (uint32_t i = 0; i < word_count; i += 4)
+			{
+				__m256i v = _mm256_load_si256((const __m256i *)&words[i]);
+				__m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_mask));
+				__m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+				total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+			}
+
+			return (uint32_t)(_mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+							  _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3));
+		}
+#endif
+		uint32_t total = 0;
+		for (uint32_t i = 0; i < used_words; i++)
+		{
+			total += bit_popcount64(words[i]);
+		}
+		return total;
+	}
+
+	bool
+	any() const
+	{
+		for (uint32_t i = 0; i < used_words; i++)
+		{
+			if (words[i])
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool
+	none() const
+	{
+		return !any();
+	}
+
+	int32_t
+	find_first() const
+	{
+		for (uint32_t i = 0; i < used_words; i++)
+		{
+			if (words[i])
+			{
+				return (int32_t)(i * 64 + bit_ctz64(words[i]));
+			}
+		}
+		return -1;
+	}
+
+	/* First set bit strictly after index, so iteration is find_first() then find_next(i) until -1 */
+	int32_t
+	find_next(uint32_t index) const
+	{
+		uint32_t next = index + 1;
+		if (next >= N)
+		{
+			return -1;
+		}
+
+		uint32_t word_idx = next >> 6;
+		uint64_t word = words[word_idx] & (~0ull << (next & 63));
+
+		while (true)
+		{
+			if (word)
+			{
+				return (int32_t)(word_idx * 64 + bit_ctz64(word));
+			}
+			if (++word_idx >= used_words)
+			{
+				return -1;
+			}
+			word = words[word_idx];
+		}
+	}
+
+	/* Index of the nth (0 based) set bit */
+	int32_t
+	select(uint32_t n) const
+	{
+		for (uint32_t i = 0; i < used_words; i++)
+		{
+			uint32_t bits = bit_popcount64(words[i]);
+			if (n < bits)
+			{
+				return (int32_t)(i * 64 + bit_select64(words[i], n));
+			}
+			n -= bits;
+		}
+		return -1;
+	}
+
+	static constexpr uint32_t
+	size()
+	{
+		return N;
+	}
+};
@@ -0,0 +1,484 @@
+#include "demo.hpp"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char DEMO_MAGIC[4] = {'C', 'O', 'D', 'D'};
+static const char INDEX_MAGIC[4] = {'C', 'O', 'D', 'I'};
+
+/*
+ * Byte i of the delta, anything past the end of the previous snapshot counts as zero
+ */
+static inline uint8_t
+xor_at(const uint8_t *current, const uint8_t *previous, uint16_t previous_size, uint16_t i)
+{
+	return current[i] ^ (i < previous_size ? previous[i] : 0);
+}
+
+/*
+ * Pairs of [zero run][literal count] followed by the literals, until 'size' bytes are covered.
+ * At worst (alternating single changed bytes) it's 1.5x the input
+ */
+static uint16_t
+encode_delta(const uint8_t *current, uint16_t size, const uint8_t *previous, uint16_t previous_size, uint8_t *out)
+{
+	uint16_t in = 0;
+	uint16_t written = 0;
+
+	while (in < size)
+	{
+		uint8_t zeros = 0;
+		while (in < size && zeros < 255 && xor_at(current, previous, previous_size, in) == 0)
+		{
+			zeros++;
+			in++;
+		}
+
+		uint8_t *run = out + written;
+		uint8_t	 literals = 0;
+		while (in < size && literals < 255 && xor_at(current, previous, previous_size, in) != 0)
+		{
+			run[2 + literals++] = xor_at(current, previous, previous_size, in);
+			in++;
+		}
+
+		run[0] = zeros;
+		run[1] = literals;
+		written += 2 + literals;
+	}
+	return written;
+}
+
+/* XORs the delta into 'snapshot', which holds the previous one */
+static bool
+decode_delta(const uint8_t *in, uint16_t in_size, uint8_t *snapshot, uint16_t decoded_size)
+{
+	uint16_t read = 0;
+	uint32_t out = 0;
+
+	while (read + 2 <= in_size)
+	{
+		uint8_t zeros = in[read];
+		uint8_t literals = in[read + 1];
+		read += 2;
+		out += zeros;
+
+		if (out + literals > decoded_size || read + literals > in_size)
+		{
+			return false;
+		}
+		for (uint8_t i = 0; i < literals; i++)
+		{
+			snapshot[out++] ^= in[read++];
+		}
+	}
+	return read == in_size;
+}
+
+static void
+write_record(DemoWriter *w, uint8_t type, float time, const void *a, uint16_t a_size, const void *b = nullptr,
+			 uint16_t b_size = 0)
+{
+	DemoRecord record = {type, (uint16_t)(a_size + b_size), time};
+	fwrite(&record, sizeof(record), 1, w->file);
+	fwrite(a, 1, a_size, w->file);
+	if (b_size)
+	{
+		fwrite(b, 1, b_size, w->file);
+	}
+	w->offset += sizeof(record) + a_size + b_size;
+	w->stored_bytes += sizeof(record) + a_size + b_size;
+}
+
+bool
+demo_writer_open(DemoWriter *w, const char *path, int8_t player_idx, uint64_t epoch_tick, uint16_t tick_rate)
+{
+	w->file = fopen(path, "wb");
+	if (!w->file)
+	{
+		printf("Failed to open demo %s for writing\n", path);
+		return false;
+	}
+
+	DemoFileHeader header = {};
+	memcpy(header.magic, DEMO_MAGIC, sizeof(header.magic));
+	header.version = DEMO_VERSION;
+	header.player_idx = player_idx;
+	header.epoch_tick = epoch_tick;
+	header.tick_rate = tick_rate;
+	fwrite(&header, sizeof(header), 1, w->file);
+
+	w->offset = sizeof(header);
+	w->next_keyframe_time = 0.0f;
+	w->has_keyframe = false;
+	w->previous_size = 0;
+	w->index.clear();
+	w->snapshot_bytes = 0;
+	w->stored_bytes = sizeof(header);
+
+	printf("Recording demo to %s\n", path);
+	return true;
+}
+
+void
+demo_write_snapshot(DemoWriter *w, float time, const void *message, uint16_t size)
+{
+	if (!w->file || size > DEMO_MAX_MESSAGE)
+	{
+		return;
+	}
+
+	const uint8_t *bytes = (const uint8_t *)message;
+	w->snapshot_bytes += size;
+
+	bool keyframe = !w->has_keyframe || time >= w->next_keyframe_time;
+	if (!keyframe)
+	{
+		uint8_t delta[DEMO_MAX_MESSAGE * 2];
+		uint16_t delta_size = encode_delta(bytes, size, w->previous, w->previous_size, delta);
+
+		if (delta_size + sizeof(uint16_t) < size)
+		{
+			write_record(w, DEMO_DELTA, time, &size, sizeof(size), delta, delta_size);
+		}
+		else
+		{
+			/* Changed too much to be worth it, a whole one is a keyframe anyway, just not indexed */
+			write_record(w, DEMO_KEYFRAME, time, bytes, size);
+		}
+	}
+	else
+	{
+		if (w->index.size() < DEMO_MAX_KEYFRAMES)
+		{
+			w->index.push({time, w->offset});
+		}
+		write_record(w, DEMO_KEYFRAME, time, bytes, size);
+		w->has_keyframe = true;
+		w->next_keyframe_time = time + DEMO_KEYFRAME_SECONDS;
+	}
+
+	memcpy(w->previous, bytes, size);
+	w->previous_size = size;
+}
+
+void
+demo_write_event(DemoWriter *w, float time, const void *message, uint16_t size)
+{
+	if (!w->file || size > DEMO_MAX_MESSAGE)
+	{
+		return;
+	}
+	write_record(w, DEMO_EVENT, time, message, size);
+}
+
+void
+demo_writer_close(DemoWriter *w)
+{
+	if (!w->file)
+	{
+		return;
+	}
+
+	DemoFooter footer = {};
+	footer.index_offset = w->offset;
+	footer.index_count = w->index.size();
+	memcpy(footer.magic, INDEX_MAGIC, sizeof(footer.magic));
+
+	fwrite(w->index.data, sizeof(DemoIndexEntry), w->index.size(), w->file);
+	fwrite(&footer, sizeof(footer), 1, w->file);
+	fclose(w->file);
+	w->file = nullptr;
+
+	printf("Demo closed: %u keyframes, snapshots %llu bytes received, %llu bytes stored\n", footer.index_count,
+		   (unsigned long long)w->snapshot_bytes, (unsigned long long)w->stored_bytes);
+}
+
+static bool
+map_file(DemoPlayer *p, const char *path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+							  nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	HANDLE		  mapping = nullptr;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+		!(mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	p->data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!p->data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	p->size = (uint64_t)size.QuadPart;
+	p->file_handle = file;
+	p->mapping = mapping;
+	return true;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	/* Playback reads front to back, let the kernel read ahead */
+	madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+	p->data = (const uint8_t *)data;
+	p->size = info.st_size;
+	p->fd = fd;
+	return true;
+#endif
+}
+
+void
+demo_player_close(DemoPlayer *p)
+{
+	if (!p->data)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(p->data);
+	CloseHandle(p->mapping);
+	CloseHandle(p->file_handle);
+#else
+	munmap((void *)p->data, p->size);
+	close(p->fd);
+#endif
+	p->data = nullptr;
+}
+
+/*
+ * For a demo with no footer: walks the records from the start, indexing keyframes, and stops at the
+ * first one that's cut off or isn't a record type, which is where the writer stopped
+ */
+static void
+recover_index(DemoPlayer *p)
+{
+	uint64_t cursor = sizeof(DemoFileHeader);
+	p->recovered_index.clear();
+
+	while (cursor + sizeof(DemoRecord) <= p->size)
+	{
+		DemoRecord record;
+		memcpy(&record, p->data + cursor, sizeof(record));
+		if (record.type > DEMO_EVENT || cursor + sizeof(record) + record.size > p->size)
+		{
+			break;
+		}
+
+		if (record.type == DEMO_KEYFRAME && p->recovered_index.size() < DEMO_MAX_KEYFRAMES)
+		{
+			p->recovered_index.push({record.time, cursor});
+		}
+		cursor += sizeof(record) + record.size;
+	}
+
+	p->index = p->recovered_index.data;
+	p->index_count = p->recovered_index.size();
+	p->records_end = cursor;
+}
+
+bool
+demo_player_open(DemoPlayer *p, const char *path)
+{
+	*p = {};
+	if (!map_file(p, path))
+	{
+		printf("Failed to open demo %s\n", path);
+		return false;
+	}
+
+	DemoFooter footer = {};
+	if (p->size < sizeof(DemoFileHeader))
+	{
+		printf("Demo %s is truncated\n", path);
+		demo_player_close(p);
+		return false;
+	}
+	memcpy(&p->header, p->data, sizeof(p->header));
+	if (p->size >= sizeof(DemoFileHeader) + sizeof(DemoFooter))
+	{
+		memcpy(&footer, p->data + p->size - sizeof(footer), sizeof(footer));
+	}
+
+	if (memcmp(p->header.magic, DEMO_MAGIC, 4) != 0 || p->header.version != DEMO_VERSION)
+	{
+		printf("Demo %s is not a demo, or a different version\n", path);
+		demo_player_close(p);
+		return false;
+	}
+
+	uint64_t index_end = footer.index_offset + (uint64_t)footer.index_count * sizeof(DemoIndexEntry);
+	bool	 recovered = false;
+	if (memcmp(footer.magic, INDEX_MAGIC, 4) == 0 && footer.index_offset >= sizeof(DemoFileHeader) &&
+		index_end == p->size - sizeof(footer))
+	{
+		p->index = (const DemoIndexEntry *)(p->data + footer.index_offset);
+		p->index_count = footer.index_count;
+		p->records_end = footer.index_offset;
+	}
+	else
+	{
+		recover_index(p);
+		recovered = true;
+	}
+	p->cursor = sizeof(DemoFileHeader);
+
+	/* Last record's time is the length */
+	p->duration = 0.0f;
+	if (p->index_count)
+	{
+		/* Played through from the last keyframe, then back to the start, it's too big to scan a copy */
+		p->cursor = p->index[p->index_count - 1].offset;
+		DemoMessage msg;
+		while (demo_next(p, 1e30f, &msg))
+		{
+			p->duration = msg.time;
+		}
+		p->cursor = sizeof(DemoFileHeader);
+		memset(p->snapshot, 0, sizeof(p->snapshot));
+		p->snapshot_size = 0;
+	}
+
+	if (recovered)
+	{
+		printf("Demo %s was never closed, recovered %.1fs from %llu of its %llu bytes\n", path, p->duration,
+			   (unsigned long long)p->records_end, (unsigned long long)p->size);
+	}
+	return true;
+}
+
+float
+demo_seek(DemoPlayer *p, float time)
+{
+	/* Last keyframe at or before 'time' */
+	uint32_t low = 0;
+	uint32_t high = p->index_count;
+	while (low < high)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (p->index[mid].time <= time)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	p->snapshot_size = 0;
+	memset(p->snapshot, 0, sizeof(p->snapshot));
+
+	if (low == 0)
+	{
+		p->cursor = sizeof(DemoFileHeader);
+		return 0.0f;
+	}
+	p->cursor = p->index[low - 1].offset;
+	return p->index[low - 1].time;
+}
+
+bool
+demo_next(DemoPlayer *p, float until, DemoMessage *out)
+{
+	while (p->cursor + sizeof(DemoRecord) <= p->records_end)
+	{
+		DemoRecord record;
+		memcpy(&record, p->data + p->cursor, sizeof(record));
+
+		const uint8_t *bytes = p->data + p->cursor + sizeof(record);
+		if (p->cursor + sizeof(record) + record.size > p->records_end)
+		{
+			return false;
+		}
+		if (record.time > until)
+		{
+			return false;
+		}
+		p->cursor += sizeof(record) + record.size;
+
+		out->time = record.time;
+		out->is_snapshot = record.type != DEMO_EVENT;
+
+		if (record.type == DEMO_EVENT)
+		{
+			out->data = bytes;
+			out->size = record.size;
+			return true;
+		}
+
+		uint16_t decoded_size;
+		if (record.type == DEMO_KEYFRAME)
+		{
+			if (record.size > DEMO_MAX_MESSAGE)
+			{
+				return false;
+			}
+			memcpy(p->snapshot, bytes, record.size);
+			decoded_size = record.size;
+		}
+		else
+		{
+			if (record.size < sizeof(uint16_t))
+			{
+				return false;
+			}
+			memcpy(&decoded_size, bytes, sizeof(decoded_size));
+			if (decoded_size > DEMO_MAX_MESSAGE ||
+				!decode_delta(bytes + sizeof(uint16_t), record.size - sizeof(uint16_t), p->snapshot, decoded_size))
+			{
+				return false;
+			}
+		}
+
+		/* Keep everything past the end zero, the next delta treats it as such */
+		if (decoded_size < p->snapshot_size)
+		{
+			memset(p->snapshot + decoded_size, 0, p->snapshot_size - decoded_size);
+		}
+		p->snapshot_size = decoded_size;
+
+		out->data = p->snapshot;
+		out->size = decoded_size;
+		return true;
+	}
+	return false;
+}
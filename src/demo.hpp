@@ -0,0 +1,155 @@
+#pragma once
+/*
+ * Demo recording and playback
+ *
+ * A demo is everything one client received, so a match can be watched again from that player's view
+ * without a server. The messages are stored as they arrived, the format doesn't know what's in them
+ * beyond snapshots vs events.
+ *
+ * File layout:
+ *   DemoFileHeader
+ *   DemoRecord + bytes, ...	   in time order
+ *   DemoIndexEntry[index_count]   one per keyframe
+ *   DemoFooter
+ *
+ * The index and footer are written on close. A demo that was never closed (the client crashed) is
+ * played from a scan of its records instead, up to the first one that was cut off.
+ *
+ * Consecutive snapshots are mostly the same bytes (players move a little, the rest doesn't change),
+ * so most are stored as a delta: XOR against the previous snapshot, which turns every unchanged byte
+ * into a zero, then run-length encoded. Every DEMO_KEYFRAME_SECONDS a snapshot is stored whole instead
+ * and indexed, so seeking is a binary search for the keyframe before the target plus decoding at most
+ * one keyframe interval of deltas.
+ *
+ * Playback maps the file rather than reading it in, only the pages that are played are loaded.
+ */
+
+#include "containers.hpp"
+#include <cstdint>
+#include <cstdio>
+
+#define DEMO_MAX_MESSAGE	  1500
+#define DEMO_KEYFRAME_SECONDS 2.0f
+#define DEMO_MAX_KEYFRAMES	  8192 /* ~4.5 hours, later keyframes are still written, just not indexed */
+#define DEMO_VERSION		  2
+
+enum DemoRecordType : uint8_t
+{
+	DEMO_KEYFRAME, /* a whole snapshot */
+	DEMO_DELTA,	   /* uint16_t decoded size, then the run-length encoded XOR against the previous snapshot */
+	DEMO_EVENT,	   /* any other message, as received */
+};
+
+#pragma pack(push, 1)
+
+struct DemoFileHeader
+{
+	char	 magic[4];
+	uint16_t version;
+	int8_t	 player_idx; /* whose view it was recorded from */
+	uint64_t epoch_tick; /* the tick they connected on, record times are relative to it */
+	uint16_t tick_rate;	 /* the match's, to turn snapshot ticks into time */
+};
+
+struct DemoRecord
+{
+	uint8_t	 type;
+	uint16_t size; /* bytes that follow */
+	float	 time;
+};
+
+struct DemoIndexEntry
+{
+	float	 time;
+	uint64_t offset;
+};
+
+struct DemoFooter
+{
+	uint64_t index_offset;
+	uint32_t index_count;
+	char	 magic[4];
+};
+
+#pragma pack(pop)
+
+struct DemoWriter
+{
+	FILE	*file;
+	uint64_t offset;
+	float	 next_keyframe_time;
+	bool	 has_keyframe;
+
+	/* The last snapshot written, deltas are against it */
+	uint8_t	 previous[DEMO_MAX_MESSAGE];
+	uint16_t previous_size;
+
+	fixed_array<DemoIndexEntry, DEMO_MAX_KEYFRAMES> index;
+
+	uint64_t snapshot_bytes; /* as received, for the compression ratio */
+	uint64_t stored_bytes;
+};
+
+struct DemoMessage
+{
+	bool		   is_snapshot;
+	float		   time;
+	const uint8_t *data;
+	uint16_t	   size;
+};
+
+struct DemoPlayer
+{
+	const uint8_t		 *data;
+	uint64_t			  size;
+	DemoFileHeader		  header;
+	const DemoIndexEntry *index;
+	uint32_t			  index_count;
+	uint64_t			  records_end;
+	uint64_t			  cursor;
+	float				  duration;
+
+	/* Rebuilt by scanning the records when there's no footer, index points here then */
+	fixed_array<DemoIndexEntry, DEMO_MAX_KEYFRAMES> recovered_index;
+
+	/* Last decoded snapshot, zeroed past snapshot_size so deltas can XOR over the whole thing */
+	uint8_t	 snapshot[DEMO_MAX_MESSAGE];
+	uint16_t snapshot_size;
+
+#ifdef _WIN32
+	void *file_handle;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+bool
+demo_writer_open(DemoWriter *w, const char *path, int8_t player_idx, uint64_t epoch_tick, uint16_t tick_rate);
+
+void
+demo_write_snapshot(DemoWriter *w, float time, const void *message, uint16_t size);
+
+void
+demo_write_event(DemoWriter *w, float time, const void *message, uint16_t size);
+
+/* Writes the index, without it the player has to scan the whole file to seek */
+void
+demo_writer_close(DemoWriter *w);
+
+bool
+demo_player_open(DemoPlayer *p, const char *path);
+
+void
+demo_player_close(DemoPlayer *p);
+
+/* Moves to the last keyframe at or before 'time', returns the time playback resumes from */
+float
+demo_seek(DemoPlayer *p, float time);
+
+/*
+ * The next message recorded at or before 'until', false once there are none. Events point straight
+ * into the mapping, snapshots into p->snapshot, both valid until the next call
+ */
+bool
+demo_next(DemoPlayer *p, float until, DemoMessage *out);
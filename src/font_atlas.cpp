@@ -0,0 +1,146 @@
+#include "font_atlas.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char FONT_ATLAS_MAGIC[4] = {'C', 'O', 'D', 'F'};
+
+static bool
+map_file(FontAtlas *atlas, const char *path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+							  nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	HANDLE		  mapping = nullptr;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+		!(mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	atlas->size = (uint64_t)size.QuadPart;
+	atlas->file_handle = file;
+	atlas->mapping = mapping;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+	atlas->size = info.st_size;
+	atlas->fd = fd;
+#endif
+
+	atlas->header = (const FontAtlasHeader *)data;
+	return true;
+}
+
+bool
+font_atlas_open(FontAtlas *atlas, const char *path)
+{
+	*atlas = {};
+	if (!map_file(atlas, path))
+	{
+		return false;
+	}
+
+	const FontAtlasHeader *header = atlas->header;
+	uint64_t			   glyphs_end = sizeof(FontAtlasHeader) + FONT_ATLAS_GLYPHS * sizeof(FontAtlasGlyph);
+	if (atlas->size < glyphs_end || memcmp(header->magic, FONT_ATLAS_MAGIC, 4) != 0 ||
+		header->version != FONT_ATLAS_VERSION || header->glyph_count != FONT_ATLAS_GLYPHS ||
+		atlas->size < glyphs_end + (uint64_t)header->width * header->height)
+	{
+		printf("%s is not a font atlas, or a different version\n", path);
+		font_atlas_close(atlas);
+		return false;
+	}
+
+	atlas->glyphs = (const FontAtlasGlyph *)((const uint8_t *)header + sizeof(FontAtlasHeader));
+	atlas->pixels = (const uint8_t *)header + glyphs_end;
+	return true;
+}
+
+void
+font_atlas_close(FontAtlas *atlas)
+{
+	if (!atlas->header)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(atlas->header);
+	CloseHandle(atlas->mapping);
+	CloseHandle(atlas->file_handle);
+#else
+	munmap((void *)atlas->header, atlas->size);
+	close(atlas->fd);
+#endif
+	*atlas = {};
+}
+
+bool
+font_atlas_write(const char *path, const FontAtlasHeader &header, const FontAtlasGlyph *glyphs,
+				 const uint8_t *pixels)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Failed to create %s\n", path);
+		return false;
+	}
+
+	FontAtlasHeader out = header;
+	memcpy(out.magic, FONT_ATLAS_MAGIC, 4);
+	out.version = FONT_ATLAS_VERSION;
+	out.glyph_count = FONT_ATLAS_GLYPHS;
+
+	size_t pixel_count = (size_t)header.width * header.height;
+	bool   ok = fwrite(&out, sizeof(out), 1, file) == 1 &&
+			  fwrite(glyphs, sizeof(FontAtlasGlyph), FONT_ATLAS_GLYPHS, file) == FONT_ATLAS_GLYPHS &&
+			  fwrite(pixels, 1, pixel_count, file) == pixel_count;
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+	{
+		printf("Failed to write %s\n", path);
+	}
+	return ok;
+}
@@ -0,0 +1,70 @@
+#pragma once
+/*
+ * Prebaked font atlas
+ *
+ * Rasterizing the font with FreeType at startup means loading the TTF, rendering 128 glyphs one at a
+ * time and creating a texture for each. cod_font_bake (tools/font_bake.cpp) does that once, offline,
+ * packing every glyph into one single channel image and writing it with their metrics. The client maps
+ * the file and uploads the image straight from the mapping as a single texture, with no FreeType.
+ *
+ * File layout:
+ *   FontAtlasHeader
+ *   FontAtlasGlyph[FONT_ATLAS_GLYPHS] indexed by character, empty ones have no size
+ *   uint8_t[width * height]		   coverage, rows top to bottom, no padding
+ */
+
+#include <cstdint>
+
+#define FONT_ATLAS_VERSION 1
+#define FONT_ATLAS_GLYPHS  128 /* ASCII */
+
+struct FontAtlasHeader
+{
+	char	 magic[4];
+	uint16_t version;
+	uint16_t pixel_size;
+	uint16_t width;
+	uint16_t height;
+	uint32_t glyph_count;
+};
+
+/* In pixels, the same as FreeType reports them */
+struct FontAtlasGlyph
+{
+	uint16_t x; /* top left in the atlas */
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	int16_t	 bearing_x;
+	int16_t	 bearing_y;
+	uint32_t advance; /* 1/64ths of a pixel */
+};
+
+static_assert(sizeof(FontAtlasHeader) == 16, "FontAtlasHeader is written as is");
+static_assert(sizeof(FontAtlasGlyph) == 16, "FontAtlasGlyph is written as is");
+
+struct FontAtlas
+{
+	const FontAtlasHeader *header;
+	const FontAtlasGlyph  *glyphs;
+	const uint8_t		  *pixels;
+	uint64_t			   size;
+
+#ifdef _WIN32
+	void *file_handle;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+/* Maps 'path' read only, false if it's missing or not an atlas this build understands */
+bool
+font_atlas_open(FontAtlas *atlas, const char *path);
+
+void
+font_atlas_close(FontAtlas *atlas);
+
+bool
+font_atlas_write(const char *path, const FontAtlasHeader &header, const FontAtlasGlyph *glyphs,
+				 const uint8_t *pixels);
@@ -10,15 +10,22 @@
 #include "containers.hpp"
 #include <glm/glm.hpp>
 #include "math.hpp"
+#include <cmath>
 #include <cstdint>
 
-#define SERVER_PORT 7777
+#define SERVER_PORT			 7777 /* a lone server's, the matchmaker starts its own from MATCH_BASE_PORT */
+#define RELAY_PORT			 7778
+#define MATCHMAKER_PORT		 7700
+#define MATCHMAKER_LOAD_PORT 7701
+#define MATCH_BASE_PORT		 7800
+
+#define DEFAULT_TICK_RATE 60
+#define MIN_TICK_RATE	  20
+#define MAX_TICK_RATE	  128 /* the server's history and input buffers are sized for it */
 
-#define TICK_RATE		60.0f
-#define TICK_TIME		(1.0f / TICK_RATE)
 #define SNAPSHOT_COUNT	32
 #define MAX_PLAYERS		10
-#define MAX_SHOTS		16
+#define SNAPSHOT_BUDGET 1200 /* snapshot payload bytes, well inside a 1500 byte MTU with the headers */
 #define MAX_OBSTACLES	256
 #define MAX_JUMPS		2
 #define MAX_SHOOT_RANGE 100.0f
@@ -29,6 +36,48 @@
 #define PLAYER_RADIUS	  1.0f
 #define PLAYER_EYE_HEIGHT 0.5f
 
+/*
+ * The canonical clock is the tick number, the count of simulation steps since the server started.
+ *
+ * Accumulating float seconds loses precision as the value grows (after a day of uptime a float
+ * can't resolve a single 16ms tick), whereas a 64 bit tick count is exact forever, and can be used
+ * directly as an index into tick keyed history.
+ *
+ * How long a tick is belongs to the match, the server picks its tick rate and sends it with the connect
+ * accept, so converting between ticks and seconds needs to know whose ticks they are.
+ */
+typedef uint64_t Tick;
+
+inline float
+ticks_to_seconds(int64_t ticks, uint16_t tick_rate)
+{
+	return (float)ticks / tick_rate;
+}
+
+inline int64_t
+seconds_to_ticks(float seconds, uint16_t tick_rate)
+{
+	return (int64_t)floorf(seconds * tick_rate);
+}
+
+/*
+ * Inputs are sent once a tick, but a click lands anywhere inside one. Where is sent as a fraction of the
+ * tick in 256ths, finer than any tick rate we run at needs
+ */
+#define SUBTICK_STEPS 256
+
+inline uint8_t
+fraction_to_subtick(float fraction)
+{
+	return (uint8_t)glm::clamp(fraction * SUBTICK_STEPS, 0.0f, SUBTICK_STEPS - 1.0f);
+}
+
+inline float
+subtick_to_fraction(uint8_t subtick)
+{
+	return (float)subtick / SUBTICK_STEPS;
+}
+
 struct Player
 {
 	int8_t	  player_idx; /* -1 = inactive */
@@ -68,7 +117,7 @@ struct Shot
  */
 struct Snapshot
 {
-	float							 timestamp;
+	Tick							 tick;
 	fixed_array<Player, MAX_PLAYERS> players;
 };
 
@@ -82,6 +131,25 @@ enum MessageType : uint8_t
 	MSG_PLAYER_DIED,
 	MSG_CONNECT_REQUEST,
 	MSG_CONNECT_ACCEPT,
+	MSG_RELAY_CONNECT,
+	MSG_SPECTATE_REQUEST,
+	/* unreliable, sent by peers that otherwise go quiet so they aren't timed out */
+	MSG_KEEPALIVE,
+	MSG_MATCH_REQUEST,
+	MSG_MATCH_ASSIGN,
+	/* a bare datagram, no PacketHeader, servers -> matchmaker on MATCHMAKER_LOAD_PORT */
+	MSG_SERVER_LOAD,
+};
+
+/*
+ * Reliable messages are split over channels (see network_client.hpp). Connection control is ordered,
+ * so nobody hears a player left before hearing they joined; kills go on their own unordered channel
+ * so the kill feed never waits on control traffic, or the other way around
+ */
+enum GameChannel : uint8_t
+{
+	CHANNEL_CONTROL,
+	CHANNEL_EVENTS,
 };
 
 #pragma pack(push, 1)
@@ -92,11 +160,58 @@ struct ConnectRequest
 	char	player_name[32];
 };
 
+/* player_index is -1 for a relay or spectator, they watch rather than play */
 struct ConnectAccept
+{
+	uint8_t	 type;
+	Tick	 server_tick;
+	int8_t	 player_index;
+	uint16_t tick_rate; /* clients send an input per tick, so they run at it too */
+};
+
+/*
+ * A relay asks the server for the full-visibility stream: every snapshot with no shots culled, plus
+ * the reliable events. It takes no player slot
+ */
+struct RelayConnect
 {
 	uint8_t type;
-	float	server_time;
-	int8_t	player_index;
+};
+
+/* Spectators connect to a relay rather than the server, and pick how far behind live to watch */
+struct SpectateRequest
+{
+	uint8_t type;
+	uint8_t delay_bucket;
+};
+
+struct Keepalive
+{
+	uint8_t type;
+};
+
+/* Client -> matchmaker, which server should I join? */
+struct MatchRequest
+{
+	uint8_t type;
+};
+
+struct MatchAssign
+{
+	uint8_t	 type;
+	uint16_t port; /* 0 = every match is full */
+};
+
+/* Once a second from each server the matchmaker started */
+struct ServerLoad
+{
+	uint8_t	 type;
+	uint16_t port;
+	uint8_t	 player_count;
+	uint8_t	 max_players;
+	uint32_t tick_us_avg; /* simulation cost per tick, over the last second */
+	uint32_t tick_us_max;
+	uint16_t tick_rate;
 };
 
 struct InputMessage
@@ -106,8 +221,15 @@ struct InputMessage
 	float	 move_x, move_z;
 	float	 look_yaw, look_pitch;
 	uint8_t	 buttons;
-	float	 shot_time;
-	float	 time;
+	Tick	 shot_tick;		/* the tick the client was looking at when it fired */
+	uint8_t	 shot_fraction; /* and how far on from it towards the next, in SUBTICK_STEPS */
+
+	/*
+	 * Where in the tick before this input was sent the buttons or move keys changed, in SUBTICK_STEPS,
+	 * and the look at that moment. 0 when nothing changed, or at the start
+	 */
+	uint8_t press_fraction;
+	float	press_yaw, press_pitch;
 };
 
 struct QuantizedPlayer
@@ -129,14 +251,21 @@ struct QuantizedShot
 	uint8_t length;
 };
 
+/*
+ * Variable size, followed by player_count QuantizedPlayers then shot_count QuantizedShots.
+ *
+ * Shots are a stream the server numbers as they happen. Each client's snapshot carries on from where
+ * its last one stopped: it covers [first_shot_sequence, next_shot_sequence) minus the shots culled as
+ * irrelevant to that client, and whatever didn't fit in the budget starts the next snapshot
+ */
 struct SnapshotMessage
 {
-	uint8_t			type;
-	float			server_time;
-	uint8_t			player_count;
-	uint8_t			shot_count;
-	QuantizedPlayer players[MAX_PLAYERS];
-	QuantizedShot	shots[MAX_SHOTS];
+	uint8_t	 type;
+	Tick	 server_tick;
+	uint8_t	 player_count;
+	uint8_t	 shot_count;
+	uint32_t first_shot_sequence;
+	uint32_t next_shot_sequence;
 };
 
 struct PlayerLeftEvent
@@ -154,13 +283,36 @@ struct PlayerKilledEvent
 
 #pragma pack(pop)
 
+#define MAX_SNAPSHOT_SHOTS \
+	((SNAPSHOT_BUDGET - sizeof(SnapshotMessage) - MAX_PLAYERS * sizeof(QuantizedPlayer)) / sizeof(QuantizedShot))
+static_assert(MAX_SNAPSHOT_SHOTS >= MAX_PLAYERS && MAX_SNAPSHOT_SHOTS <= 255, "Snapshot budget doesn't fit the shots");
+
+inline QuantizedPlayer *
+snapshot_players(SnapshotMessage *snap)
+{
+	return (QuantizedPlayer *)(snap + 1);
+}
+
+inline QuantizedShot *
+snapshot_shots(SnapshotMessage *snap)
+{
+	return (QuantizedShot *)(snapshot_players(snap) + snap->player_count);
+}
+
+inline uint32_t
+snapshot_size(uint32_t player_count, uint32_t shot_count)
+{
+	return sizeof(SnapshotMessage) + player_count * sizeof(QuantizedPlayer) + shot_count * sizeof(QuantizedShot);
+}
+
 inline ConnectAccept
-make_connect_accept(uint32_t client_id, float server_time, int8_t player_index)
+make_connect_accept(uint32_t client_id, Tick server_tick, int8_t player_index, uint16_t tick_rate)
 {
 	ConnectAccept msg = {};
 	msg.type = MSG_CONNECT_ACCEPT;
-	msg.server_time = server_time;
+	msg.server_tick = server_tick;
 	msg.player_index = player_index;
+	msg.tick_rate = tick_rate;
 	return msg;
 }
 
@@ -178,7 +330,7 @@ make_leave_event(int8_t player_idx)
 
 inline InputMessage
 make_input_message(uint32_t seq, float move_x, float move_z, float yaw, float pitch, uint8_t buttons,
-				   float shot_time = 0)
+				   Tick shot_tick = 0)
 {
 	InputMessage msg = {};
 	msg.type = MSG_CLIENT_INPUT;
@@ -188,6 +340,8 @@ make_input_message(uint32_t seq, float move_x, float move_z, float yaw, float pi
 	msg.look_yaw = yaw;
 	msg.look_pitch = pitch;
 	msg.buttons = buttons;
-	msg.shot_time = shot_time;
+	msg.shot_tick = shot_tick;
+	msg.press_yaw = yaw;
+	msg.press_pitch = pitch;
 	return msg;
 }
@@ -0,0 +1,205 @@
+#include "large_pages.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static bool LARGE_PAGES_ENABLED = false;
+
+/*
+ * Faults every page in now, rather than in the middle of whatever first uses it, and from the
+ * allocating thread, so they're placed on its NUMA node
+ */
+static void
+touch_pages(LargeBlock *block)
+{
+	size_t page = block->kind == PAGES_HUGE ? HUGE_PAGE_SIZE : 4096; /* transparent ones might be small */
+	for (size_t i = 0; i < block->size; i += page)
+	{
+		block->data[i] = 0;
+	}
+}
+
+static size_t
+round_up(size_t size, size_t to)
+{
+	return (size + to - 1) / to * to;
+}
+
+void
+large_pages_set_enabled(bool enabled)
+{
+	LARGE_PAGES_ENABLED = enabled;
+}
+
+#ifdef _WIN32
+
+bool
+large_block_alloc(LargeBlock *block, size_t size)
+{
+	*block = {};
+
+	/* Needs the 'Lock pages in memory' privilege, without it this just fails */
+	size_t large_page = GetLargePageMinimum();
+	if (LARGE_PAGES_ENABLED && large_page)
+	{
+		size_t rounded = round_up(size, large_page);
+		void  *data = VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (data)
+		{
+			block->data = (uint8_t *)data;
+			block->size = rounded;
+			block->kind = PAGES_HUGE;
+			block->mapping = data;
+			block->mapping_size = rounded;
+			touch_pages(block);
+			return true;
+		}
+	}
+
+	void *data = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!data)
+	{
+		return false;
+	}
+	block->data = (uint8_t *)data;
+	block->size = size;
+	block->kind = PAGES_SMALL;
+	block->mapping = data;
+	block->mapping_size = size;
+	touch_pages(block);
+	return true;
+}
+
+void
+large_block_free(LargeBlock *block)
+{
+	if (block->mapping)
+	{
+		VirtualFree(block->mapping, 0, MEM_RELEASE);
+	}
+	*block = {};
+}
+
+#else
+
+/*
+ * madvise(MADV_HUGEPAGE) only fails when the kernel has no transparent huge pages at all. With them
+ * set to "never" it succeeds and does nothing, so that's checked separately
+ */
+static bool
+transparent_huge_pages_off()
+{
+	char  setting[64] = {};
+	FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (!file)
+	{
+		return false;
+	}
+	bool read = fgets(setting, sizeof(setting), file) != nullptr;
+	fclose(file);
+	return read && strstr(setting, "[never]") != nullptr;
+}
+
+static void *
+map_anonymous(size_t size, int extra_flags)
+{
+	void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+	return data == MAP_FAILED ? nullptr : data;
+}
+
+bool
+large_block_alloc(LargeBlock *block, size_t size)
+{
+	*block = {};
+
+	if (LARGE_PAGES_ENABLED)
+	{
+		size_t rounded = round_up(size, HUGE_PAGE_SIZE);
+
+#ifdef MAP_HUGETLB
+		if (void *data = map_anonymous(rounded, MAP_HUGETLB))
+		{
+			block->data = (uint8_t *)data;
+			block->size = rounded;
+			block->kind = PAGES_HUGE;
+			block->mapping = data;
+			block->mapping_size = rounded;
+			touch_pages(block);
+			return true;
+		}
+#endif
+
+#ifdef MADV_HUGEPAGE
+		/*
+		 * A huge page has to start on a 2MB boundary, which mmap doesn't promise, so map an extra
+		 * 2MB and use the aligned part
+		 */
+		void	 *mapping = transparent_huge_pages_off() ? nullptr : map_anonymous(rounded + HUGE_PAGE_SIZE, 0);
+		uintptr_t aligned = round_up((uintptr_t)mapping, HUGE_PAGE_SIZE);
+
+		/* Refused, it's 4KB pages after all, and the plain mapping below doesn't waste the extra 2MB */
+		if (mapping && madvise((void *)aligned, rounded, MADV_HUGEPAGE) != 0)
+		{
+			munmap(mapping, rounded + HUGE_PAGE_SIZE);
+			mapping = nullptr;
+		}
+
+		if (mapping)
+		{
+			block->data = (uint8_t *)aligned;
+			block->size = rounded;
+			block->kind = PAGES_TRANSPARENT_HUGE;
+			block->mapping = mapping;
+			block->mapping_size = rounded + HUGE_PAGE_SIZE;
+			touch_pages(block);
+			return true;
+		}
+#endif
+	}
+
+	void *data = map_anonymous(size, 0);
+	if (!data)
+	{
+		return false;
+	}
+	block->data = (uint8_t *)data;
+	block->size = size;
+	block->kind = PAGES_SMALL;
+	block->mapping = data;
+	block->mapping_size = size;
+	touch_pages(block);
+	return true;
+}
+
+void
+large_block_free(LargeBlock *block)
+{
+	if (block->mapping)
+	{
+		munmap(block->mapping, block->mapping_size);
+	}
+	*block = {};
+}
+
+#endif
+
+const char *
+page_kind_name(PageKind kind)
+{
+	switch (kind)
+	{
+	case PAGES_HUGE:
+		return "huge pages";
+	case PAGES_TRANSPARENT_HUGE:
+		return "transparent huge pages";
+	default:
+		return "4KB pages";
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+/*
+ * Large, long-lived allocations, optionally in huge pages
+ *
+ * Every page the CPU touches needs a TLB entry to translate its address, and there are only so many.
+ * The packet pool, the lag compensation history and the frames are hundreds of KB touched all over
+ * every tick, which is a hundred or so 4KB pages, more than the TLB holds alongside everything else.
+ * In 2MB pages each is one entry.
+ *
+ * Explicit huge pages (MAP_HUGETLB) have to be reserved up front by the admin
+ * (vm.nr_hugepages), so when there are none we ask for transparent ones instead: a 2MB aligned
+ * mapping with MADV_HUGEPAGE, which the kernel backs with a huge page if it has one to spare.
+ * Either way the block works the same, only how it's backed changes.
+ *
+ * Off unless large_pages_set_enabled is called, a 375KB pool rounds up to a whole 2MB page.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#define HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
+enum PageKind : uint8_t
+{
+	PAGES_SMALL,
+	PAGES_TRANSPARENT_HUGE, /* asked for, the kernel may not have given them */
+	PAGES_HUGE,
+};
+
+struct LargeBlock
+{
+	uint8_t *data;
+	size_t	 size; /* as mapped, rounded up */
+	PageKind kind;
+
+	/* The mapping, which is larger than data when it was over-allocated to align it */
+	void  *mapping;
+	size_t mapping_size;
+};
+
+void
+large_pages_set_enabled(bool enabled);
+
+/* Zeroed, page aligned, false if there's no memory at all */
+bool
+large_block_alloc(LargeBlock *block, size_t size);
+
+void
+large_block_free(LargeBlock *block);
+
+const char *
+page_kind_name(PageKind kind);
@@ -0,0 +1,429 @@
+#include "log.hpp"
+#include "time.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#define LOG_LINE_BYTES		 512
+#define LOG_OUTPUT_BYTES	 (64 * 1024) /* formatted lines are gathered and written in one go */
+#define LOG_WRITER_SLEEP_MS	 2
+#define LOG_NS_PER_SECOND	 1000000000ll
+#define LOG_RING_MASK		 (LOG_RING_RECORDS - 1)
+
+static_assert((LOG_RING_RECORDS & LOG_RING_MASK) == 0, "LOG_RING_RECORDS must be a power of 2");
+
+/*
+ * One producer, the thread that claimed it, one consumer, the writer. A thread's ring is handed back
+ * when it exits, and the next new thread to log takes it over rather than allocating another
+ */
+struct LogRing
+{
+	alignas(64) std::atomic<uint32_t> write_pos;
+	alignas(64) std::atomic<uint32_t> read_pos;
+	alignas(64) std::atomic<bool> owned;
+	std::atomic<uint32_t> dropped; /* full when the thread wanted to log */
+	LogRecord			  records[LOG_RING_RECORDS];
+};
+
+struct LogThread
+{
+	LogRing *ring;
+
+	~LogThread()
+	{
+		if (ring)
+		{
+			ring->owned.store(false, std::memory_order_release);
+		}
+	}
+};
+
+static struct
+{
+	std::atomic<LogRing *> rings[LOG_MAX_THREADS];
+	std::atomic<uint32_t>  ring_count;
+	std::atomic<uint32_t>  ringless_dropped; /* from threads past LOG_MAX_THREADS */
+
+	/* Sites that have gone over their rate at some point, pushed on by producers, walked by the writer */
+	std::atomic<LogSite *> suppressing;
+
+	std::atomic<bool> running;
+	std::thread		  writer;
+
+	/* Writer only */
+	char	 output[LOG_OUTPUT_BYTES];
+	uint32_t output_used;
+} LOGGER;
+
+static thread_local LogThread LOG_THREAD;
+static thread_local LogRecord LOG_DIRECT; /* before log_start, formatted and printed on the spot */
+
+static int64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static bool
+site_allows(LogSite *site, int64_t now)
+{
+	/* Approximate under contention, two threads can both start a window, which only costs a few extra lines */
+	int64_t start = site->window_start.load(std::memory_order_relaxed);
+	if (now - start >= LOG_NS_PER_SECOND &&
+		site->window_start.compare_exchange_strong(start, now, std::memory_order_relaxed))
+	{
+		site->lines.store(0, std::memory_order_relaxed);
+	}
+
+	if (site->lines.fetch_add(1, std::memory_order_relaxed) < LOG_SITE_LINES_PER_SECOND)
+	{
+		return true;
+	}
+
+	site->suppressed.fetch_add(1, std::memory_order_relaxed);
+	if (!site->listed.exchange(true, std::memory_order_relaxed))
+	{
+		LogSite *head = LOGGER.suppressing.load(std::memory_order_relaxed);
+		do
+		{
+			site->next = head;
+		} while (!LOGGER.suppressing.compare_exchange_weak(head, site, std::memory_order_release,
+														   std::memory_order_relaxed));
+	}
+	return false;
+}
+
+static LogRing *
+claim_ring()
+{
+	uint32_t count = LOGGER.ring_count.load(std::memory_order_acquire);
+	for (uint32_t i = 0; i < count && i < LOG_MAX_THREADS; i++)
+	{
+		LogRing *ring = LOGGER.rings[i].load(std::memory_order_acquire);
+		bool	 expected = false;
+		if (ring && ring->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+		{
+			return ring;
+		}
+	}
+
+	/* Once per thread, and only for threads that log */
+	uint32_t index = LOGGER.ring_count.fetch_add(1, std::memory_order_acq_rel);
+	if (index >= LOG_MAX_THREADS)
+	{
+		return nullptr;
+	}
+	LogRing *ring = new LogRing();
+	ring->owned.store(true, std::memory_order_relaxed);
+	LOGGER.rings[index].store(ring, std::memory_order_release);
+	return ring;
+}
+
+LogRecord *
+log_begin(LogSite *site)
+{
+	int64_t now = now_ns();
+	if (!site_allows(site, now))
+	{
+		return nullptr;
+	}
+
+	LogRecord *record;
+	if (!LOGGER.running.load(std::memory_order_acquire))
+	{
+		record = &LOG_DIRECT;
+	}
+	else
+	{
+		if (!LOG_THREAD.ring)
+		{
+			LOG_THREAD.ring = claim_ring();
+			if (!LOG_THREAD.ring)
+			{
+				LOGGER.ringless_dropped.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+
+		LogRing *ring = LOG_THREAD.ring;
+		uint32_t write = ring->write_pos.load(std::memory_order_relaxed);
+		if (((write + 1) & LOG_RING_MASK) == ring->read_pos.load(std::memory_order_acquire))
+		{
+			ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		record = &ring->records[write];
+	}
+
+	record->site = site;
+	record->time_ns = now;
+	record->arg_count = 0;
+	return record;
+}
+
+/*
+ * printf's length modifiers are dropped and replaced to match how the argument was stored, the rest of
+ * the conversion, flags, width and precision, is passed on as written
+ */
+static uint32_t
+format_record(const LogRecord *record, char *out, uint32_t capacity)
+{
+	const char *format = record->site->format;
+	uint32_t	length = 0;
+	uint8_t		arg = 0;
+
+	while (*format && length < capacity - 1)
+	{
+		if (*format != '%')
+		{
+			out[length++] = *format++;
+			continue;
+		}
+		if (format[1] == '%')
+		{
+			out[length++] = '%';
+			format += 2;
+			continue;
+		}
+
+		char	 spec[32];
+		uint32_t spec_length = 0;
+		spec[spec_length++] = *format++;
+		while (*format && strchr("-+ #0123456789.", *format) && spec_length < sizeof(spec) - 4)
+		{
+			spec[spec_length++] = *format++;
+		}
+		while (*format && strchr("hlLqjzt", *format))
+		{
+			format++;
+		}
+		char conversion = *format ? *format++ : 's';
+
+		if (arg >= record->arg_count)
+		{
+			break;
+		}
+
+		uint64_t value = record->args[arg];
+		int		 written = 0;
+		switch (record->kinds[arg++])
+		{
+		case LOG_ARG_INT:
+		case LOG_ARG_UINT:
+			if (conversion == 'c')
+			{
+				spec[spec_length++] = 'c';
+				spec[spec_length] = '\0';
+				written = snprintf(out + length, capacity - length, spec, (int)value);
+				break;
+			}
+			if (!strchr("diouxX", conversion))
+			{
+				conversion = record->kinds[arg - 1] == LOG_ARG_INT ? 'd' : 'u';
+			}
+			spec[spec_length++] = 'l';
+			spec[spec_length++] = 'l';
+			spec[spec_length++] = conversion;
+			spec[spec_length] = '\0';
+			written = snprintf(out + length, capacity - length, spec, (long long)value);
+			break;
+		case LOG_ARG_DOUBLE: {
+			double d;
+			memcpy(&d, &value, sizeof(d));
+			spec[spec_length++] = strchr("fFeEgGaA", conversion) ? conversion : 'f';
+			spec[spec_length] = '\0';
+			written = snprintf(out + length, capacity - length, spec, d);
+			break;
+		}
+		case LOG_ARG_STRING:
+			spec[spec_length++] = 's';
+			spec[spec_length] = '\0';
+			written = snprintf(out + length, capacity - length, spec, record->text + value);
+			break;
+		default:
+			spec[spec_length++] = 'p';
+			spec[spec_length] = '\0';
+			written = snprintf(out + length, capacity - length, spec, (void *)(uintptr_t)value);
+			break;
+		}
+
+		if (written > 0)
+		{
+			length += (uint32_t)written < capacity - length ? (uint32_t)written : capacity - length - 1;
+		}
+	}
+
+	out[length] = '\0';
+	return length;
+}
+
+void
+log_commit(LogRecord *record)
+{
+	if (record == &LOG_DIRECT)
+	{
+		char line[LOG_LINE_BYTES];
+		format_record(record, line, sizeof(line));
+		fputs(line, stdout);
+		return;
+	}
+
+	LogRing *ring = LOG_THREAD.ring;
+	ring->write_pos.store((ring->write_pos.load(std::memory_order_relaxed) + 1) & LOG_RING_MASK,
+						  std::memory_order_release);
+}
+
+static void
+flush_output()
+{
+	if (LOGGER.output_used)
+	{
+		fwrite(LOGGER.output, 1, LOGGER.output_used, stdout);
+		fflush(stdout);
+		LOGGER.output_used = 0;
+	}
+}
+
+static void
+output_line(const char *format, ...)
+{
+	if (LOGGER.output_used + LOG_LINE_BYTES > LOG_OUTPUT_BYTES)
+	{
+		flush_output();
+	}
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(LOGGER.output + LOGGER.output_used, LOG_LINE_BYTES, format, args);
+	va_end(args);
+	if (written > 0)
+	{
+		LOGGER.output_used += written < LOG_LINE_BYTES ? written : LOG_LINE_BYTES - 1;
+	}
+}
+
+/*
+ * Each ring is in time order, so the oldest record overall is at the head of one of them. Taking the
+ * oldest head each time interleaves the threads the way the lines happened
+ */
+static void
+drain_rings()
+{
+	uint32_t count = LOGGER.ring_count.load(std::memory_order_acquire);
+	if (count > LOG_MAX_THREADS)
+	{
+		count = LOG_MAX_THREADS;
+	}
+
+	for (;;)
+	{
+		LogRing	 *oldest = nullptr;
+		LogRecord *oldest_record = nullptr;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			LogRing *ring = LOGGER.rings[i].load(std::memory_order_acquire);
+			if (!ring)
+			{
+				continue;
+			}
+			uint32_t read = ring->read_pos.load(std::memory_order_relaxed);
+			if (read == ring->write_pos.load(std::memory_order_acquire))
+			{
+				continue;
+			}
+			if (!oldest_record || ring->records[read].time_ns < oldest_record->time_ns)
+			{
+				oldest = ring;
+				oldest_record = &ring->records[read];
+			}
+		}
+		if (!oldest)
+		{
+			break;
+		}
+
+		if (LOGGER.output_used + LOG_LINE_BYTES > LOG_OUTPUT_BYTES)
+		{
+			flush_output();
+		}
+		LOGGER.output_used += format_record(oldest_record, LOGGER.output + LOGGER.output_used, LOG_LINE_BYTES);
+		oldest->read_pos.store((oldest->read_pos.load(std::memory_order_relaxed) + 1) & LOG_RING_MASK,
+							   std::memory_order_release);
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		LogRing *ring = LOGGER.rings[i].load(std::memory_order_acquire);
+		uint32_t dropped = ring ? ring->dropped.exchange(0, std::memory_order_relaxed) : 0;
+		if (dropped)
+		{
+			output_line("Log ring full, dropped %u lines\n", dropped);
+		}
+	}
+	uint32_t ringless = LOGGER.ringless_dropped.exchange(0, std::memory_order_relaxed);
+	if (ringless)
+	{
+		output_line("Over %d logging threads, dropped %u lines\n", LOG_MAX_THREADS, ringless);
+	}
+}
+
+/* Once a second, and once more at the end for whatever's left */
+static void
+report_suppressed(bool final)
+{
+	static int64_t last_report = 0;
+	int64_t		   now = now_ns();
+	if (!final && now - last_report < LOG_NS_PER_SECOND)
+	{
+		return;
+	}
+	last_report = now;
+
+	for (LogSite *site = LOGGER.suppressing.load(std::memory_order_acquire); site; site = site->next)
+	{
+		uint32_t suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+		if (suppressed)
+		{
+			int format_length = (int)strcspn(site->format, "\n");
+			output_line("Suppressed %u more \"%.*s\"\n", suppressed, format_length, site->format);
+		}
+	}
+}
+
+static void
+writer_thread_func()
+{
+	while (LOGGER.running.load(std::memory_order_acquire))
+	{
+		drain_rings();
+		report_suppressed(false);
+		flush_output();
+		sleep_milliseconds(LOG_WRITER_SLEEP_MS);
+	}
+
+	drain_rings();
+	report_suppressed(true);
+	flush_output();
+}
+
+void
+log_start()
+{
+	if (LOGGER.running.exchange(true))
+	{
+		return;
+	}
+	/* Anything printed before now goes out first */
+	fflush(stdout);
+	LOGGER.writer = std::thread(writer_thread_func);
+}
+
+void
+log_stop()
+{
+	if (!LOGGER.running.exchange(false))
+	{
+		return;
+	}
+	LOGGER.writer.join();
+}
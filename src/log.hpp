@@ -0,0 +1,162 @@
+#pragma once
+/*
+ * Logging that never waits on the terminal
+ *
+ * printf takes stdout's lock and, once the buffer fills, blocks in write() until the terminal or pipe
+ * takes the bytes. A slow terminal, a paused pager, or a burst of 'dropping packet' lines, and the tick
+ * or receive thread stops for it.
+ *
+ * LOG instead copies the format string's address and the arguments into a fixed size record on a ring
+ * belonging to the calling thread, which costs about as much as a function call. A writer thread
+ * formats the records, in time order across threads, and does the write. If a ring fills the record is
+ * dropped and counted, it never waits.
+ *
+ * Each call site is rate limited, past LOG_SITE_LINES_PER_SECOND its lines are counted rather than
+ * written, and the count is reported once the second is up.
+ *
+ * Until log_start is called LOG prints straight away, so tools and benchmarks need do nothing.
+ *
+ * The format must be a string literal, only its address is kept. %s arguments are copied, up to
+ * LOG_TEXT_BYTES between them. There's no %n or * width.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#define LOG_MAX_ARGS			  6
+#define LOG_TEXT_BYTES			  48
+#define LOG_RING_RECORDS		  1024 /* per thread, 128KB */
+#define LOG_MAX_THREADS			  128
+#define LOG_SITE_LINES_PER_SECOND 100 /* enough for a full server's worth of joins at once */
+
+enum LogArgKind : uint8_t
+{
+	LOG_ARG_INT,
+	LOG_ARG_UINT,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_STRING, /* offset into the record's text */
+	LOG_ARG_POINTER,
+};
+
+/* One per LOG, rate limit state shared by every thread that calls it */
+struct LogSite
+{
+	const char			 *format;
+	std::atomic<int64_t>  window_start{0};
+	std::atomic<uint32_t> lines{0};
+	std::atomic<uint32_t> suppressed{0};
+	std::atomic<bool>	  listed{false}; /* on the writer's list of sites to report suppressions for */
+	LogSite				 *next = nullptr;
+};
+
+struct alignas(64) LogRecord
+{
+	LogSite *site;
+	int64_t	 time_ns;
+	uint8_t	 arg_count;
+	uint8_t	 kinds[LOG_MAX_ARGS];
+	uint64_t args[LOG_MAX_ARGS];
+	char	 text[LOG_TEXT_BYTES];
+};
+
+static_assert(sizeof(LogRecord) == 128, "LogRecord should be two cache lines");
+
+/* Starts the writer thread, LOG is synchronous until then */
+void
+log_start();
+
+/* Writes whatever's queued and stops the writer, LOG is synchronous again afterwards */
+void
+log_stop();
+
+/*
+ * The calling thread's record for 'site', or nullptr when the site is over its rate or the ring is full.
+ * log_commit publishes it
+ */
+LogRecord *
+log_begin(LogSite *site);
+
+void
+log_commit(LogRecord *record);
+
+/*
+ * Arguments are stored as 64 bit values and tagged with their kind, the writer rewrites each conversion
+ * to match, so %d given an int8_t and %zu given a size_t both come out right
+ */
+template <typename T>
+inline void
+log_put(LogRecord *record, uint32_t *text_used, T value)
+{
+	uint8_t i = record->arg_count++;
+	if constexpr (std::is_floating_point_v<T>)
+	{
+		double d = value;
+		record->kinds[i] = LOG_ARG_DOUBLE;
+		memcpy(&record->args[i], &d, sizeof(d));
+	}
+	else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+	{
+		bool is_signed = std::is_signed_v<std::conditional_t<std::is_enum_v<T>, int, T>>;
+		record->kinds[i] = is_signed ? LOG_ARG_INT : LOG_ARG_UINT;
+		record->args[i] = is_signed ? (uint64_t)(int64_t)value : (uint64_t)value;
+	}
+	else if constexpr (std::is_convertible_v<T, const char *>)
+	{
+		/* Once the text is full the rest are empty, pointed at the last string's terminator */
+		const char *string = value ? (const char *)value : "(null)";
+		uint32_t	start = *text_used < LOG_TEXT_BYTES ? *text_used : LOG_TEXT_BYTES - 1;
+		while (*string && *text_used < LOG_TEXT_BYTES - 1)
+		{
+			record->text[(*text_used)++] = *string++;
+		}
+		if (*text_used < LOG_TEXT_BYTES)
+		{
+			record->text[(*text_used)++] = '\0';
+		}
+		record->kinds[i] = LOG_ARG_STRING;
+		record->args[i] = start;
+	}
+	else
+	{
+		static_assert(std::is_pointer_v<T>, "LOG takes numbers, strings and pointers");
+		record->kinds[i] = LOG_ARG_POINTER;
+		record->args[i] = (uint64_t)(uintptr_t)value;
+	}
+}
+
+template <typename... Args>
+inline void
+log_write(LogSite *site, Args... args)
+{
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many LOG arguments");
+	LogRecord *record = log_begin(site);
+	if (!record)
+	{
+		return;
+	}
+	uint32_t text_used = 0;
+	(log_put(record, &text_used, args), ...);
+	log_commit(record);
+}
+
+/* Never called, only here so the compiler checks LOG's arguments against its format like printf's */
+#if defined(__GNUC__)
+__attribute__((format(printf, 1, 2)))
+#endif
+inline void
+log_check_format(const char *, ...)
+{
+}
+
+#define LOG(format, ...)                                                                                               \
+	do                                                                                                                 \
+	{                                                                                                                  \
+		static LogSite log_site_ = {format};                                                                           \
+		if (false)                                                                                                     \
+		{                                                                                                              \
+			log_check_format(format, ##__VA_ARGS__);                                                                   \
+		}                                                                                                              \
+		log_write(&log_site_, ##__VA_ARGS__);                                                                          \
+	} while (0)
@@ -2,22 +2,168 @@
 #include "ai.hpp"
 #include "client.hpp"
 #include "game_types.hpp"
+#include "log.hpp"
+#include "matchmaker.hpp"
+#include "relay.hpp"
 #include "server.hpp"
+#include "telemetry.hpp"
+#include "threads.hpp"
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <thread>
 
 int
 main(int argc, char **argv)
 {
+	/* Runtime messages go through the log writer, so the tick and receive threads never wait on stdout */
+	log_start();
+	atexit(log_stop);
 
 	if (argc > 1 && strcmp(argv[1], "server") == 0)
 	{
-		run_server();
+		ServerConfig config = server_default_config();
+		int			 arg = 2;
+		if (argc > arg && argv[arg][0] != '-')
+		{
+			uint16_t port = atoi(argv[arg++]);
+			config.port = port ? port : SERVER_PORT;
+		}
+		for (; arg < argc; arg++)
+		{
+			if (strcmp(argv[arg], "--report") == 0 && arg + 1 < argc)
+			{
+				config.report_port = atoi(argv[++arg]);
+			}
+			else if (strcmp(argv[arg], "--tick-rate") == 0 && arg + 1 < argc)
+			{
+				config.tick_rate = atoi(argv[++arg]);
+			}
+			else if (strcmp(argv[arg], "--checkpoint") == 0 && arg + 1 < argc)
+			{
+				config.checkpoint_seconds = atof(argv[++arg]);
+			}
+			else if (strcmp(argv[arg], "--pin") == 0 && arg + 1 < argc)
+			{
+				/* tick,receive,net,send */
+				int16_t cpus[4];
+				if (parse_cpu_list(argv[++arg], cpus, 4) != 4)
+				{
+					printf("--pin takes four cpus: tick,receive,net,send\n");
+					return 1;
+				}
+				config.tick_cpu = cpus[0];
+				config.receive_cpu = cpus[1];
+				config.net_cpu = cpus[2];
+				config.send_cpu = cpus[3];
+			}
+			else if (strcmp(argv[arg], "--realtime") == 0)
+			{
+				config.realtime = true;
+			}
+			else if (strcmp(argv[arg], "--numa-local") == 0)
+			{
+				config.local_numa = true;
+			}
+			else if (strcmp(argv[arg], "--huge-pages") == 0)
+			{
+				config.huge_pages = true;
+			}
+			else if (strcmp(argv[arg], "--telemetry-hours") == 0 && arg + 1 < argc)
+			{
+				config.telemetry_hours = atof(argv[++arg]);
+			}
+			else if (strcmp(argv[arg], "--measure-startup") == 0)
+			{
+				config.measure_startup = true;
+			}
+		}
+		run_server(config);
+	}
+	else if (argc > 1 && strcmp(argv[1], "matchmaker") == 0)
+	{
+		/* One match per core by default, each server's sim is a single thread */
+		uint32_t count = std::thread::hardware_concurrency();
+		uint16_t tick_rate = DEFAULT_TICK_RATE;
+		for (int arg = 2; arg < argc; arg++)
+		{
+			if (strcmp(argv[arg], "--tick-rate") == 0 && arg + 1 < argc)
+			{
+				tick_rate = atoi(argv[++arg]);
+			}
+			else
+			{
+				count = atoi(argv[arg]);
+			}
+		}
+		run_matchmaker(argv[0], count ? count : 1, tick_rate);
 	}
 	else if (argc > 2 && strcmp(argv[1], "npcs") == 0)
 	{
 		uint32_t count = std::min(atoi(argv[2]), MAX_PLAYERS - 1);
-		ai_run_npcs("127.0.0.1", "bot", count);
+		bool	 matchmake = false;
+		bool	 measure_startup = false;
+		int16_t	 cpus[256];
+		uint32_t cpu_count = 0;
+		for (int arg = 3; arg < argc; arg++)
+		{
+			if (strcmp(argv[arg], "--matchmaker") == 0)
+			{
+				matchmake = true;
+			}
+			else if (strcmp(argv[arg], "--pin") == 0 && arg + 1 < argc)
+			{
+				cpu_count = parse_cpu_list(argv[++arg], cpus, 256);
+			}
+			else if (strcmp(argv[arg], "--measure-startup") == 0)
+			{
+				measure_startup = true;
+			}
+		}
+		ai_run_npcs("127.0.0.1", matchmake ? 0 : SERVER_PORT, "bot", count, cpus, cpu_count, measure_startup);
+	}
+	else if (argc > 1 && strcmp(argv[1], "relay") == 0)
+	{
+		float	 delays[MAX_DELAY_BUCKETS];
+		uint32_t delay_count = 0;
+		uint16_t server_port = SERVER_PORT;
+		uint16_t relay_port = RELAY_PORT;
+		for (int i = 2; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+			{
+				server_port = atoi(argv[++i]);
+			}
+			else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+			{
+				relay_port = atoi(argv[++i]);
+			}
+			else if (delay_count < MAX_DELAY_BUCKETS)
+			{
+				delays[delay_count++] = atof(argv[i]);
+			}
+		}
+		run_relay("127.0.0.1", server_port ? server_port : SERVER_PORT, relay_port ? relay_port : RELAY_PORT, delays,
+				  delay_count);
+	}
+	else if (argc > 2 && strcmp(argv[1], "telemetry") == 0)
+	{
+		/* CSV to stdout, the count to stderr so it stays out of the file */
+		TelemetryFile telemetry;
+		if (!telemetry_open(&telemetry, argv[2]))
+		{
+			return 1;
+		}
+		uint64_t first_tick = argc > 3 ? strtoull(argv[3], nullptr, 10) : 0;
+		uint64_t last_tick = argc > 4 ? strtoull(argv[4], nullptr, 10) : UINT64_MAX;
+		uint64_t exported = telemetry_export_csv(&telemetry, first_tick, last_tick, stdout);
+		fprintf(stderr, "%llu ticks\n", (unsigned long long)exported);
+		telemetry_close(&telemetry);
+	}
+	else if (argc > 2 && strcmp(argv[1], "play") == 0)
+	{
+		float speed = argc > 3 ? atof(argv[3]) : 1.0f;
+		run_demo(argv[2], speed > 0.0f ? speed : 1.0f, 0, 0, 1920, 800);
 	}
 	else if (argc > 1)
 	{
@@ -30,7 +176,42 @@ main(int argc, char **argv)
 			exit(0);
 		}
 
-		run_client("127.0.0.1", "markymark", port, 0, 0, 1920, 800);
+		if (argc > 2 && strcmp(argv[2], "--spectate") == 0)
+		{
+			uint8_t	 delay_bucket = argc > 3 ? atoi(argv[3]) : 0;
+			uint16_t relay_port = RELAY_PORT;
+			if (argc > 5 && strcmp(argv[4], "--relay") == 0)
+			{
+				relay_port = atoi(argv[5]);
+			}
+			run_spectator("127.0.0.1", relay_port ? relay_port : RELAY_PORT, port, delay_bucket, 0, 0, 1920, 800);
+			return 0;
+		}
+
+		uint16_t	server_port = SERVER_PORT;
+		const char *record_path = nullptr;
+		bool		measure_startup = false;
+		for (int i = 2; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			{
+				record_path = argv[++i];
+			}
+			else if (strcmp(argv[i], "--measure-startup") == 0)
+			{
+				measure_startup = true;
+			}
+			else if (strcmp(argv[i], "--matchmaker") == 0)
+			{
+				server_port = matchmaker_find_match("127.0.0.1", port);
+				if (!server_port)
+				{
+					return 0;
+				}
+			}
+		}
+
+		run_client("127.0.0.1", server_port, "markymark", port, record_path, measure_startup, 0, 0, 1920, 800);
 	}
 
 	return 0;
@@ -0,0 +1,446 @@
+/*
+ * Matchmaker
+ *
+ * A server process is one match, and its simulation is one thread, so a single match can't make use
+ * of a many-core machine. The matchmaker runs several side by side: it starts a server per match on
+ * consecutive ports, each told to report its load here once a second (players, and what a tick cost
+ * over that second), restarts any that exit, and tells clients asking where to play which one to join.
+ *
+ * The least loaded match is the one with the fewest players, counting the clients we've sent there that
+ * haven't shown up in a report yet, so a burst of clients doesn't all land on the same server. Matches
+ * whose ticks are close to overrunning are only used when nothing else has room.
+ *
+ * Clients talk to the matchmaker through NetworkClient like anything else. Load reports are bare
+ * datagrams on their own port: they're local, and if one is lost the next is a second away.
+ */
+#include "matchmaker.hpp"
+#include "containers.hpp"
+#include "game_types.hpp"
+#include "network_client.hpp"
+#include "time.hpp"
+#include "udp_socket.hpp"
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
+
+#define MAX_MATCHES				  32
+#define LOAD_STALE_SECONDS		  3.0f /* no report for this long and nobody is sent there */
+#define TICK_BUDGET				  0.8f /* of a tick, past it a match is running close to late */
+#define RESTART_DELAY_SECONDS	  1.0f
+#define MATCHMAKER_UPDATE_SECONDS 0.1f
+#define MATCHMAKER_REPORT_SECONDS 5.0f
+#define FIND_MATCH_TIMEOUT		  5.0f
+
+struct Match
+{
+	uint16_t   port;
+	ServerLoad load;
+	bool	   has_report;
+	TimePoint  last_report;
+	TimePoint  started;
+	uint8_t	   pending; /* sent here since the last report */
+
+#ifdef _WIN32
+	HANDLE process;
+#else
+	pid_t pid;
+#endif
+};
+
+static struct
+{
+	NetworkClient					net;
+	UdpSocket						load_socket;
+	const char					   *exe_path;
+	uint16_t						tick_rate;
+	fixed_array<Match, MAX_MATCHES> matches;
+	uint32_t						assigned;
+	uint32_t						turned_away;
+} MATCHMAKER = {};
+
+static volatile std::sig_atomic_t MATCHMAKER_RUNNING = 0;
+
+static void
+on_interrupt(int)
+{
+	MATCHMAKER_RUNNING = 0;
+}
+
+/* Each match reports its own tick rate, so the budget follows what the server is actually running */
+static bool
+over_budget(const ServerLoad &load)
+{
+	uint16_t tick_rate = load.tick_rate ? load.tick_rate : DEFAULT_TICK_RATE;
+	return load.tick_us_avg > 1e6f / tick_rate * TICK_BUDGET;
+}
+
+static bool
+start_match(Match *match)
+{
+	char port_arg[8];
+	char report_arg[8];
+	char tick_rate_arg[8];
+	snprintf(port_arg, sizeof(port_arg), "%u", match->port);
+	snprintf(report_arg, sizeof(report_arg), "%u", MATCHMAKER_LOAD_PORT);
+	snprintf(tick_rate_arg, sizeof(tick_rate_arg), "%u", MATCHMAKER.tick_rate);
+	match->has_report = false;
+	match->pending = 0;
+	match->started = time_now();
+
+#ifdef _WIN32
+	char command[512];
+	snprintf(command, sizeof(command), "\"%s\" server %s --report %s --tick-rate %s", MATCHMAKER.exe_path, port_arg,
+			 report_arg, tick_rate_arg);
+
+	STARTUPINFOA		startup = {sizeof(startup)};
+	PROCESS_INFORMATION info = {};
+	if (!CreateProcessA(nullptr, command, nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &info))
+	{
+		printf("Failed to start match on port %u\n", match->port);
+		match->process = nullptr;
+		return false;
+	}
+	CloseHandle(info.hThread);
+	match->process = info.hProcess;
+#else
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		printf("Failed to start match on port %u\n", match->port);
+		match->pid = 0;
+		return false;
+	}
+
+	if (pid == 0)
+	{
+#ifdef __linux__
+		/* Don't outlive the matchmaker */
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+		/* Not the matchmaker's sockets, and each server's chatter in its own log */
+		close(MATCHMAKER.net.socket.sock_fd);
+		close(MATCHMAKER.load_socket.sock_fd);
+
+		char log_path[32];
+		snprintf(log_path, sizeof(log_path), "match_%u.log", match->port);
+		int log = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (log >= 0)
+		{
+			dup2(log, STDOUT_FILENO);
+			dup2(log, STDERR_FILENO);
+			close(log);
+		}
+
+		execl(MATCHMAKER.exe_path, MATCHMAKER.exe_path, "server", port_arg, "--report", report_arg, "--tick-rate",
+			  tick_rate_arg, (char *)nullptr);
+		_exit(1);
+	}
+	match->pid = pid;
+#endif
+
+	printf("Started match on port %u\n", match->port);
+	return true;
+}
+
+static bool
+match_running(Match *match)
+{
+#ifdef _WIN32
+	return match->process && WaitForSingleObject(match->process, 0) == WAIT_TIMEOUT;
+#else
+	return match->pid > 0 && waitpid(match->pid, nullptr, WNOHANG) == 0;
+#endif
+}
+
+static void
+stop_match(Match *match)
+{
+#ifdef _WIN32
+	if (match->process)
+	{
+		TerminateProcess(match->process, 0);
+		CloseHandle(match->process);
+		match->process = nullptr;
+	}
+#else
+	if (match->pid > 0)
+	{
+		kill(match->pid, SIGTERM);
+		waitpid(match->pid, nullptr, 0);
+		match->pid = 0;
+	}
+#endif
+}
+
+static void
+check_matches()
+{
+	for (Match &match : MATCHMAKER.matches)
+	{
+		if (match_running(&match) || time_elapsed_seconds(match.started) < RESTART_DELAY_SECONDS)
+		{
+			continue;
+		}
+
+		printf("Match on port %u exited, restarting\n", match.port);
+#ifdef _WIN32
+		if (match.process)
+		{
+			CloseHandle(match.process);
+		}
+#endif
+		start_match(&match);
+	}
+}
+
+static void
+receive_load_reports()
+{
+	ServerLoad	load;
+	sockaddr_in from;
+	int			received;
+
+	/* The socket's receive timeout doubles as the loop's idle wait */
+	while ((received = udp_receive(&MATCHMAKER.load_socket, &load, sizeof(load), &from)) > 0)
+	{
+		if (received != sizeof(load) || load.type != MSG_SERVER_LOAD)
+		{
+			continue;
+		}
+
+		for (Match &match : MATCHMAKER.matches)
+		{
+			if (match.port == load.port)
+			{
+				match.load = load;
+				match.has_report = true;
+				match.last_report = time_now();
+				match.pending = 0;
+				break;
+			}
+		}
+	}
+}
+
+static Match *
+pick_match()
+{
+	Match	*best = nullptr;
+	uint32_t best_players = 0;
+	bool	 best_over_budget = false;
+
+	for (Match &match : MATCHMAKER.matches)
+	{
+		if (!match.has_report || time_elapsed_seconds(match.last_report) > LOAD_STALE_SECONDS)
+		{
+			continue;
+		}
+
+		uint32_t players = match.load.player_count + match.pending;
+		if (players >= match.load.max_players)
+		{
+			continue;
+		}
+
+		bool busy = over_budget(match.load);
+		bool better = !best || (best_over_budget && !busy) || (busy == best_over_budget && players < best_players);
+		if (better)
+		{
+			best = &match;
+			best_players = players;
+			best_over_budget = busy;
+		}
+	}
+	return best;
+}
+
+static void
+handle_match_request(uint32_t peer_id)
+{
+	Match *match = pick_match();
+
+	SendPacket<MatchAssign> reply = {};
+	reply.payload.type = MSG_MATCH_ASSIGN;
+	reply.payload.port = match ? match->port : 0;
+
+	/*
+	 * Unreliable, then the peer is gone. The client shuts down as soon as it has an answer, so a reliable
+	 * reply would hold a peer slot and send buffer here for seconds of retransmits. If the reply is lost
+	 * the client's request is retransmitted, it arrives as a new peer and asks again
+	 */
+	network_send_unreliable(&MATCHMAKER.net, peer_id, reply);
+	network_remove_peer(&MATCHMAKER.net, peer_id);
+
+	if (match)
+	{
+		match->pending++;
+		MATCHMAKER.assigned++;
+	}
+	else
+	{
+		MATCHMAKER.turned_away++;
+	}
+}
+
+static bool
+on_unrecognised(sockaddr_in address)
+{
+	return network_add_peer(&MATCHMAKER.net, address) != 0;
+}
+
+static void
+print_report()
+{
+	printf("Matchmaker: %u assigned, %u turned away\n", MATCHMAKER.assigned, MATCHMAKER.turned_away);
+	for (Match &match : MATCHMAKER.matches)
+	{
+		if (!match.has_report)
+		{
+			printf("  %u: no report yet\n", match.port);
+			continue;
+		}
+		printf("  %u: %u/%u players, %uHz tick %uus avg %uus max%s\n", match.port, match.load.player_count,
+			   match.load.max_players, match.load.tick_rate, match.load.tick_us_avg, match.load.tick_us_max,
+			   over_budget(match.load) ? " (over budget)" : "");
+	}
+	MATCHMAKER.assigned = 0;
+	MATCHMAKER.turned_away = 0;
+}
+
+void
+run_matchmaker(const char *exe_path, uint32_t match_count, uint16_t tick_rate)
+{
+	MATCHMAKER.exe_path = exe_path;
+	MATCHMAKER.tick_rate = tick_rate;
+
+	if (!network_init(&MATCHMAKER.net, "0.0.0.0", MATCHMAKER_PORT))
+	{
+		printf("Failed to initialize matchmaker on port %u\n", MATCHMAKER_PORT);
+		return;
+	}
+	MATCHMAKER.net.on_unrecognised = on_unrecognised;
+
+	if (udp_create(&MATCHMAKER.load_socket, "127.0.0.1", MATCHMAKER_LOAD_PORT, 1) != 0)
+	{
+		printf("Failed to open load report port %u\n", MATCHMAKER_LOAD_PORT);
+		network_shutdown(&MATCHMAKER.net);
+		return;
+	}
+
+	for (uint32_t i = 0; i < match_count && i < MAX_MATCHES; i++)
+	{
+		Match match = {};
+		match.port = MATCH_BASE_PORT + i;
+		MATCHMAKER.matches.push(match);
+		start_match(MATCHMAKER.matches.back());
+	}
+
+	printf("Matchmaker on port %u, %u matches at %u ticks a second\n", MATCHMAKER_PORT, MATCHMAKER.matches.size(),
+		   tick_rate);
+
+	TimePoint last_update = time_now();
+	TimePoint last_report = time_now();
+
+	/* Ctrl-C takes the matches down with it */
+	MATCHMAKER_RUNNING = 1;
+	std::signal(SIGINT, on_interrupt);
+
+	while (MATCHMAKER_RUNNING)
+	{
+		receive_load_reports();
+
+		Polled polled;
+		while (network_poll(&MATCHMAKER.net, polled))
+		{
+			if (polled.size >= 1 && polled.buffer[0] == MSG_MATCH_REQUEST)
+			{
+				handle_match_request(polled.from);
+			}
+			network_release_buffer(&MATCHMAKER.net, polled.buffer_index);
+		}
+
+		float since_update = time_elapsed_seconds(last_update);
+		if (since_update >= MATCHMAKER_UPDATE_SECONDS)
+		{
+			network_update(&MATCHMAKER.net, since_update);
+			check_matches();
+			last_update = time_now();
+		}
+
+		if (time_elapsed_seconds(last_report) >= MATCHMAKER_REPORT_SECONDS)
+		{
+			print_report();
+			last_report = time_now();
+		}
+	}
+
+	printf("Stopping matches\n");
+	for (Match &match : MATCHMAKER.matches)
+	{
+		stop_match(&match);
+	}
+	udp_close(&MATCHMAKER.load_socket);
+	network_shutdown(&MATCHMAKER.net);
+}
+
+uint16_t
+matchmaker_find_match(const char *ip, uint16_t bind_port)
+{
+	/* Only for the question, the caller binds the same port for the match afterwards */
+	NetworkClient *net = new NetworkClient();
+	if (!network_init(net, nullptr, bind_port))
+	{
+		delete net;
+		return 0;
+	}
+
+	uint32_t			   peer_id = network_add_peer(net, ip, MATCHMAKER_PORT);
+	SendPacket<MatchRequest> req = {};
+	req.payload.type = MSG_MATCH_REQUEST;
+	network_send_reliable(net, peer_id, req);
+
+	uint16_t  port = 0;
+	bool	  answered = false;
+	TimePoint start = time_now();
+	while (!answered && time_elapsed_seconds(start) < FIND_MATCH_TIMEOUT)
+	{
+		network_update(net, 0.01f);
+
+		Polled polled;
+		while (network_poll(net, polled))
+		{
+			if (polled.size >= sizeof(MatchAssign) && polled.buffer[0] == MSG_MATCH_ASSIGN)
+			{
+				port = ((MatchAssign *)polled.buffer)->port;
+				answered = true;
+			}
+			network_release_buffer(net, polled.buffer_index);
+		}
+		sleep_milliseconds(10);
+	}
+
+	network_shutdown(net);
+	delete net;
+
+	if (!answered)
+	{
+		printf("No answer from the matchmaker at %s:%u\n", ip, MATCHMAKER_PORT);
+	}
+	else if (!port)
+	{
+		printf("Every match is full\n");
+	}
+	return port;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * Starts 'match_count' servers, as 'exe_path server <port>' on ports from MATCH_BASE_PORT, each
+ * ticking at 'tick_rate', and hands connecting clients the least loaded one until killed
+ */
+void
+run_matchmaker(const char *exe_path, uint32_t match_count, uint16_t tick_rate);
+
+/* Asks the matchmaker at 'ip' which server to join, 0 if it didn't answer or everything is full */
+uint16_t
+matchmaker_find_match(const char *ip, uint16_t bind_port);
@@ -52,6 +52,12 @@ sphere_vs_aabb_local(Sphere &sphere, AABB &box, Contact *out_contact)
 	return true;
 }
 
+bool
+sphere_vs_aabb(Sphere &sphere, AABB &box, Contact *out_contact)
+{
+	return sphere_vs_aabb_local(sphere, box, out_contact);
+}
+
 bool
 sphere_vs_sphere(Sphere &a, Sphere &b, Contact *out_contact)
 {
@@ -106,7 +112,7 @@ sphere_vs_obb(Sphere &sphere, OBB &obb, Contact *out_contact)
 
 	return hit;
 }
-static bool
+bool
 raycast_aabb(Ray &ray, AABB &box, RayHit *out_hit)
 {
 	glm::vec3 inv_dir = glm::vec3(1.0f) / ray.direction;
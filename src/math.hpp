@@ -51,6 +51,7 @@ sphere_vs_aabb(Sphere &sphere, AABB &box, Contact *out_contact);
 
 bool
 sphere_vs_obb(Sphere &sphere, OBB &obb, Contact *out_contact);
+bool raycast_aabb(Ray &ray, AABB &box, RayHit *out_hit);
 bool raycast_sphere(Ray &ray, glm::vec3 &position, float radius, RayHit *out_hit);
 bool raycast_obb(Ray &ray, OBB &obb, RayHit *out_hit);
 
@@ -21,9 +21,15 @@
  *
  * Unreliable message are send and discarded, reliable messages are kept until we get our ack and
  * then freed.
+ *
+ * Reliable messages go out on a channel. Each channel numbers its messages separately from the packet
+ * sequence, so a retransmit can go out as a fresh packet (with fresh acks) and still be recognised as
+ * the same message by the receiver, and a message stuck waiting for its ack only ever fills its own
+ * channel's window.
  */
 
 #include "network_client.hpp"
+#include "log.hpp"
 #include "time.hpp"
 #include <cstring>
 #include <thread>
@@ -34,6 +40,8 @@
 
 #define MAX_RETRANSMIT_ATTEMPTS 10
 #define PEER_INACTIVITY_TIMEOUT 4.0f
+/* Ordered channels can only hold early arrivals while there are buffers left to receive the gap into */
+#define MAX_HELD_PACKETS (RECV_POOL_SIZE / 2)
 
 /*
  * I've tried to use descriptive macros rather than comments
@@ -55,10 +63,19 @@
 #define CLEAR_ACKNOWLEDGED_BIT(ack_bits, bit_index)			   ((ack_bits) &= ~(1u << (bit_index)))
 
 #define IS_WINDOW_SLOT_IN_USE(window_mask, slot) (((window_mask) & (1u << (slot))) != 0)
+#define MARK_WINDOW_SLOT(window_mask, slot)		 ((window_mask) |= (1u << (slot)))
 #define CLEAR_WINDOW_SLOT(window_mask, slot)	 ((window_mask) &= ~(1u << (slot)))
 
 #define IS_TIME_TO_RETRANSMIT(current_time, retransmit_time) ((current_time) >= (retransmit_time))
 #define HAS_EXCEEDED_MAX_RETRIES(retry_count)				 ((retry_count) >= MAX_RETRANSMIT_ATTEMPTS)
+#define MAP_SEQUENCE_TO_SENT_SLOT(sequence)					 ((sequence) & (SENT_HISTORY - 1))
+
+enum ChannelVerdict : uint8_t
+{
+	CHANNEL_DELIVER,
+	CHANNEL_HELD,
+	CHANNEL_DUPLICATE,
+};
 
 static int
 find_lowest_set_bit(uint32_t mask)
@@ -72,24 +89,41 @@ find_lowest_set_bit(uint32_t mask)
 #endif
 }
 
+static void
+release_payload_buffer(NetworkClient *net, uint8_t buffer_idx)
+{
+	if (--net->buffer_refs[buffer_idx] == 0)
+	{
+		net->send_free.push(buffer_idx);
+	}
+}
+
 static void
 acknowledge_packet(NetworkClient *net, PeerState *peer, uint16_t sequence)
 {
-	int16_t diff = CALCULATE_SEQUENCE_OFFSET(sequence, peer->window_start);
+	SentPacket *sent = &peer->sent[MAP_SEQUENCE_TO_SENT_SLOT(sequence)];
+
+	if (sent->sequence != sequence || sent->channel == NO_CHANNEL)
+	{
+		return;
+	}
+
+	ChannelSendState *channel = &peer->channels[sent->channel];
+	int16_t			  diff = CALCULATE_SEQUENCE_OFFSET(sent->channel_sequence, channel->window_start);
 
 	if (diff < 0 || diff >= WINDOW_SIZE)
 	{
 		return;
 	}
 
-	uint8_t slot = MAP_SEQUENCE_TO_WINDOW_SLOT(sequence);
+	uint8_t slot = MAP_SEQUENCE_TO_WINDOW_SLOT(sent->channel_sequence);
 
-	if (!IS_WINDOW_SLOT_IN_USE(peer->window_mask, slot))
+	if (!IS_WINDOW_SLOT_IN_USE(channel->window_mask, slot))
 	{
 		return;
 	}
 
-	float rtt = net->current_time - peer->window[slot].send_time;
+	float rtt = net->current_time - channel->window[slot].send_time;
 
 	/*
 	 * A real implementation would take a more adaptive view of this,
@@ -98,8 +132,9 @@ acknowledge_packet(NetworkClient *net, PeerState *peer, uint16_t sequence)
 	 */
 	peer->round_trip_time = rtt;
 
-	net->free_indices.try_push(peer->window[slot].buffer_idx);
-	CLEAR_WINDOW_SLOT(peer->window_mask, slot);
+	release_payload_buffer(net, channel->window[slot].buffer_idx);
+	CLEAR_WINDOW_SLOT(channel->window_mask, slot);
+	sent->channel = NO_CHANNEL;
 }
 
 static void
@@ -120,41 +155,45 @@ process_ack_bitmask(NetworkClient *net, PeerState *peer, uint16_t most_recent_ac
 }
 
 static void
-advance_window_start(PeerState *peer)
+advance_window_start(ChannelSendState *channel)
 {
-	while (HAS_PENDING_ACKS(peer->window_mask))
+	while (HAS_PENDING_ACKS(channel->window_mask))
 	{
-		uint8_t slot = MAP_SEQUENCE_TO_WINDOW_SLOT(peer->window_start);
-		if (IS_WINDOW_SLOT_IN_USE(peer->window_mask, slot))
+		uint8_t slot = MAP_SEQUENCE_TO_WINDOW_SLOT(channel->window_start);
+		if (IS_WINDOW_SLOT_IN_USE(channel->window_mask, slot))
 		{
 			break;
 		}
-		peer->window_start++;
+		channel->window_start++;
 	}
 
-	if (!HAS_PENDING_ACKS(peer->window_mask))
+	if (!HAS_PENDING_ACKS(channel->window_mask))
 	{
-		peer->window_start = peer->local_sequence;
+		channel->window_start = channel->local_sequence;
 	}
 }
 
+/*
+ * Works for packet sequences and unordered channel sequences alike: 'latest' is the newest seen,
+ * 'received_bits' which of the 32 before it have been
+ */
 static bool
-is_new_packet(uint16_t sequence, PeerState *peer)
+is_new_sequence(uint16_t sequence, uint16_t *latest, uint32_t *received_bits)
 {
-	int16_t diff = CALCULATE_SEQUENCE_OFFSET(sequence, peer->remote_sequence);
+	int16_t diff = CALCULATE_SEQUENCE_OFFSET(sequence, *latest);
 
 	if (IS_PACKET_NEWER_THAN_LATEST(diff))
 	{
 		if (IS_PACKET_WITHIN_ACK_WINDOW(diff))
 		{
-			SHIFT_ACK_WINDOW_FOR_NEW_PACKET(peer->remote_ack_bits, diff);
-			MARK_PREVIOUS_PACKET_RECEIVED(peer->remote_ack_bits, diff);
+			SHIFT_ACK_WINDOW_FOR_NEW_PACKET(*received_bits, diff);
+			MARK_PREVIOUS_PACKET_RECEIVED(*received_bits, diff);
 		}
 		else
 		{
-			CLEAR_ACK_WINDOW(peer->remote_ack_bits);
+			CLEAR_ACK_WINDOW(*received_bits);
 		}
-		peer->remote_sequence = sequence;
+		*latest = sequence;
 		return true;
 	}
 
@@ -169,46 +208,197 @@ is_new_packet(uint16_t sequence, PeerState *peer)
 	}
 
 	uint16_t bit_index = -diff - 1;
-	bool	 already_received = WAS_PACKET_ALREADY_RECEIVED(peer->remote_ack_bits, bit_index);
-	MARK_OUT_OF_ORDER_PACKET_RECEIVED(peer->remote_ack_bits, bit_index);
+	bool	 already_received = WAS_PACKET_ALREADY_RECEIVED(*received_bits, bit_index);
+	MARK_OUT_OF_ORDER_PACKET_RECEIVED(*received_bits, bit_index);
 
 	return !already_received;
 }
 
+/*
+ * Receive thread: whether a reliable packet can be taken on its channel right now. It only looks,
+ * a packet turned away is never marked received, so it isn't acked and the sender tries again
+ */
+static bool
+channel_accepts(NetworkClient *net, ChannelReceiveState *channel, const PacketHeader *header)
+{
+	if (!(header->flags & PACKET_FLAG_ORDERED))
+	{
+		return true;
+	}
+
+	int16_t diff = CALCULATE_SEQUENCE_OFFSET(header->channel_sequence, channel->latest);
+	if (diff <= 1)
+	{
+		/* Next in line, or already delivered */
+		return true;
+	}
+	return diff <= WINDOW_SIZE && net->rx_held < MAX_HELD_PACKETS;
+}
+
+static uint8_t
+channel_receive(ChannelReceiveState *channel, const PacketHeader *header, uint8_t buffer_idx, uint16_t bytes)
+{
+	uint16_t sequence = header->channel_sequence;
+
+	if (!(header->flags & PACKET_FLAG_ORDERED))
+	{
+		return is_new_sequence(sequence, &channel->latest, &channel->received_bits) ? CHANNEL_DELIVER
+																					: CHANNEL_DUPLICATE;
+	}
+
+	int16_t diff = CALCULATE_SEQUENCE_OFFSET(sequence, channel->latest);
+	if (diff <= 0)
+	{
+		return CHANNEL_DUPLICATE;
+	}
+	if (diff == 1)
+	{
+		channel->latest = sequence;
+		return CHANNEL_DELIVER;
+	}
+
+	/* Early, wait for the ones before it */
+	uint8_t slot = MAP_SEQUENCE_TO_WINDOW_SLOT(sequence);
+	if (IS_WINDOW_SLOT_IN_USE(channel->held_mask, slot))
+	{
+		return CHANNEL_DUPLICATE;
+	}
+	MARK_WINDOW_SLOT(channel->held_mask, slot);
+	channel->held_buffer[slot] = buffer_idx;
+	channel->held_size[slot] = bytes;
+	return CHANNEL_HELD;
+}
+
+/*
+ * Fills in the header's packet sequence and acks, and remembers what the packet carried so its ack
+ * can be matched back up
+ */
 static void
-check_peer_retransmits(NetworkClient *net, PeerState *peer, uint32_t peer_id)
+stamp_header(PeerState *peer, PacketHeader *header, uint8_t channel, uint16_t channel_sequence)
+{
+	uint16_t sequence = ++peer->local_sequence;
+	header->sequence = sequence;
+	header->ack = peer->remote_sequence;
+	header->ack_bits = peer->remote_ack_bits;
+
+	SentPacket *sent = &peer->sent[MAP_SEQUENCE_TO_SENT_SLOT(sequence)];
+	sent->sequence = sequence;
+	sent->channel = channel;
+	sent->channel_sequence = channel_sequence;
+}
+
+static void
+push_peer_command(NetworkClient *net, uint8_t type, uint32_t peer_id)
+{
+	PeerCommand command = {type, peer_id};
+	while (!net->peer_commands.try_push(command))
+	{
+		sleep_microseconds(100);
+	}
+}
+
+/*
+ * Owner side of a received packet: free acknowledged sends and take on the receive state the
+ * receive thread worked out. Results can arrive out of order between ack_queue and recv_queue,
+ * so only ever move remote_sequence forward.
+ */
+static void
+apply_receive_result(NetworkClient *net, PeerState *peer, const ReceiveResult &result)
 {
-	uint32_t slots_to_check = peer->window_mask;
+	peer->last_seen_time = net->current_time;
 
-	while (HAS_PENDING_ACKS(slots_to_check))
+	process_ack_bitmask(net, peer, result.ack, result.ack_bits);
+	for (uint8_t i = 0; i < MAX_CHANNELS; i++)
 	{
-		int			   slot = find_lowest_set_bit(slots_to_check);
-		PendingPacket *pending = &peer->window[slot];
+		advance_window_start(&peer->channels[i]);
+	}
 
-		if (IS_TIME_TO_RETRANSMIT(net->current_time, pending->next_retransmit_time))
+	int16_t diff = CALCULATE_SEQUENCE_OFFSET(result.remote_sequence, peer->remote_sequence);
+	if (diff > 0)
+	{
+		peer->remote_sequence = result.remote_sequence;
+		peer->remote_ack_bits = result.remote_ack_bits;
+	}
+	else if (diff == 0)
+	{
+		peer->remote_ack_bits |= result.remote_ack_bits;
+	}
+}
+
+static void
+drain_receive_results(NetworkClient *net)
+{
+	ReceiveResult result;
+	while (net->ack_queue.try_pop(result))
+	{
+		PeerState *peer = net->peers.get(result.peer_id);
+		if (peer)
+		{
+			apply_receive_result(net, peer, result);
+		}
+	}
+
+	net->stats.packets_received = net->rx_packets.load(std::memory_order_relaxed);
+	net->stats.bytes_received = net->rx_bytes.load(std::memory_order_relaxed);
+	net->stats.duplicates_received = net->rx_duplicates.load(std::memory_order_relaxed);
+	net->stats.packets_held = net->rx_held_total.load(std::memory_order_relaxed);
+}
+
+static void
+check_peer_retransmits(NetworkClient *net, PeerState *peer, uint32_t peer_id)
+{
+	for (uint8_t i = 0; i < MAX_CHANNELS; i++)
+	{
+		ChannelSendState *channel = &peer->channels[i];
+		uint32_t		  slots_to_check = channel->window_mask;
+
+		while (HAS_PENDING_ACKS(slots_to_check))
 		{
-			if (HAS_EXCEEDED_MAX_RETRIES(pending->retry_count))
+			int			   slot = find_lowest_set_bit(slots_to_check);
+			PendingPacket *pending = &channel->window[slot];
+
+			if (IS_TIME_TO_RETRANSMIT(net->current_time, pending->next_retransmit_time))
 			{
-				network_remove_peer(net, peer_id);
-				return;
+				if (HAS_EXCEEDED_MAX_RETRIES(pending->retry_count))
+				{
+					network_remove_peer(net, peer_id);
+					return;
+				}
+
+				/* Same message, new packet, so it isn't mistaken for a duplicate and carries current acks */
+				stamp_header(peer, &pending->header, i, pending->header.channel_sequence);
+
+				udp_send_gather(&net->socket, &pending->header, sizeof(PacketHeader),
+								net->packet_pool[pending->buffer_idx].data, pending->size, &peer->address);
+				net->stats.packets_sent++;
+				net->stats.bytes_sent += sizeof(PacketHeader) + pending->size;
+				net->stats.retransmits++;
+				pending->retry_count++;
+				auto retransmission_timeout = peer->round_trip_time * 1.1;
+				pending->next_retransmit_time = net->current_time + retransmission_timeout;
 			}
 
-			udp_send(&net->socket, net->packet_pool[pending->buffer_idx].data, pending->size, &peer->address);
-			pending->retry_count++;
-			auto retransmission_timeout = peer->round_trip_time * 1.1;
-			pending->next_retransmit_time = net->current_time + retransmission_timeout;
+			CLEAR_WINDOW_SLOT(slots_to_check, slot);
 		}
-
-		CLEAR_WINDOW_SLOT(slots_to_check, slot);
 	}
 }
 
 bool
-network_init(NetworkClient *net, const char *bind_ip, uint16_t bind_port)
+network_init(NetworkClient *net, const char *bind_ip, uint16_t bind_port,
+			 bool (*on_receive_thread)(uint32_t peer_id, const uint8_t *payload, uint16_t size))
 {
 	net->running = false;
 	net->current_time = 0.0f;
 	net->on_peer_removed = nullptr;
+	net->on_unrecognised = nullptr;
+	net->on_receive_thread = on_receive_thread;
+	net->stats = {};
+	net->rx_packets = 0;
+	net->rx_bytes = 0;
+	net->rx_duplicates = 0;
+	net->rx_held_total = 0;
+	net->rx_held = 0;
+	memset(net->channel_modes, DELIVERY_UNORDERED, sizeof(net->channel_modes));
 
 	if (udp_create(&net->socket, bind_ip, bind_port, 100) != 0)
 	{
@@ -216,10 +406,30 @@ network_init(NetworkClient *net, const char *bind_ip, uint16_t bind_port)
 		return false;
 	}
 
-	for (uint16_t i = 0; i < PACKET_POOL_SIZE; i++)
+	if (!net->packet_block.data)
+	{
+		if (!large_block_alloc(&net->packet_block, PACKET_POOL_SIZE * sizeof(PacketBuffer)))
+		{
+			printf("Failed to allocate packet pool\n");
+			udp_close(&net->socket);
+			return false;
+		}
+		net->packet_pool = (PacketBuffer *)net->packet_block.data;
+	}
+
+	net->peers.clear();
+	net->rx_peers.clear();
+	net->rx_spare.clear();
+	net->send_free.clear();
+	memset(net->buffer_refs, 0, sizeof(net->buffer_refs));
+	for (uint16_t i = 0; i < RECV_POOL_SIZE; i++)
 	{
 		net->free_indices.try_push(i);
 	}
+	for (uint16_t i = RECV_POOL_SIZE; i < PACKET_POOL_SIZE; i++)
+	{
+		net->send_free.push(i);
+	}
 
 	net->running = true;
 	net->recv_thread = std::thread(&NetworkClient::receive_thread_func, net);
@@ -240,6 +450,8 @@ network_shutdown(NetworkClient *net)
 		net->recv_thread.join();
 	}
 	udp_close(&net->socket);
+	large_block_free(&net->packet_block);
+	net->packet_pool = nullptr;
 }
 
 uint32_t
@@ -247,7 +459,7 @@ network_add_peer(NetworkClient *net, const char *ip, uint16_t port)
 {
 	if (net->peers.size() >= MAX_PEERS)
 	{
-		printf("Cannot add peer, limit reached \n");
+		LOG("Cannot add peer, limit reached \n");
 		return 0;
 	}
 
@@ -262,8 +474,13 @@ network_add_peer(NetworkClient *net, const char *ip, uint16_t port)
 	PeerState peer = {};
 	peer.address = addr;
 	peer.last_seen_time = net->current_time;
+	for (uint32_t i = 0; i < SENT_HISTORY; i++)
+	{
+		peer.sent[i].channel = NO_CHANNEL;
+	}
 
 	net->peers.insert(peer_id, peer);
+	push_peer_command(net, PEER_COMMAND_ADD, peer_id);
 	return peer_id;
 }
 
@@ -282,15 +499,20 @@ network_remove_peer(NetworkClient *net, uint32_t peer_id)
 		return;
 	}
 
-	uint32_t slots_to_free = peer->window_mask;
-	while (HAS_PENDING_ACKS(slots_to_free))
+	for (uint8_t i = 0; i < MAX_CHANNELS; i++)
 	{
-		int slot = find_lowest_set_bit(slots_to_free);
-		net->free_indices.try_push(peer->window[slot].buffer_idx);
-		CLEAR_WINDOW_SLOT(slots_to_free, slot);
+		ChannelSendState *channel = &peer->channels[i];
+		uint32_t		  slots_to_free = channel->window_mask;
+		while (HAS_PENDING_ACKS(slots_to_free))
+		{
+			int slot = find_lowest_set_bit(slots_to_free);
+			release_payload_buffer(net, channel->window[slot].buffer_idx);
+			CLEAR_WINDOW_SLOT(slots_to_free, slot);
+		}
 	}
 
 	net->peers.remove(peer_id);
+	push_peer_command(net, PEER_COMMAND_REMOVE, peer_id);
 
 	if (net->on_peer_removed)
 	{
@@ -298,9 +520,170 @@ network_remove_peer(NetworkClient *net, uint32_t peer_id)
 	}
 }
 
+void
+network_set_channel_mode(NetworkClient *net, uint8_t channel, DeliveryMode mode)
+{
+	assert(channel < MAX_CHANNELS);
+	net->channel_modes[channel] = mode;
+}
+
+/*
+ * Reliable payloads are copied once into a pool buffer, which each window entry that sends it takes
+ * a reference on
+ */
+static bool
+acquire_payload_buffer(NetworkClient *net, const void *packet, uint16_t total_size, uint8_t *buffer_idx)
+{
+	if (net->send_free.empty())
+	{
+		LOG("No free buffers, dropping packet\n");
+		net->stats.sends_dropped++;
+		return false;
+	}
+
+	*buffer_idx = *net->send_free.pop_back();
+	net->buffer_refs[*buffer_idx] = 0;
+	memcpy(net->packet_pool[*buffer_idx].data, (const uint8_t *)packet + sizeof(PacketHeader),
+		   total_size - sizeof(PacketHeader));
+	return true;
+}
+
+/* Nobody took it, e.g. every window was full */
+static void
+return_unused_payload_buffer(NetworkClient *net, uint8_t buffer_idx)
+{
+	if (net->buffer_refs[buffer_idx] == 0)
+	{
+		net->send_free.push(buffer_idx);
+	}
+}
+
+/*
+ * Fills in 'packet's header for this peer and sends it. A reliable packet also goes in the
+ * channel's window, pointing at the payload in 'buffer_idx'
+ */
+static void
+send_to_peer(NetworkClient *net, PeerState *peer, void *packet, uint16_t total_size, bool reliable,
+			 uint8_t channel_idx, uint8_t buffer_idx)
+{
+	PacketHeader	 *header = (PacketHeader *)packet;
+	ChannelSendState *channel = nullptr;
+	header->type = 0;
+	header->flags = 0x00;
+	header->channel = 0;
+	header->channel_sequence = 0;
+
+	if (reliable)
+	{
+		channel = &peer->channels[channel_idx];
+		uint16_t next_seq = channel->local_sequence + 1;
+		int16_t	 diff = (int16_t)(next_seq - channel->window_start);
+
+		if (diff < 0 || diff >= WINDOW_SIZE)
+		{
+			LOG("Window full on channel %u, dropping packet\n", channel_idx);
+			net->stats.sends_dropped++;
+			return;
+		}
+
+		header->flags = PACKET_FLAG_RELIABLE;
+		if (net->channel_modes[channel_idx] == DELIVERY_ORDERED)
+		{
+			header->flags |= PACKET_FLAG_ORDERED;
+		}
+		header->channel = channel_idx;
+		header->channel_sequence = ++channel->local_sequence;
+	}
+
+	stamp_header(peer, header, reliable ? channel_idx : NO_CHANNEL, header->channel_sequence);
+
+	udp_send(&net->socket, packet, total_size, &peer->address);
+	net->stats.packets_sent++;
+	net->stats.bytes_sent += total_size;
+
+	if (!reliable)
+	{
+		return;
+	}
+
+	uint8_t		   slot = MAP_SEQUENCE_TO_WINDOW_SLOT(header->channel_sequence);
+	PendingPacket *pending = &channel->window[slot];
+
+	pending->header = *header;
+	pending->buffer_idx = buffer_idx;
+	pending->size = total_size - sizeof(PacketHeader);
+	pending->send_time = net->current_time;
+	pending->next_retransmit_time = net->current_time + peer->round_trip_time * 1.1;
+	pending->retry_count = 0;
+	MARK_WINDOW_SLOT(channel->window_mask, slot);
+	net->buffer_refs[buffer_idx]++;
+}
+
+void
+network_send_packet(NetworkClient *net, uint32_t peer_id, void *packet, uint16_t total_size, bool reliable,
+					uint8_t channel)
+{
+	PeerState *peer = net->peers.get(peer_id);
+	if (!peer)
+	{
+		LOG("Invalid peer ID: %u\n", peer_id);
+		return;
+	}
+
+	uint8_t buffer_idx = 0;
+	if (reliable)
+	{
+		assert(channel < MAX_CHANNELS);
+		if (!acquire_payload_buffer(net, packet, total_size, &buffer_idx))
+		{
+			return;
+		}
+	}
+
+	send_to_peer(net, peer, packet, total_size, reliable, channel, buffer_idx);
+
+	if (reliable)
+	{
+		return_unused_payload_buffer(net, buffer_idx);
+	}
+}
+
+void
+network_broadcast_packet(NetworkClient *net, const uint32_t *peer_ids, uint32_t peer_count, void *packet,
+						 uint16_t total_size, bool reliable, uint8_t channel)
+{
+	uint8_t buffer_idx = 0;
+	if (reliable)
+	{
+		assert(channel < MAX_CHANNELS);
+		if (!acquire_payload_buffer(net, packet, total_size, &buffer_idx))
+		{
+			return;
+		}
+	}
+
+	for (uint32_t i = 0; i < peer_count; i++)
+	{
+		PeerState *peer = net->peers.get(peer_ids[i]);
+		if (!peer)
+		{
+			LOG("Invalid peer ID: %u\n", peer_ids[i]);
+			continue;
+		}
+		send_to_peer(net, peer, packet, total_size, reliable, channel, buffer_idx);
+	}
+
+	if (reliable)
+	{
+		return_unused_payload_buffer(net, buffer_idx);
+	}
+}
+
 bool
 network_poll(NetworkClient *net, Polled &polled)
 {
+	drain_receive_results(net);
+
 	while (1)
 	{
 		ReceivedPacketInfo info;
@@ -310,31 +693,22 @@ network_poll(NetworkClient *net, Polled &polled)
 		}
 
 		PacketBuffer &packet = net->packet_pool[info.buffer_index];
-		PacketHeader *header = (PacketHeader *)packet.data;
-		uint32_t	  peer_id = hash_sockaddr(info.from);
+		uint32_t	  peer_id = info.result.peer_id;
 		PeerState	 *peer = net->peers.get(peer_id);
 
 		if (!peer)
 		{
 			if (!net->on_unrecognised || !net->on_unrecognised(info.from))
 			{
+				/* Nobody wants it, stop the receive thread tracking it */
+				push_peer_command(net, PEER_COMMAND_REMOVE, peer_id);
 				net->free_indices.try_push(info.buffer_index);
 				continue;
 			}
 			peer = net->peers.get(peer_id);
 		}
 
-		peer->last_seen_time = net->current_time;
-
-		process_ack_bitmask(net, peer, header->ack, header->ack_bits);
-		advance_window_start(peer);
-
-		bool is_new = is_new_packet(header->sequence, peer);
-		if (!is_new)
-		{
-			net->free_indices.try_push(info.buffer_index);
-			continue;
-		}
+		apply_receive_result(net, peer, info.result);
 
 		polled.from = peer_id;
 		polled.buffer = packet.data + sizeof(PacketHeader);
@@ -348,6 +722,7 @@ void
 network_update(NetworkClient *net, float dt)
 {
 	net->current_time += dt;
+	drain_receive_results(net);
 
 	for (auto &&[id, peer] : net->peers)
 	{
@@ -361,6 +736,51 @@ network_update(NetworkClient *net, float dt)
 	}
 }
 
+static void
+release_held_packets(NetworkClient *net, ReceiveState *state)
+{
+	for (uint8_t i = 0; i < MAX_CHANNELS; i++)
+	{
+		ChannelReceiveState *channel = &state->channels[i];
+		while (HAS_PENDING_ACKS(channel->held_mask))
+		{
+			int slot = find_lowest_set_bit(channel->held_mask);
+			net->rx_spare.push(channel->held_buffer[slot]);
+			net->rx_held--;
+			CLEAR_WINDOW_SLOT(channel->held_mask, slot);
+		}
+	}
+}
+
+static void
+apply_peer_commands(NetworkClient *net)
+{
+	PeerCommand command;
+	while (net->peer_commands.try_pop(command))
+	{
+		if (command.type == PEER_COMMAND_REMOVE)
+		{
+			ReceiveState *state = net->rx_peers.get(command.peer_id);
+			if (state)
+			{
+				release_held_packets(net, state);
+				net->rx_peers.remove(command.peer_id);
+			}
+			continue;
+		}
+
+		ReceiveState *state = net->rx_peers.get(command.peer_id);
+		if (!state)
+		{
+			state = net->rx_peers.insert(command.peer_id, {});
+		}
+		if (state)
+		{
+			state->recognised = true;
+		}
+	}
+}
+
 void
 NetworkClient::receive_thread_func()
 {
@@ -370,13 +790,24 @@ NetworkClient::receive_thread_func()
 	 *
 	 * While the pool itself is not thread safe, we acquire specific indexes into it
 	 * with a thread safe queue.
+	 *
+	 * Everything that only depends on the packet is done here rather than on the owning thread:
+	 * header validation, working out which peer it's from, duplicate filtering, and, through
+	 * on_receive_thread, routing the payload to where it's consumed. The owner only gets the
+	 * packets it has to handle itself, plus the ack results of the rest.
 	 */
 	while (running)
 	{
+		apply_peer_commands(this);
+
 		uint8_t buffer_idx;
-		if (!free_indices.try_pop(buffer_idx))
+		if (!rx_spare.empty())
 		{
-			printf("No slots free, waiting \n");
+			buffer_idx = *rx_spare.pop_back();
+		}
+		else if (!free_indices.try_pop(buffer_idx))
+		{
+			LOG("No slots free, waiting \n");
 			sleep_microseconds(100);
 			continue;
 		}
@@ -384,22 +815,123 @@ NetworkClient::receive_thread_func()
 		sockaddr_in from;
 		int			bytes = udp_receive(&socket, packet_pool[buffer_idx].data, MAX_PACKET_SIZE, &from);
 
-		if (bytes >= (int)sizeof(PacketHeader))
+		if (bytes < (int)sizeof(PacketHeader))
+		{
+			rx_spare.push(buffer_idx);
+			udp_is_error(bytes);
+			continue;
+		}
+
+		/* Commands sent before this packet arrived, e.g. the peer that's replying being added */
+		apply_peer_commands(this);
+
+		PacketHeader *header = (PacketHeader *)packet_pool[buffer_idx].data;
+		uint32_t	  peer_id = hash_sockaddr(from);
+		ReceiveState *state = rx_peers.get(peer_id);
+		if (!state)
 		{
-			ReceivedPacketInfo info;
-			info.buffer_index = buffer_idx;
-			info.from = from;
-			info.size = bytes;
+			state = rx_peers.insert(peer_id, {});
+		}
+		bool reliable = header->flags & PACKET_FLAG_RELIABLE;
+		if (!state || header->type != 0 || (reliable && header->channel >= MAX_CHANNELS))
+		{
+			/* More strangers than we track, or not one of our packets */
+			rx_spare.push(buffer_idx);
+			continue;
+		}
+		state->address = from;
 
-			if (!recv_queue.try_push(info))
+		rx_packets.fetch_add(1, std::memory_order_relaxed);
+		rx_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+		ChannelReceiveState *channel = reliable ? &state->channels[header->channel] : nullptr;
+		bool				 ordered = header->flags & PACKET_FLAG_ORDERED;
+
+		if (channel && !channel_accepts(this, channel, header))
+		{
+			if (state->recognised)
 			{
-				free_indices.try_push(buffer_idx);
+				ack_queue.try_push({peer_id, header->ack, header->ack_bits, state->remote_sequence, state->remote_ack_bits});
 			}
+			rx_spare.push(buffer_idx);
+			continue;
 		}
-		else
+
+		bool		  is_new = is_new_sequence(header->sequence, &state->remote_sequence, &state->remote_ack_bits);
+		ReceiveResult result = {peer_id, header->ack, header->ack_bits, state->remote_sequence, state->remote_ack_bits};
+
+		uint8_t verdict = CHANNEL_DELIVER;
+		if (!is_new)
 		{
-			free_indices.try_push(buffer_idx);
-			udp_is_error(bytes);
+			verdict = CHANNEL_DUPLICATE;
+		}
+		else if (channel)
+		{
+			verdict = channel_receive(channel, header, buffer_idx, bytes);
+		}
+
+		if (verdict != CHANNEL_DELIVER)
+		{
+			/* The owner still needs the acks, a duplicate can carry newer ones */
+			if (state->recognised)
+			{
+				ack_queue.try_push(result);
+			}
+
+			if (verdict == CHANNEL_HELD)
+			{
+				rx_held++;
+				rx_held_total.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				rx_duplicates.fetch_add(1, std::memory_order_relaxed);
+				rx_spare.push(buffer_idx);
+			}
+			continue;
+		}
+
+		deliver(peer_id, state, buffer_idx, bytes, result);
+
+		/* The gap this one filled may free up the ones that came early */
+		while (ordered)
+		{
+			uint16_t next = channel->latest + 1;
+			uint8_t	 slot = MAP_SEQUENCE_TO_WINDOW_SLOT(next);
+			if (!IS_WINDOW_SLOT_IN_USE(channel->held_mask, slot))
+			{
+				break;
+			}
+			CLEAR_WINDOW_SLOT(channel->held_mask, slot);
+			channel->latest = next;
+			rx_held--;
+			deliver(peer_id, state, channel->held_buffer[slot], channel->held_size[slot], result);
 		}
 	}
 }
+
+void
+NetworkClient::deliver(uint32_t peer_id, ReceiveState *state, uint8_t buffer_idx, uint16_t bytes,
+					   const ReceiveResult &result)
+{
+	const uint8_t *payload = packet_pool[buffer_idx].data + sizeof(PacketHeader);
+	uint16_t	   payload_size = bytes - sizeof(PacketHeader);
+
+	if (state->recognised && on_receive_thread && on_receive_thread(peer_id, payload, payload_size))
+	{
+		ack_queue.try_push(result);
+		rx_spare.push(buffer_idx);
+		return;
+	}
+
+	ReceivedPacketInfo info;
+	info.buffer_index = buffer_idx;
+	info.from = state->address;
+	info.size = bytes;
+	info.result = result;
+
+	if (!recv_queue.try_push(info))
+	{
+		rx_spare.push(buffer_idx);
+	}
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "containers.hpp"
+#include "large_pages.hpp"
 #include "lock_free_queue.hpp"
 #include "udp_socket.hpp"
 #include <atomic>
@@ -8,9 +9,22 @@
 #include <thread>
 
 #define MAX_PACKET_SIZE	 1500
-#define MAX_PEERS		 16
+#define MAX_PEERS		 64 /* a relay's spectators are all peers of one client */
 #define PACKET_POOL_SIZE 256
 #define WINDOW_SIZE		 32
+#define MAX_CHANNELS	 4
+#define SENT_HISTORY	 256 /* power of 2, packet sequence -> what it carried, for acks */
+
+/*
+ * The pool is split in two so each half has one owner: [0, RECV_POOL_SIZE) cycles between the receive
+ * thread and the owner through free_indices, the rest holds reliable payloads awaiting an ack and
+ * is only ever touched by the owner
+ */
+#define RECV_POOL_SIZE	 (PACKET_POOL_SIZE / 2)
+#define SEND_POOL_SIZE	 (PACKET_POOL_SIZE - RECV_POOL_SIZE)
+
+#define PACKET_FLAG_RELIABLE 0x01
+#define PACKET_FLAG_ORDERED	 0x02
 
 #pragma pack(push, 1)
 struct PacketHeader
@@ -20,10 +34,29 @@ struct PacketHeader
 	uint16_t sequence;
 	uint32_t ack_bits;
 	uint16_t ack;
+	/* Reliable packets only, each channel numbers its own messages */
+	uint8_t	 channel;
+	uint16_t channel_sequence;
 };
 
 #pragma pack(pop)
 
+/*
+ * Reliable messages are sent on numbered channels, each with its own sequence numbers and window,
+ * so a lost message only ever holds up its own channel.
+ *
+ * Unordered: delivered as soon as they arrive, duplicates dropped
+ * Ordered:   delivered in the order they were sent, anything that arrives early waits
+ *            on the receive thread for the gap to be filled
+ *
+ * The mode is the sender's choice and travels in the header, the receiver follows it
+ */
+enum DeliveryMode : uint8_t
+{
+	DELIVERY_UNORDERED,
+	DELIVERY_ORDERED,
+};
+
 /*
  * Every packet needs a header
  */
@@ -39,22 +72,105 @@ struct PacketBuffer
 	uint8_t data[MAX_PACKET_SIZE];
 };
 
+/*
+ * What the receive thread learned from a packet's header, for the owning thread to apply:
+ * 'ack'/'ack_bits' acknowledge our reliable sends, 'remote_sequence'/'remote_ack_bits' are what we
+ * tell the peer we've received in our next header
+ */
+struct ReceiveResult
+{
+	uint32_t peer_id;
+	uint16_t ack;
+	uint32_t ack_bits;
+	uint16_t remote_sequence;
+	uint32_t remote_ack_bits;
+};
+
 struct ReceivedPacketInfo
 {
-	uint8_t		buffer_index;
-	sockaddr_in from;
-	uint16_t	size;
+	uint8_t		  buffer_index;
+	sockaddr_in	  from;
+	uint16_t	  size;
+	ReceiveResult result;
 };
 
+/*
+ * Unordered: 'latest' is the newest message received and 'received_bits' which of the 32 before it were
+ * Ordered:   'latest' is the last message delivered and 'held_mask' which of the next 32 arrived early,
+ *            their buffers waiting in 'held_buffer' by window slot
+ */
+struct ChannelReceiveState
+{
+	uint16_t latest;
+	uint32_t received_bits;
+	uint32_t held_mask;
+	uint8_t	 held_buffer[WINDOW_SIZE];
+	uint16_t held_size[WINDOW_SIZE];
+};
+
+/*
+ * Receive thread's view of a peer, duplicate filtering and ordering happen here
+ */
+struct ReceiveState
+{
+	sockaddr_in			address;
+	uint16_t			remote_sequence;
+	uint32_t			remote_ack_bits;
+	bool				recognised; /* added by the owner, packets from strangers go to on_unrecognised */
+	ChannelReceiveState channels[MAX_CHANNELS];
+};
+
+enum PeerCommandType : uint8_t
+{
+	PEER_COMMAND_ADD,
+	PEER_COMMAND_REMOVE,
+};
+
+/* Owner -> receive thread, keeps the receive thread's peer table in step with 'peers' */
+struct PeerCommand
+{
+	uint8_t	 type;
+	uint32_t peer_id;
+};
+
+/*
+ * A reliable message awaiting its ack. The header is per peer and kept here, the payload lives in a
+ * pool buffer that every peer the message was broadcast to shares
+ */
 struct PendingPacket
 {
-	uint8_t	 buffer_idx;
-	uint16_t size;
-	float	 send_time;
-	float	 next_retransmit_time;
-	uint8_t	 retry_count;
+	PacketHeader header;
+	uint8_t		 buffer_idx;
+	uint16_t	 size; /* payload only */
+	float		 send_time;
+	float		 next_retransmit_time;
+	uint8_t		 retry_count;
 };
 
+/*
+ * Send side of a channel, the window is indexed by channel sequence
+ */
+struct ChannelSendState
+{
+	uint16_t	  local_sequence;
+	uint16_t	  window_start;
+	uint32_t	  window_mask;
+	PendingPacket window[WINDOW_SIZE];
+};
+
+/*
+ * Acks come back by packet sequence, retransmits go out under a new one, so remember which
+ * channel message each packet carried
+ */
+struct SentPacket
+{
+	uint16_t sequence;
+	uint16_t channel_sequence;
+	uint8_t	 channel; /* NO_CHANNEL for unreliable packets */
+};
+
+#define NO_CHANNEL 0xFF
+
 struct Polled
 {
 	uint32_t from;
@@ -71,14 +187,30 @@ struct PeerState
 	uint16_t remote_sequence;
 	uint32_t remote_ack_bits;
 
-	uint16_t	  window_start;
-	uint32_t	  window_mask;
-	PendingPacket window[WINDOW_SIZE];
+	ChannelSendState channels[MAX_CHANNELS];
+	SentPacket		 sent[SENT_HISTORY];
 
 	float last_seen_time;
 	float round_trip_time;
 };
 
+/*
+ * Counters for everything the transport does, only touched by the thread that owns the client
+ * (sends, network_poll and network_update), so there is nothing to synchronise.
+ * Packets the receive thread reads but drops before network_poll are not counted.
+ */
+struct NetworkStats
+{
+	uint64_t packets_sent;
+	uint64_t bytes_sent;
+	uint64_t packets_received;
+	uint64_t bytes_received;
+	uint64_t retransmits;
+	uint64_t duplicates_received;
+	uint64_t sends_dropped; /* no free buffer or reliable window full */
+	uint64_t packets_held;	/* ordered messages that arrived early and waited for a gap */
+};
+
 struct NetworkClient
 {
 	UdpSocket		  socket;
@@ -86,20 +218,49 @@ struct NetworkClient
 	std::atomic<bool> running;
 	double			  current_time;
 
-	PacketBuffer										  packet_pool[PACKET_POOL_SIZE];
-	lock_free_queue<uint8_t, PACKET_POOL_SIZE>			  free_indices;
+	PacketBuffer										 *packet_pool; /* PACKET_POOL_SIZE, in packet_block */
+	LargeBlock											  packet_block;
+	lock_free_queue<uint8_t, PACKET_POOL_SIZE>			  free_indices; /* receive buffers, owner -> receive thread */
 	lock_free_queue<ReceivedPacketInfo, PACKET_POOL_SIZE> recv_queue;
 	fixed_map<uint32_t, PeerState, MAX_PEERS>			  peers;
+	fixed_array<uint8_t, SEND_POOL_SIZE>				  send_free;					/* owner only */
+	uint8_t												  buffer_refs[PACKET_POOL_SIZE]; /* window entries sharing a payload */
+	uint8_t												  channel_modes[MAX_CHANNELS];
+	NetworkStats										  stats;
+
+	/*
+	 * Receive thread state. Acks for packets the owner never sees (duplicates, routed packets)
+	 * come back through ack_queue
+	 */
+	fixed_map<uint32_t, ReceiveState, MAX_PEERS * 2>  rx_peers;
+	fixed_array<uint8_t, RECV_POOL_SIZE>			  rx_spare;
+	lock_free_queue<PeerCommand, 64>				  peer_commands;
+	lock_free_queue<ReceiveResult, PACKET_POOL_SIZE> ack_queue;
+	std::atomic<uint64_t>							  rx_packets;
+	std::atomic<uint64_t>							  rx_bytes;
+	std::atomic<uint64_t>							  rx_duplicates;
+	std::atomic<uint64_t>							  rx_held_total;
+	uint32_t										  rx_held; /* buffers waiting in ordered channels */
 
 	void (*on_peer_removed)(uint32_t peer_id);
 	bool (*on_unrecognised)(sockaddr_in address);
+	/*
+	 * Called on the receive thread for every new packet from a known peer, before it is queued for
+	 * network_poll. Returning true means the payload was consumed there (copied somewhere) and
+	 * network_poll never sees it. Passed to network_init since the receive thread reads it.
+	 */
+	bool (*on_receive_thread)(uint32_t peer_id, const uint8_t *payload, uint16_t size);
 
 	void
 	receive_thread_func();
+
+	void
+	deliver(uint32_t peer_id, ReceiveState *state, uint8_t buffer_idx, uint16_t bytes, const ReceiveResult &result);
 };
 
 bool
-network_init(NetworkClient *net, const char *bind_ip, uint16_t bind_port);
+network_init(NetworkClient *net, const char *bind_ip, uint16_t bind_port,
+			 bool (*on_receive_thread)(uint32_t peer_id, const uint8_t *payload, uint16_t size) = nullptr);
 
 void
 network_shutdown(NetworkClient *net);
@@ -113,6 +274,10 @@ network_add_peer(NetworkClient *net, sockaddr_in from);
 void
 network_remove_peer(NetworkClient *net, uint32_t peer_id);
 
+/* Applies to messages sent after the call, set it up before sending on the channel */
+void
+network_set_channel_mode(NetworkClient *net, uint8_t channel, DeliveryMode mode);
+
 bool
 network_poll(NetworkClient *net, Polled &polled);
 
@@ -133,69 +298,43 @@ network_release_buffer(NetworkClient *net, uint8_t buffer_idx)
 	net->free_indices.try_push(buffer_idx);
 }
 
+/*
+ * Sends a packet whose first sizeof(PacketHeader) bytes are left for the header, which is filled
+ * in here. The typed helpers below go through this; it is also usable directly for payloads
+ * whose size is only known at runtime.
+ */
+void
+network_send_packet(NetworkClient *net, uint32_t peer_id, void *packet, uint16_t total_size, bool reliable,
+					uint8_t channel = 0);
+
+/*
+ * Sends the same packet to every peer in 'peer_ids'. A reliable broadcast stores the payload once, in a
+ * buffer shared by all their windows, rather than a copy per peer.
+ */
+void
+network_broadcast_packet(NetworkClient *net, const uint32_t *peer_ids, uint32_t peer_count, void *packet,
+						 uint16_t total_size, bool reliable, uint8_t channel = 0);
+
+template <typename T>
+inline void
+network_broadcast_reliable(NetworkClient *net, const uint32_t *peer_ids, uint32_t peer_count, SendPacket<T> &packet,
+						   uint8_t channel = 0)
+{
+	network_broadcast_packet(net, peer_ids, peer_count, &packet, sizeof(SendPacket<T>), true, channel);
+}
+
 template <typename T>
-static void
-network_send(NetworkClient *net, uint32_t peer_id, SendPacket<T> &packet, bool reliable)
-{
-	PeerState *peer = net->peers.get(peer_id);
-	if (!peer)
-	{
-		printf("Invalid peer ID: %u\n", peer_id);
-		return;
-	}
-
-	uint8_t buffer_idx;
-	if (reliable)
-	{
-		if (!net->free_indices.try_pop(buffer_idx))
-		{
-			printf("No free buffers, dropping packet\n");
-			return;
-		}
-
-		uint16_t next_seq = peer->local_sequence + 1;
-		int16_t	 diff = (int16_t)(next_seq - peer->window_start);
-
-		if (diff < 0 || diff >= WINDOW_SIZE)
-		{
-			printf("Window full, dropping packet\n");
-			net->free_indices.try_push(buffer_idx);
-			return;
-		}
-	}
-
-	uint16_t seq = ++peer->local_sequence;
-	packet.header.type = 0;
-	packet.header.flags = reliable ? 0x01 : 0x00;
-	packet.header.sequence = seq;
-	packet.header.ack = peer->remote_sequence;
-	packet.header.ack_bits = peer->remote_ack_bits;
-
-	uint16_t total_size = sizeof(SendPacket<T>);
-	udp_send(&net->socket, &packet, total_size, &peer->address);
-
-	if (!reliable)
-	{
-		return;
-	}
-
-	uint8_t slot = seq & (WINDOW_SIZE - 1);
-	memcpy(net->packet_pool[buffer_idx].data, &packet, total_size);
-
-	peer->window[slot].buffer_idx = buffer_idx;
-	peer->window[slot].size = total_size;
-	peer->window[slot].send_time = net->current_time;
-
-	peer->window[slot].next_retransmit_time = net->current_time + peer->round_trip_time * 1.1;
-	peer->window[slot].retry_count = 0;
-	peer->window_mask |= (1u << slot);
+inline void
+network_send(NetworkClient *net, uint32_t peer_id, SendPacket<T> &packet, bool reliable, uint8_t channel = 0)
+{
+	network_send_packet(net, peer_id, &packet, sizeof(SendPacket<T>), reliable, channel);
 }
 
 template <typename T>
 inline void
-network_send_reliable(NetworkClient *net, uint32_t peer_id, SendPacket<T> &packet)
+network_send_reliable(NetworkClient *net, uint32_t peer_id, SendPacket<T> &packet, uint8_t channel = 0)
 {
-	network_send(net, peer_id, packet, true);
+	network_send(net, peer_id, packet, true, channel);
 }
 
 template <typename T>
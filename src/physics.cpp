@@ -21,13 +21,16 @@
 #define JUMP_VELOCITY		 14.0f
 #define DOUBLE_JUMP_VELOCITY 14.0f
 #define GROUND_SPEED		 25.0f
-#define GROUND_ACCEL		 35.0f
+#define GROUND_ACCEL		 52.53f /* 1/s, closes 7/12ths of the gap to the target velocity every 1/60s */
 
 #define WALLRUN_MIN_SPEED 15.0f
 #define WALLRUN_SPEED	  22.0f
 #define WALLRUN_GRAVITY	  0.0f
 #define WALLRUN_JUMP_OUT  15.0f
 #define WALLRUN_JUMP_UP	  10.0f
+#define WALLRUN_STEER	  120.0f /* units/s^2 of sideways push from the move keys */
+
+thread_local PhysicsCounters PHYSICS_COUNTERS;
 
 void
 apply_player_input(Player *player, InputMessage *input, float dt)
@@ -58,16 +61,22 @@ apply_player_input(Player *player, InputMessage *input, float dt)
 			player->velocity.z = current_dir.z * WALLRUN_SPEED;
 		}
 
-		player->velocity.x += move.x * 2.0f;
-		player->velocity.z += move.z * 2.0f;
+		player->velocity.x += move.x * WALLRUN_STEER * dt;
+		player->velocity.z += move.z * WALLRUN_STEER * dt;
 	}
 	else
 	{
+		/*
+		 * Closing a fixed fraction of the gap per tick (accel * dt) approaches the target faster at
+		 * higher tick rates, since the fraction compounds more often. As an exponential decay, the
+		 * gap left after a second is the same however it's divided into ticks
+		 */
 		glm::vec3 target_vel = move * GROUND_SPEED;
 		glm::vec3 vel_diff = target_vel - glm::vec3(player->velocity.x, 0, player->velocity.z);
+		float	  blend = 1.0f - expf(-GROUND_ACCEL * dt);
 
-		player->velocity.x += vel_diff.x * GROUND_ACCEL * dt;
-		player->velocity.z += vel_diff.z * GROUND_ACCEL * dt;
+		player->velocity.x += vel_diff.x * blend;
+		player->velocity.z += vel_diff.z * blend;
 	}
 
 	if ((input->buttons & INPUT_BUTTON_JUMP))
@@ -96,6 +105,25 @@ apply_player_input(Player *player, InputMessage *input, float dt)
 	}
 }
 
+float
+apply_held_input(Player *player, InputMessage *previous, InputMessage *input, Map &map, Player *all_players,
+				 uint32_t player_count, float dt)
+{
+	float held = subtick_to_fraction(input->press_fraction) * dt;
+	if (!previous || held <= 0.0f)
+	{
+		return dt;
+	}
+
+	/* Its jump already happened in its own tick, only the keys held down carry on */
+	InputMessage carried = *previous;
+	carried.buttons &= ~INPUT_BUTTON_JUMP;
+
+	apply_player_input(player, &carried, held);
+	apply_player_physics(player, map, all_players, player_count, held);
+	return dt - held;
+}
+
 static bool
 is_wall_surface(glm::vec3 normal)
 {
@@ -104,8 +132,15 @@ is_wall_surface(glm::vec3 normal)
 
 
 void
-apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS> &all_players, float dt)
+apply_player_physics(Player *player, Map &map, Player *all_players, uint32_t player_count, float dt)
 {
+	/*
+	 * Moving a whole tick at the velocity from after gravity drops half of g * dt^2 further than
+	 * the real fall each tick, so jumps would come out higher at higher tick rates. Adding that half
+	 * back makes a jump the same parabola at any rate
+	 */
+	float gravity_drop = 0.0f;
+
 	if (player->position.y <= PLAYER_RADIUS)
 	{
 		player->position.y = PLAYER_RADIUS;
@@ -117,6 +152,12 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 		{
 			player->velocity.y = 0;
 		}
+		else if (player->velocity.y > 0)
+		{
+			/* Jumped this tick, falling starts now like it does off a box, not a tick later */
+			player->velocity.y -= GRAVITY * dt;
+			gravity_drop = 0.5f * GRAVITY * dt * dt;
+		}
 	}
 	else
 	{
@@ -129,6 +170,7 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 		{
 			player->on_ground = false;
 			player->velocity.y -= GRAVITY * dt;
+			gravity_drop = 0.5f * GRAVITY * dt * dt;
 		}
 	}
 
@@ -148,6 +190,7 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 		Sphere	current_sphere = {player->position, expanded_radius};
 		OBB	   &box = *obstacles.get(player->wall_index);
 		Contact contact;
+		PHYSICS_COUNTERS.sphere_vs_obb++;
 		if (!sphere_vs_obb(current_sphere, box, &contact))
 		{
 			player->wall_running = false;
@@ -155,6 +198,7 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 	}
 
 	glm::vec3 movement = player->velocity * dt;
+	movement.y += gravity_drop;
 	glm::vec3 new_position = player->position;
 
 	glm::vec3 axes[3] = {{movement.x, 0, 0}, {0, 0, movement.z}, {0, movement.y, 0}};
@@ -169,6 +213,7 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 
 		Contact collision_contact = {};
 		int32_t index = -1;
+		PHYSICS_COUNTERS.sphere_vs_obb += obstacles.size();
 		for (OBB &box : obstacles)
 		{
 			index++;
@@ -251,6 +296,7 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 					Contact contact;
 					for (OBB &box : obstacles)
 					{
+						PHYSICS_COUNTERS.sphere_vs_obb++;
 						if (sphere_vs_obb(slope_test_sphere, box, &contact))
 						{
 							slope_blocked = true;
@@ -283,9 +329,10 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 
 	Sphere s1 = {player->position, PLAYER_RADIUS};
 
-	for (Player &other : all_players)
+	for (uint32_t i = 0; i < player_count; i++)
 	{
-		if (other.player_idx == player->player_idx)
+		Player &other = all_players[i];
+		if (&other == player || (player->player_idx >= 0 && other.player_idx == player->player_idx))
 		{
 			continue;
 		}
@@ -293,8 +340,10 @@ apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS>
 		Sphere	s2 = {other.position, PLAYER_RADIUS};
 		Contact contact;
 
+		PHYSICS_COUNTERS.sphere_vs_sphere++;
 		if (sphere_vs_sphere(s1, s2, &contact))
 		{
+			PHYSICS_COUNTERS.player_contacts++;
 			player->position -= contact.normal * contact.depth;
 		}
 	}
@@ -5,8 +5,18 @@
 #include "map.hpp"
 #include <glm/glm.hpp>
 
+/*
+ * How much collision work the physics did, for benchmarks and profiling. Per thread since the
+ * NPC threads each run their own prediction.
+ */
+struct PhysicsCounters
+{
+	uint64_t sphere_vs_obb;
+	uint64_t sphere_vs_sphere;
+	uint64_t player_contacts;
+};
 
-
+extern thread_local PhysicsCounters PHYSICS_COUNTERS;
 
 void
 apply_player_input(Player *player, InputMessage *input, float dt);
@@ -14,5 +24,32 @@ apply_player_input(Player *player, InputMessage *input, float dt);
 bool
 check_collision_at(glm::vec3 position, fixed_array<OBB, MAX_OBSTACLES> &obstacles);
 
+/*
+ * 'player' is skipped when it appears in 'all_players', matched by address, or by player_idx when
+ * it's a copy (client prediction runs on a copy of the local player)
+ */
 void
-apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS> &all_players, float dt);
+apply_player_physics(Player *player, Map &map, Player *all_players, uint32_t player_count, float dt);
+
+inline void
+apply_player_physics(Player *player, Map &map, fixed_array<Player, MAX_PLAYERS> &all_players, float dt)
+{
+	apply_player_physics(player, map, all_players.data, all_players.size(), dt);
+}
+
+/*
+ * A key can go down anywhere inside a tick, 'input->press_fraction' says where. Up to then the player
+ * carries on under 'previous', so a jump leaves the ground when the key went down rather than at the
+ * tick boundary. Returns what's left of dt, to apply 'input' for. Client prediction and the server
+ * have to split the same way or every press is a misprediction
+ */
+float
+apply_held_input(Player *player, InputMessage *previous, InputMessage *input, Map &map, Player *all_players,
+				 uint32_t player_count, float dt);
+
+inline float
+apply_held_input(Player *player, InputMessage *previous, InputMessage *input, Map &map,
+				 fixed_array<Player, MAX_PLAYERS> &all_players, float dt)
+{
+	return apply_held_input(player, previous, input, map, all_players.data, all_players.size(), dt);
+}
@@ -1,4 +1,5 @@
 #include "profiler.hpp"
+#include "log.hpp"
 #include <cstdio>
 #include <cstring>
 
@@ -24,9 +25,9 @@ profiler_print_report(Profiler *p)
 		return;
 	}
 
-	printf("\n========== PROFILER REPORT (Frame %u) ==========\n", p->frame_count);
-	printf("%-30s %8s %8s %8s %8s\n", "Zone", "Avg", "Min", "Max", "Var");
-	printf("----------------------------------------------------------------\n");
+	LOG("\n========== PROFILER REPORT (Frame %u) ==========\n", p->frame_count);
+	LOG("%-30s %8s %8s %8s %8s\n", "Zone", "Avg", "Min", "Max", "Var");
+	LOG("----------------------------------------------------------------\n");
 
 	for (uint32_t i = 0; i < p->zones.table_capacity(); i++)
 	{
@@ -36,11 +37,11 @@ profiler_print_report(Profiler *p)
 			continue;
 		}
 
-		printf("%-30s %7.2fms %7.2fms %7.2fms %7.2fms\n", entry.value.name.c_str(), entry.value.avg_time_ms,
-			   entry.value.min_time_ms, entry.value.max_time_ms, entry.value.variance_ms);
+		LOG("%-30s %7.2fms %7.2fms %7.2fms %7.2fms\n", entry.value.name.c_str(), entry.value.avg_time_ms,
+			entry.value.min_time_ms, entry.value.max_time_ms, entry.value.variance_ms);
 	}
 
-	printf("================================================\n\n");
+	LOG("================================================\n\n");
 }
 
 void
@@ -0,0 +1,436 @@
+/*
+ * Spectator relay
+ *
+ * Spectators on the game server would each take a peer, a snapshot send per tick and a share of every
+ * reliable broadcast. Instead the server sends one stream to a relay: every snapshot with nothing
+ * culled, plus the kill and leave events. The relay keeps the last few minutes of it and fans it out,
+ * so the server's work doesn't grow with spectators. The relay's spectators are peers of its one
+ * NetworkClient, so a relay serves at most MAX_PEERS - 1 of them (the server is the other), 63. More
+ * than that means more relays, each on its own port.
+ *
+ * Tournaments want spectators behind live so they can't call out positions, so spectators pick a
+ * delay bucket when they connect. Each bucket walks through the same history, sending a frame once
+ * its tick is 'delay' behind the newest, as one broadcast to everyone in the bucket. However many
+ * spectators there are, each frame is prepared once per bucket, not once per spectator.
+ *
+ * Events are stamped with the tick after the newest snapshot when they arrived, and go out just before
+ * that frame does, which is the order live clients see them in.
+ *
+ * Spectators use the same transport as players, so the events are reliable and the frames aren't.
+ */
+#include "relay.hpp"
+#include "containers.hpp"
+#include "game_types.hpp"
+#include "log.hpp"
+#include "network_client.hpp"
+#include "time.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define RELAY_HISTORY_SIZE		4096 /* power of 2, ~3 minutes of snapshots at 20 a second */
+#define RELAY_EVENT_HISTORY		256	 /* power of 2 */
+#define RELAY_MAX_DELAY			180.0f
+#define RELAY_MAX_EVENT_SIZE	16
+#define RELAY_UPDATE_SECONDS	0.1f /* retransmits and timeouts, same cadence as the server */
+#define RELAY_KEEPALIVE_SECONDS 0.5f
+#define RELAY_CONNECT_TIMEOUT	5.0f
+#define RELAY_REPORT_SECONDS	5.0f
+
+/*
+ * A snapshot as the server sent it, with room in front for the header so it's sent from where it sits
+ */
+struct RelayFrame
+{
+	Tick	 tick;
+	uint16_t size; /* payload */
+	uint8_t	 packet[sizeof(PacketHeader) + SNAPSHOT_BUDGET];
+};
+
+struct RelayEvent
+{
+	Tick	tick; /* the frame it goes out before */
+	uint8_t channel;
+	uint8_t size;
+	uint8_t packet[sizeof(PacketHeader) + RELAY_MAX_EVENT_SIZE];
+};
+
+struct DelayBucket
+{
+	float	 delay_seconds;
+	Tick	 delay_ticks; /* in the server's ticks, known once it accepts us */
+	Tick	 play_tick;	 /* tick of the last frame sent, where someone joining now starts */
+	uint32_t next_frame; /* sequence into frames */
+	uint32_t next_event;
+
+	fixed_array<uint32_t, MAX_PEERS> spectators;
+};
+
+static struct
+{
+	NetworkClient net;
+	uint32_t	  server_peer;
+	bool		  connected; /* the server accepted us */
+	uint16_t	  tick_rate; /* the server's, passed on to spectators */
+	bool		  running;
+
+	/*
+	 * Frames and events are numbered as they arrive, each bucket reads them at its own delay
+	 */
+	keyed_ring<RelayFrame, RELAY_HISTORY_SIZE>	frames;
+	uint32_t									frame_count;
+	Tick										latest_tick;
+	keyed_ring<RelayEvent, RELAY_EVENT_HISTORY> events;
+	uint32_t									event_count;
+
+	fixed_array<DelayBucket, MAX_DELAY_BUCKETS> buckets;
+
+	uint64_t frames_in;
+	uint64_t frames_out; /* one per bucket per frame, however many spectators it went to */
+} RELAY = {};
+
+static void
+store_frame(const uint8_t *payload, uint16_t size)
+{
+	SnapshotMessage *snap = (SnapshotMessage *)payload;
+	if (size < sizeof(SnapshotMessage) || size > SNAPSHOT_BUDGET ||
+		size < snapshot_size(snap->player_count, snap->shot_count))
+	{
+		return;
+	}
+
+	/* Unreliable, so late ones happen, the buckets have moved past them */
+	if (RELAY.frame_count && snap->server_tick <= RELAY.latest_tick)
+	{
+		return;
+	}
+
+	if (RELAY.frame_count == 0)
+	{
+		for (DelayBucket &bucket : RELAY.buckets)
+		{
+			bucket.play_tick = snap->server_tick;
+		}
+	}
+
+	RelayFrame *frame = RELAY.frames.put(RELAY.frame_count++);
+	frame->tick = snap->server_tick;
+	frame->size = size;
+	memcpy(frame->packet + sizeof(PacketHeader), payload, size);
+
+	RELAY.latest_tick = snap->server_tick;
+	RELAY.frames_in++;
+}
+
+static void
+store_event(const uint8_t *payload, uint16_t size, uint8_t channel)
+{
+	if (size > RELAY_MAX_EVENT_SIZE)
+	{
+		return;
+	}
+
+	RelayEvent *event = RELAY.events.put(RELAY.event_count++);
+	event->tick = RELAY.latest_tick + 1;
+	event->channel = channel;
+	event->size = size;
+	memcpy(event->packet + sizeof(PacketHeader), payload, size);
+}
+
+static void
+handle_server_message(const uint8_t *payload, uint16_t size)
+{
+	switch (payload[0])
+	{
+	case MSG_CONNECT_ACCEPT:
+	{
+		ConnectAccept *accept = (ConnectAccept *)payload;
+		RELAY.connected = true;
+		RELAY.tick_rate = accept->tick_rate ? accept->tick_rate : DEFAULT_TICK_RATE;
+		for (DelayBucket &bucket : RELAY.buckets)
+		{
+			bucket.delay_ticks = seconds_to_ticks(bucket.delay_seconds, RELAY.tick_rate);
+		}
+		LOG("Relay connected to server, %u ticks a second\n", RELAY.tick_rate);
+		break;
+	}
+	case MSG_SERVER_SNAPSHOT:
+		store_frame(payload, size);
+		break;
+	case MSG_PLAYER_DIED:
+		store_event(payload, size, CHANNEL_EVENTS);
+		break;
+	case MSG_PLAYER_LEFT:
+		store_event(payload, size, CHANNEL_CONTROL);
+		break;
+	default:
+		break;
+	}
+}
+
+static DelayBucket *
+find_bucket_for_peer(uint32_t peer_id, uint32_t *index)
+{
+	for (DelayBucket &bucket : RELAY.buckets)
+	{
+		for (uint32_t i = 0; i < bucket.spectators.size(); i++)
+		{
+			if (bucket.spectators[i] == peer_id)
+			{
+				*index = i;
+				return &bucket;
+			}
+		}
+	}
+	return nullptr;
+}
+
+static void
+add_spectator(uint32_t peer_id, SpectateRequest *req)
+{
+	uint32_t index;
+	if (find_bucket_for_peer(peer_id, &index))
+	{
+		return;
+	}
+
+	if (!RELAY.connected || RELAY.frame_count == 0)
+	{
+		LOG("Spectator %u turned away, no stream from the server yet\n", peer_id);
+		return;
+	}
+
+	uint8_t		 bucket_idx = req->delay_bucket < RELAY.buckets.size() ? req->delay_bucket : 0;
+	DelayBucket *bucket = &RELAY.buckets[bucket_idx];
+	bucket->spectators.push(peer_id);
+
+	LOG("Spectator %u joined, %.0fs behind live\n", peer_id, bucket->delay_seconds);
+
+	SendPacket<ConnectAccept> msg = {};
+	msg.payload = make_connect_accept(peer_id, bucket->play_tick, -1, RELAY.tick_rate);
+	network_send_reliable(&RELAY.net, peer_id, msg, CHANNEL_CONTROL);
+}
+
+static void
+handle_spectator_message(uint32_t peer_id, const uint8_t *payload, uint16_t size)
+{
+	if (payload[0] == MSG_SPECTATE_REQUEST && size >= sizeof(SpectateRequest))
+	{
+		add_spectator(peer_id, (SpectateRequest *)payload);
+	}
+	/* Keepalives only need to arrive, and nothing else is expected from a spectator */
+}
+
+static void
+on_peer_removed(uint32_t peer_id)
+{
+	if (peer_id == RELAY.server_peer)
+	{
+		LOG("Lost the server\n");
+		RELAY.running = false;
+		return;
+	}
+
+	uint32_t	 index;
+	DelayBucket *bucket = find_bucket_for_peer(peer_id, &index);
+	if (bucket)
+	{
+		bucket->spectators.erase_swap(index);
+		LOG("Spectator %u left\n", peer_id);
+	}
+}
+
+static bool
+on_unrecognised(sockaddr_in address)
+{
+	return network_add_peer(&RELAY.net, address) != 0;
+}
+
+static void
+send_events_until(DelayBucket *bucket, Tick tick)
+{
+	if (RELAY.event_count - bucket->next_event > RELAY_EVENT_HISTORY)
+	{
+		bucket->next_event = RELAY.event_count - RELAY_EVENT_HISTORY;
+	}
+
+	while (bucket->next_event != RELAY.event_count)
+	{
+		RelayEvent *event = RELAY.events.get(bucket->next_event);
+		if (event && event->tick > tick)
+		{
+			return;
+		}
+
+		bucket->next_event++;
+		if (event && !bucket->spectators.empty())
+		{
+			network_broadcast_packet(&RELAY.net, bucket->spectators.data, bucket->spectators.size(), event->packet,
+									 sizeof(PacketHeader) + event->size, true, event->channel);
+		}
+	}
+}
+
+/*
+ * Everything that has been in the history for at least the bucket's delay, in the order it arrived.
+ * Buckets with nobody in them still move along, so joining one starts at its delay rather than
+ * wherever it was left
+ */
+static void
+fan_out(DelayBucket *bucket)
+{
+	/* Joined as the history wrapped, or the delay is longer than it holds */
+	if (RELAY.frame_count - bucket->next_frame > RELAY_HISTORY_SIZE)
+	{
+		bucket->next_frame = RELAY.frame_count - RELAY_HISTORY_SIZE;
+	}
+
+	while (bucket->next_frame != RELAY.frame_count)
+	{
+		RelayFrame *frame = RELAY.frames.get(bucket->next_frame);
+		if (frame->tick + bucket->delay_ticks > RELAY.latest_tick)
+		{
+			return;
+		}
+
+		send_events_until(bucket, frame->tick);
+
+		bucket->next_frame++;
+		bucket->play_tick = frame->tick;
+		if (!bucket->spectators.empty())
+		{
+			network_broadcast_packet(&RELAY.net, bucket->spectators.data, bucket->spectators.size(), frame->packet,
+									 sizeof(PacketHeader) + frame->size, false);
+			RELAY.frames_out++;
+		}
+	}
+}
+
+static void
+send_keepalives()
+{
+	SendPacket<Keepalive> keepalive = {};
+	keepalive.payload.type = MSG_KEEPALIVE;
+	network_send_unreliable(&RELAY.net, RELAY.server_peer, keepalive);
+
+	/* A delayed bucket has nothing to send for its first 'delay' seconds, its spectators still need to hear from us */
+	for (DelayBucket &bucket : RELAY.buckets)
+	{
+		network_broadcast_packet(&RELAY.net, bucket.spectators.data, bucket.spectators.size(), &keepalive,
+								 sizeof(keepalive), false);
+	}
+}
+
+static void
+print_report(float seconds)
+{
+	LOG("Relay: %.0f frames/s in, %.0f bucket sends/s, %.1f KB/s out, spectators:", RELAY.frames_in / seconds,
+		RELAY.frames_out / seconds, RELAY.net.stats.bytes_sent / 1024.0 / seconds);
+	for (DelayBucket &bucket : RELAY.buckets)
+	{
+		LOG(" %u (%.0fs)", bucket.spectators.size(), bucket.delay_seconds);
+	}
+	LOG("\n");
+
+	RELAY.frames_in = 0;
+	RELAY.frames_out = 0;
+	RELAY.net.stats = {};
+}
+
+void
+run_relay(const char *server_ip, uint16_t server_port, uint16_t relay_port, const float *delays, uint32_t delay_count)
+{
+	for (uint32_t i = 0; i < delay_count && i < MAX_DELAY_BUCKETS; i++)
+	{
+		DelayBucket bucket = {};
+		bucket.delay_seconds = delays[i] < 0.0f ? 0.0f : delays[i] > RELAY_MAX_DELAY ? RELAY_MAX_DELAY : delays[i];
+		RELAY.buckets.push(bucket);
+	}
+	if (RELAY.buckets.empty())
+	{
+		RELAY.buckets.push({});
+	}
+
+	if (!network_init(&RELAY.net, "0.0.0.0", relay_port))
+	{
+		printf("Failed to initialize relay on port %u\n", relay_port);
+		return;
+	}
+
+	network_set_channel_mode(&RELAY.net, CHANNEL_CONTROL, DELIVERY_ORDERED);
+	RELAY.net.on_peer_removed = on_peer_removed;
+	RELAY.net.on_unrecognised = on_unrecognised;
+
+	RELAY.server_peer = network_add_peer(&RELAY.net, server_ip, server_port);
+	SendPacket<RelayConnect> req = {};
+	req.payload.type = MSG_RELAY_CONNECT;
+	network_send_reliable(&RELAY.net, RELAY.server_peer, req, CHANNEL_CONTROL);
+
+	printf("Relay on port %u, connecting to %s:%u\n", relay_port, server_ip, server_port);
+
+	TimePoint start = time_now();
+	TimePoint last_update = start;
+	TimePoint last_keepalive = start;
+	TimePoint last_report = start;
+
+	RELAY.running = true;
+	while (RELAY.running)
+	{
+		float since_update = time_elapsed_seconds(last_update);
+		if (since_update >= RELAY_UPDATE_SECONDS)
+		{
+			network_update(&RELAY.net, since_update);
+			last_update = time_now();
+		}
+
+		Polled	 polled;
+		uint32_t processed = 0;
+		while (network_poll(&RELAY.net, polled))
+		{
+			processed++;
+			if (polled.size >= 1)
+			{
+				if (polled.from == RELAY.server_peer)
+				{
+					handle_server_message(polled.buffer, polled.size);
+				}
+				else
+				{
+					handle_spectator_message(polled.from, polled.buffer, polled.size);
+				}
+			}
+			network_release_buffer(&RELAY.net, polled.buffer_index);
+		}
+
+		if (!RELAY.connected && time_elapsed_seconds(start) > RELAY_CONNECT_TIMEOUT)
+		{
+			printf("Server didn't accept the relay\n");
+			break;
+		}
+
+		for (DelayBucket &bucket : RELAY.buckets)
+		{
+			fan_out(&bucket);
+		}
+
+		if (time_elapsed_seconds(last_keepalive) >= RELAY_KEEPALIVE_SECONDS)
+		{
+			send_keepalives();
+			last_keepalive = time_now();
+		}
+
+		float since_report = time_elapsed_seconds(last_report);
+		if (since_report >= RELAY_REPORT_SECONDS)
+		{
+			print_report(since_report);
+			last_report = time_now();
+		}
+
+		if (processed == 0)
+		{
+			sleep_milliseconds(1);
+		}
+	}
+
+	network_shutdown(&RELAY.net);
+}
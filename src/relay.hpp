@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+
+#define MAX_DELAY_BUCKETS 4
+
+/*
+ * Connects to the server at server_ip:server_port and serves spectators on relay_port, one bucket per
+ * delay. A matchmaker's matches are on their own ports, a relay each
+ */
+void
+run_relay(const char *server_ip, uint16_t server_port, uint16_t relay_port, const float *delays, uint32_t delay_count);
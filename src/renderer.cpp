@@ -12,6 +12,7 @@
 #include "renderer.hpp"
 #include "../lib/glad.h"
 #include <GLFW/glfw3.h>
+#include "font_atlas.hpp"
 #include "time.hpp"
 #include <cstdint>
 #include <math.h>
@@ -19,8 +20,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#ifdef COD_FREETYPE
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#endif
 
 const char *space_vertex_shader = R"(
 #version 330 core
@@ -236,10 +244,216 @@ compile_shader_stage(const char *source, GLenum type)
 	return shader;
 }
 
+/*
+ * Shader program binary cache
+ *
+ * Compiling and linking the shaders from source is most of what renderer_init costs, on software
+ * drivers especially. Once linked, a program's binary is saved to SHADER_CACHE_DIR, named by a hash of
+ * its sources and of the driver's vendor, renderer and version strings, so a source change or a driver
+ * update looks for a different file and compiles from source again. The driver can still refuse a
+ * binary it wrote (its own internal checks), and then it's compiled from source and the file replaced.
+ */
+#define SHADER_CACHE_DIR		 "shader_cache"
+#define SHADER_CACHE_MAX_BINARY (16u << 20) /* anything bigger is a corrupt file */
+
+static const char SHADER_CACHE_MAGIC[4] = {'C', 'O', 'D', 'S'};
+
+struct ShaderCacheHeader
+{
+	char	 magic[4];
+	uint32_t format; /* the driver's, glProgramBinary needs it back */
+	uint64_t key;
+	uint32_t length;
+	uint32_t reserved;
+};
+
+static struct
+{
+	int		 supported; /* 0 = not checked yet, 1 = yes, -1 = no */
+	uint32_t loaded;
+	uint32_t compiled;
+	float	 seconds;
+} SHADER_CACHE;
+
+static uint64_t
+hash64(const void *data, size_t len, uint64_t h)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= bytes[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static uint64_t
+hash64_string(const char *s, uint64_t h)
+{
+	/* The terminator too, so "ab" + "c" and "a" + "bc" differ */
+	return s ? hash64(s, strlen(s) + 1, h) : hash64("", 1, h);
+}
+
+static bool
+shader_cache_supported()
+{
+	if (!SHADER_CACHE.supported)
+	{
+		int formats = 0;
+		if (glGetProgramBinary && glProgramBinary && glProgramParameteri)
+		{
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		SHADER_CACHE.supported = formats > 0 ? 1 : -1;
+	}
+	return SHADER_CACHE.supported > 0;
+}
+
+static uint64_t
+shader_cache_key(const char *vertex_src, const char *fragment_src)
+{
+	uint64_t h = 14695981039346656037ull;
+	h = hash64_string((const char *)glGetString(GL_VENDOR), h);
+	h = hash64_string((const char *)glGetString(GL_RENDERER), h);
+	h = hash64_string((const char *)glGetString(GL_VERSION), h);
+	h = hash64_string(vertex_src, h);
+	return hash64_string(fragment_src, h);
+}
+
+static void
+shader_cache_path(uint64_t key, char *path, size_t size)
+{
+	snprintf(path, size, SHADER_CACHE_DIR "/%016llx.bin", (unsigned long long)key);
+}
+
+/* The linked program, or 0 when there's no usable binary for 'key' */
+static uint32_t
+shader_cache_load(uint64_t key)
+{
+	char path[64];
+	shader_cache_path(key, path, sizeof(path));
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		return 0;
+	}
+
+	/* The length comes from disk, it has to fit in what's left of the file before anything is allocated for it */
+	long file_size = -1;
+	if (fseek(file, 0, SEEK_END) == 0)
+	{
+		file_size = ftell(file);
+	}
+	rewind(file);
+
+	ShaderCacheHeader	 header;
+	std::vector<uint8_t> binary;
+	bool ok = file_size >= (long)sizeof(header) && fread(&header, sizeof(header), 1, file) == 1 &&
+			  memcmp(header.magic, SHADER_CACHE_MAGIC, 4) == 0 && header.key == key && header.length > 0 &&
+			  header.length <= SHADER_CACHE_MAX_BINARY && header.length <= (uint64_t)file_size - sizeof(header);
+	if (ok)
+	{
+		binary.resize(header.length);
+		ok = fread(binary.data(), 1, header.length, file) == header.length;
+	}
+	fclose(file);
+	if (!ok)
+	{
+		return 0;
+	}
+
+	uint32_t program = glCreateProgram();
+	glProgramBinary(program, header.format, binary.data(), header.length);
+
+	int success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static void
+shader_cache_store(uint32_t program, uint64_t key)
+{
+	int length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+	{
+		return;
+	}
+
+	ShaderCacheHeader	 header = {};
+	std::vector<uint8_t> binary(length);
+	GLenum				 format;
+	glGetProgramBinary(program, length, nullptr, &format, binary.data());
+	memcpy(header.magic, SHADER_CACHE_MAGIC, 4);
+	header.format = format;
+	header.key = key;
+	header.length = length;
+
+#ifdef _WIN32
+	_mkdir(SHADER_CACHE_DIR);
+#else
+	mkdir(SHADER_CACHE_DIR, 0755);
+#endif
+
+	/* Written aside and renamed over, so a client starting alongside never reads half a binary */
+	char path[64];
+	char temp_path[72];
+	shader_cache_path(key, path, sizeof(path));
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+	FILE *file = fopen(temp_path, "wb");
+	if (!file)
+	{
+		return;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, length, file) == (size_t)length;
+	ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (!ok || rename(temp_path, path) != 0)
+	{
+		remove(temp_path);
+	}
+}
+
+static void
+shader_find_uniforms(ShaderProgram *shader)
+{
+	shader->u_mvp = glGetUniformLocation(shader->id, "mvp");
+	shader->u_model = glGetUniformLocation(shader->id, "model");
+	shader->u_view = glGetUniformLocation(shader->id, "view");
+	shader->u_projection = glGetUniformLocation(shader->id, "projection");
+	shader->u_color = glGetUniformLocation(shader->id, "objectColor");
+	shader->u_light_pos = glGetUniformLocation(shader->id, "lightPos");
+	shader->u_light_color = glGetUniformLocation(shader->id, "lightColor");
+	shader->u_view_pos = glGetUniformLocation(shader->id, "viewPos");
+}
+
 ShaderProgram
 shader_create(const char *vertex_src, const char *fragment_src)
 {
 	ShaderProgram shader = {};
+	TimePoint	  start = time_now();
+
+	uint64_t key = 0;
+	if (shader_cache_supported())
+	{
+		key = shader_cache_key(vertex_src, fragment_src);
+		shader.id = shader_cache_load(key);
+		if (shader.id)
+		{
+			shader_find_uniforms(&shader);
+			SHADER_CACHE.loaded++;
+			SHADER_CACHE.seconds += time_elapsed_seconds(start);
+			return shader;
+		}
+	}
 
 	uint32_t vertex = compile_shader_stage(vertex_src, GL_VERTEX_SHADER);
 	uint32_t fragment = compile_shader_stage(fragment_src, GL_FRAGMENT_SHADER);
@@ -260,6 +474,10 @@ shader_create(const char *vertex_src, const char *fragment_src)
 	shader.id = glCreateProgram();
 	glAttachShader(shader.id, vertex);
 	glAttachShader(shader.id, fragment);
+	if (key)
+	{
+		glProgramParameteri(shader.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 	glLinkProgram(shader.id);
 
 	int success;
@@ -272,18 +490,17 @@ shader_create(const char *vertex_src, const char *fragment_src)
 		glDeleteProgram(shader.id);
 		shader.id = 0;
 	}
+	else if (key)
+	{
+		shader_cache_store(shader.id, key);
+	}
 
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
 
-	shader.u_mvp = glGetUniformLocation(shader.id, "mvp");
-	shader.u_model = glGetUniformLocation(shader.id, "model");
-	shader.u_view = glGetUniformLocation(shader.id, "view");
-	shader.u_projection = glGetUniformLocation(shader.id, "projection");
-	shader.u_color = glGetUniformLocation(shader.id, "objectColor");
-	shader.u_light_pos = glGetUniformLocation(shader.id, "lightPos");
-	shader.u_light_color = glGetUniformLocation(shader.id, "lightColor");
-	shader.u_view_pos = glGetUniformLocation(shader.id, "viewPos");
+	shader_find_uniforms(&shader);
+	SHADER_CACHE.compiled++;
+	SHADER_CACHE.seconds += time_elapsed_seconds(start);
 
 	return shader;
 }
@@ -626,7 +843,10 @@ renderer_init(Renderer *r, struct GLFWwindow *window)
 
 	renderer_set_light(r, glm::vec3(10.0f, 10.0f, 10.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f);
 
-	text_renderer_init(r, "../Antonio-Bold.ttf");
+	text_renderer_init(r, "../Antonio-Bold.atlas", "../Antonio-Bold.ttf");
+
+	printf("Shaders ready in %.1fms, %u from the cache, %u compiled%s\n", SHADER_CACHE.seconds * 1000.0f,
+		   SHADER_CACHE.loaded, SHADER_CACHE.compiled, shader_cache_supported() ? "" : " (no program binaries)");
 	return true;
 }
 
@@ -756,20 +976,54 @@ renderer_update_matrices(Renderer *r)
 									  r->camera.near_plane, r->camera.far_plane);
 }
 
-void
-text_renderer_init(Renderer *r, const char *font_path)
+/*
+ * One texture for every glyph, uploaded straight from the mapped atlas
+ */
+static bool
+load_font_atlas(Renderer *r, const char *atlas_path)
 {
-	r->text_shader = shader_create(text_vertex_shader, text_fragment_shader);
-	if (!r->text_shader.id)
+	FontAtlas atlas;
+	if (!font_atlas_open(&atlas, atlas_path))
 	{
-		printf("Failed to create text shader\n");
-		return;
+		return false;
 	}
 
-	glm::mat4 projection = glm::ortho(0.0f, (float)r->width, 0.0f, (float)r->height);
-	shader_use(&r->text_shader);
-	glUniformMatrix4fv(glGetUniformLocation(r->text_shader.id, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	uint32_t width = atlas.header->width;
+	uint32_t height = atlas.header->height;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glGenTextures(1, &r->font_texture);
+	glBindTexture(GL_TEXTURE_2D, r->font_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.pixels);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	for (unsigned char c = 0; c < FONT_ATLAS_GLYPHS; c++)
+	{
+		const FontAtlasGlyph &glyph = atlas.glyphs[c];
+		Character			  character = {r->font_texture, glm::ivec2(glyph.width, glyph.height),
+										   glm::ivec2(glyph.bearing_x, glyph.bearing_y), glyph.advance,
+										   glm::vec2((float)glyph.x / width, (float)glyph.y / height),
+										   glm::vec2((float)(glyph.x + glyph.width) / width,
+													 (float)(glyph.y + glyph.height) / height)};
+		r->characters.insert(c, character);
+	}
+
+	font_atlas_close(&atlas);
+	return true;
+}
 
+#ifdef COD_FREETYPE
+/*
+ * Fallback for when there's no atlas: rasterize the TTF now, a texture per glyph
+ */
+static void
+load_font_freetype(Renderer *r, const char *font_path)
+{
 	FT_Library ft;
 	if (FT_Init_FreeType(&ft))
 	{
@@ -807,15 +1061,44 @@ text_renderer_init(Renderer *r, const char *font_path)
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-		Character character = {texture, glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
+		Character character = {texture,
+							   glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
 							   glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-							   static_cast<uint32_t>(face->glyph->advance.x)};
+							   static_cast<uint32_t>(face->glyph->advance.x),
+							   glm::vec2(0.0f),
+							   glm::vec2(1.0f)};
 		r->characters.insert(c, character);
 	}
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 	FT_Done_Face(face);
 	FT_Done_FreeType(ft);
+}
+#endif
+
+void
+text_renderer_init(Renderer *r, const char *atlas_path, const char *font_path)
+{
+	r->text_shader = shader_create(text_vertex_shader, text_fragment_shader);
+	if (!r->text_shader.id)
+	{
+		printf("Failed to create text shader\n");
+		return;
+	}
+
+	glm::mat4 projection = glm::ortho(0.0f, (float)r->width, 0.0f, (float)r->height);
+	shader_use(&r->text_shader);
+	glUniformMatrix4fv(glGetUniformLocation(r->text_shader.id, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+	if (!load_font_atlas(r, atlas_path))
+	{
+#ifdef COD_FREETYPE
+		printf("No font atlas at %s, rasterizing %s\n", atlas_path, font_path);
+		load_font_freetype(r, font_path);
+#else
+		printf("No font atlas at %s, and no FreeType to rasterize %s with, text is off\n", atlas_path, font_path);
+#endif
+	}
 
 	glGenVertexArrays(1, &r->text_vao);
 	glGenBuffers(1, &r->text_vbo);
@@ -831,12 +1114,20 @@ text_renderer_init(Renderer *r, const char *font_path)
 void
 text_renderer_shutdown(Renderer *r)
 {
-	for (uint32_t i = 0; i < r->characters.table_capacity(); i++)
+	if (r->font_texture)
 	{
-		auto &entry = r->characters.data()[i];
-		if (entry.state == 1)
+		glDeleteTextures(1, &r->font_texture);
+		r->font_texture = 0;
+	}
+	else
+	{
+		for (uint32_t i = 0; i < r->characters.table_capacity(); i++)
 		{
-			glDeleteTextures(1, &entry.value.TextureID);
+			auto &entry = r->characters.data()[i];
+			if (entry.state == 1)
+			{
+				glDeleteTextures(1, &entry.value.TextureID);
+			}
 		}
 	}
 	r->characters.clear();
@@ -937,33 +1228,33 @@ text_batch_add_string(Renderer *r, std::string_view text, float x, float y, floa
 
 		r->text_batch.vertices[base + 0] = xpos;
 		r->text_batch.vertices[base + 1] = ypos + h;
-		r->text_batch.vertices[base + 2] = 0.0f;
-		r->text_batch.vertices[base + 3] = 0.0f;
+		r->text_batch.vertices[base + 2] = ch->UVMin.x;
+		r->text_batch.vertices[base + 3] = ch->UVMin.y;
 
 		r->text_batch.vertices[base + 4] = xpos;
 		r->text_batch.vertices[base + 5] = ypos;
-		r->text_batch.vertices[base + 6] = 0.0f;
-		r->text_batch.vertices[base + 7] = 1.0f;
+		r->text_batch.vertices[base + 6] = ch->UVMin.x;
+		r->text_batch.vertices[base + 7] = ch->UVMax.y;
 
 		r->text_batch.vertices[base + 8] = xpos + w;
 		r->text_batch.vertices[base + 9] = ypos;
-		r->text_batch.vertices[base + 10] = 1.0f;
-		r->text_batch.vertices[base + 11] = 1.0f;
+		r->text_batch.vertices[base + 10] = ch->UVMax.x;
+		r->text_batch.vertices[base + 11] = ch->UVMax.y;
 
 		r->text_batch.vertices[base + 12] = xpos;
 		r->text_batch.vertices[base + 13] = ypos + h;
-		r->text_batch.vertices[base + 14] = 0.0f;
-		r->text_batch.vertices[base + 15] = 0.0f;
+		r->text_batch.vertices[base + 14] = ch->UVMin.x;
+		r->text_batch.vertices[base + 15] = ch->UVMin.y;
 
 		r->text_batch.vertices[base + 16] = xpos + w;
 		r->text_batch.vertices[base + 17] = ypos;
-		r->text_batch.vertices[base + 18] = 1.0f;
-		r->text_batch.vertices[base + 19] = 1.0f;
+		r->text_batch.vertices[base + 18] = ch->UVMax.x;
+		r->text_batch.vertices[base + 19] = ch->UVMax.y;
 
 		r->text_batch.vertices[base + 20] = xpos + w;
 		r->text_batch.vertices[base + 21] = ypos + h;
-		r->text_batch.vertices[base + 22] = 1.0f;
-		r->text_batch.vertices[base + 23] = 0.0f;
+		r->text_batch.vertices[base + 22] = ch->UVMax.x;
+		r->text_batch.vertices[base + 23] = ch->UVMin.y;
 
 		r->text_batch.texture_ids[idx] = ch->TextureID;
 		r->text_batch.colors[idx] = color;
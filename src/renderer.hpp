@@ -98,6 +98,8 @@ struct Character
 	glm::ivec2 Size;
 	glm::ivec2 Bearing;
 	uint32_t   Advance;
+	glm::vec2  UVMin; /* where it is in its texture, the whole texture unless it's from the atlas */
+	glm::vec2  UVMax;
 };
 
 struct Renderer
@@ -120,6 +122,7 @@ struct Renderer
 	fixed_array<DrawCommand, 300> commands;
 
 	fixed_map<char, Character, 128> characters;
+	uint32_t						font_texture; /* the atlas every character is in, 0 if each has its own */
 	uint32_t						text_vao;
 	uint32_t						text_vbo;
 	ShaderProgram					text_shader;
@@ -205,8 +208,9 @@ mesh_create_cube(float size);
 Mesh
 mesh_create_sphere(float radius, uint32_t sectors, uint32_t stacks);
 
+/* From the baked atlas (see font_atlas.hpp), rasterizing the TTF with FreeType if there isn't one */
 void
-text_renderer_init(Renderer *r, const char *font_path);
+text_renderer_init(Renderer *r, const char *atlas_path, const char *font_path);
 
 void
 text_renderer_shutdown(Renderer *r);
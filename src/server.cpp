@@ -1,50 +1,97 @@
 /*
  * The server is where the authoritative game update occurs, with a period
  * snapshot being broadcast to all players
+ *
+ * The work is split over three threads so the simulation thread does nothing but simulate:
+ *
+ *   network thread   polls packets, decodes them, handles connects and disconnects and tells
+ *                    the simulation who joined and left
+ *   receive thread   (NetworkClient's) routes inputs straight into the owning player's input ring
+ *   sim thread       applies events and simulates tick N on its own state, no sockets involved
+ *   send thread      quantizes and sends the snapshot the sim published last (tick N-1 while the
+ *                    sim is busy with N), plus any reliable events the sim raised
+ *
+ * Handoffs are single-producer single-consumer queues, so none of them lock. The snapshot handoff
+ * is double-buffered: the sim fills a free frame and queues it, the send thread returns it once
+ * sent. If the send thread still holds both frames the sim skips that snapshot rather than wait.
+ *
+ * NetworkClient itself isn't thread safe (sends and polls both update per-peer sequence state), so
+ * the network and send threads take net_mutex around anything that touches it. The sim never does.
+ *
+ * Checkpoints of the match are taken by forking at a tick boundary, the child writes them out while
+ * the sim carries on (see checkpoint_match).
+ *
+ * A server started by the matchmaker (matchmaker.cpp) also reports its player count and tick cost to
+ * it once a second, from the network thread, with the sim publishing the tick cost through atomics.
+ *
+ * Spectators don't connect here. A relay (relay.cpp) connects once, gets every snapshot unculled plus
+ * the events, and fans them out, so spectating costs the server one extra send however many watch.
  */
 #include "server.hpp"
+#include "checkpoint.hpp"
 #include "containers.hpp"
 #include "game_types.hpp"
+#include "large_pages.hpp"
+#include "log.hpp"
 #include "map.hpp"
 #include "network_client.hpp"
 #include "physics.hpp"
 #include "profiler.hpp"
 #include "quantization.hpp"
+#include "startup.hpp"
+#include "telemetry.hpp"
 #include "time.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <glm/glm.hpp>
+#include <mutex>
+#include <new>
+#include <thread>
 #include "server_extended.hpp"
+#include "threads.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #define SNAPSHOT_RATE  20.0f
 #define CLIENT_TIMEOUT 5.0f
-#define HISTORY_SIZE   64
+#define HISTORY_SIZE   128 /* power of 2, a second at MAX_TICK_RATE */
 #define RESPAWN_TIME   1.5f
 
-#define SNAPSHOT_TIME			(1.0f / SNAPSHOT_RATE)
-#define NETWORK_UPDATE_INTERVAL (1.0f / 60.0f * 6.0f)
-#define MAX_DELTA_TIME			0.1f
-
-#define RESPAWN_INTERVAL TICK_TIME / 20
+#define NETWORK_UPDATE_SECONDS 0.1f
+#define MAX_DELTA_TIME		   0.1f
 
 #define BULLET_DAMAGE	  10
 #define STARTING_HEALTH	  100
-#define INPUT_BUFFER_SIZE 12
+#define INPUT_BUFFER_SIZE 32 /* power of 2, it's a lock_free_queue. A quarter second at MAX_TICK_RATE */
 #define MAP_GEOMETRY_SIZE 256
 #define LOOP_SLEEP_MS	  1
 
+#define SIM_EVENT_QUEUE_SIZE   1024
+#define KILL_EVENT_QUEUE_SIZE  64
+#define SHOT_EVENT_QUEUE_SIZE  256
+#define SHOT_STREAM_SIZE	   1024 /* power of 2, how far a client's shots can fall behind */
+#define THREAD_IDLE_SLEEP_US   500
+#define PROFILE_REPORT_SECONDS 5.0f
+#define LOAD_REPORT_SECONDS	   1.0f
+
+#define CHECKPOINT_PAUSE_BUDGET_US 1000
+#define CHECKPOINT_MAX_SIZE                                                                                         \
+	(sizeof(CheckpointHeader) + MAX_PLAYERS * (sizeof(CheckpointClient) + sizeof(CheckpointPlayer)) +            \
+	 HISTORY_SIZE * (sizeof(CheckpointFrame) + MAX_PLAYERS * sizeof(CheckpointPlayer)) +                         \
+	 MAX_PLAYERS * sizeof(CheckpointRespawn))
+
+/*
+ * Network thread side of a connection, the send thread reads it under net_mutex
+ */
 struct ClientConnection
 {
-	/*
-	 * Buffer the inputs, some might arrive out of order or bunched
-	 */
-	fixed_queue<InputMessage, INPUT_BUFFER_SIZE> input_buffer;
-	/*
-	 *  Server: 'This is the last input I have processed, and here is your position'
-	 *  Client: 'Okay, here + all the inputs you haven't processed yet is where I predict I am'
-	 */
-	uint32_t		 last_processed;
 	fixed_string<32> player_name;
 	uint32_t		 peer_id; /* 0 = inactive slot */
 
@@ -55,47 +102,215 @@ struct ClientConnection
 	}
 };
 
+/*
+ * Sim thread side of a connection
+ */
+struct ClientInputs
+{
+	/*
+	 *  Server: 'This is the last input I have processed, and here is your position'
+	 *  Client: 'Okay, here + all the inputs you haven't processed yet is where I predict I am'
+	 */
+	uint32_t last_processed;
+	uint32_t peer_id; /* inputs routed for anyone else are stale, from a previous occupant */
+	bool	 active;
+
+	/* What the player was doing before the next input's press, type is 0 until there's been one */
+	InputMessage last_input;
+};
+
+/*
+ * Receive thread -> sim thread, one ring per player slot
+ */
+struct RoutedInput
+{
+	uint32_t	 peer_id;
+	InputMessage input;
+};
+
 struct Respawn
 {
 	int8_t player_index;
-	float  respawn_time;
+	Tick   respawn_tick;
+};
+
+enum SimEventType : uint8_t
+{
+	SIM_EVENT_JOIN,
+	SIM_EVENT_LEAVE,
+};
+
+/*
+ * Network thread -> sim thread
+ */
+struct SimEvent
+{
+	uint8_t	 type;
+	int8_t	 player_idx;
+	uint32_t peer_id;
+	char	 player_name[32];
+};
+
+/*
+ * Sim thread -> send thread, everything a snapshot needs so the send thread never reads sim state
+ */
+struct SnapshotFrame
+{
+	Tick							 tick;
+	fixed_array<Player, MAX_PLAYERS> players;
+};
+
+/*
+ * The state every tick reads and writes all over, in one block so it can be backed by huge pages
+ * (see large_pages.hpp). The history and frame are the sim thread's, the frames are handed between
+ * the sim and send threads through free_frames/ready_frames
+ */
+struct TickState
+{
+	/*
+	 * History for doing lag-compensated shots,
+	 * when player 1 shot, it was at tick x, where was everyone at x?
+	 *
+	 * This makes it fair for everyone despite variations in latency.
+	 * Frames are keyed by tick, so finding the one a shot refers to is a single lookup
+	 */
+	keyed_ring<Snapshot, HISTORY_SIZE> history;
+	Snapshot						   frame;
+	SnapshotFrame					   frames[2];
+	Snapshot						   shot_rewind; /* the history blended to a shot's moment */
+};
+
+/*
+ * Send thread, how far into the shot stream a client's snapshots have got
+ */
+struct ShotCursor
+{
+	uint32_t peer_id; /* a new peer in the slot starts from the current end of the stream */
+	uint32_t next_sequence;
 };
 
 static struct
 {
-	NetworkClient network;
-	Map			  map;
 	/*
-	 * Accumulated for each snapshot
+	 * Network thread, and the send thread while holding net_mutex
+	 */
+	NetworkClient							   network;
+	std::mutex								   net_mutex;
+	fixed_array<ClientConnection, MAX_PLAYERS> clients;
+	uint32_t								   relay_peer; /* 0 = no relay */
+
+	uint16_t		  port;
+	uint16_t		  tick_rate; /* set before the threads start */
+	/* Load reports to the matchmaker, network thread only */
+	bool			  reporting_load;
+	UdpSocket		  load_socket;
+	sockaddr_in		  load_address;
+
+	std::thread		  net_thread;
+	std::thread		  send_thread;
+	std::atomic<bool> running;
+	std::atomic<Tick> current_tick; /* published by the sim, for connect accepts */
+	/* Published by the sim every second, for load reports */
+	std::atomic<uint32_t> load_tick_us_avg;
+	std::atomic<uint32_t> load_tick_us_max;
+	/* Which peer holds each player slot, written by the network thread, read by the receive thread */
+	std::atomic<uint32_t> slot_peers[MAX_PLAYERS];
+	/* The send side of the network stats, copied out under net_mutex for the sim's telemetry */
+	std::atomic<uint64_t> sent_packets;
+	std::atomic<uint64_t> sent_bytes;
+	std::atomic<uint64_t> sent_retransmits;
+
+	/*
+	 * Handoffs between the threads
 	 */
-	fixed_array<Shot, MAX_SHOTS> new_shots;
-	float						 time;
-	TimePoint					 start_time;
+	lock_free_queue<SimEvent, SIM_EVENT_QUEUE_SIZE>			  sim_events;
 	/*
-	 * History for doing lag-compensated shots,
-	 * when player 1 shot, it was at time x, where was everyone at x?
-	 *
-	 * This makes it fair for everyone despite variations in latency
+	 * Buffer the inputs, some might arrive out of order or bunched
+	 */
+	lock_free_queue<RoutedInput, INPUT_BUFFER_SIZE>			  input_rings[MAX_PLAYERS];
+	lock_free_queue<PlayerKilledEvent, KILL_EVENT_QUEUE_SIZE> kill_events;
+	lock_free_queue<Shot, SHOT_EVENT_QUEUE_SIZE>			  shot_events;
+	TickState												 *tick_state; /* in tick_block */
+	LargeBlock												  tick_block;
+	lock_free_queue<uint8_t, 4>								  free_frames;
+	lock_free_queue<uint8_t, 4>								  ready_frames;
+
+	/*
+	 * Send thread only. Every shot gets the next sequence number, clients read the stream at their own pace
 	 */
-	ring_buffer<Snapshot, HISTORY_SIZE>		   history;
-	Snapshot								   frame;
+	keyed_ring<Shot, SHOT_STREAM_SIZE> shot_stream;
+	uint32_t						   next_shot_sequence;
+	ShotCursor						   shot_cursors[MAX_PLAYERS];
+	ShotCursor						   relay_cursor;
+
+	/*
+	 * Sim thread only. Periodic work is scheduled on tick numbers rather than float accumulators,
+	 * the intervals are worked out from the tick rate when the server starts
+	 */
+	Map	 map;
+	Tick tick;
+	float tick_time;
+	Tick snapshot_interval;
+	Tick respawn_ticks;
 	fixed_queue<Respawn, MAX_PLAYERS>		   dead_players;
-	fixed_array<ClientConnection, MAX_PLAYERS> clients;
+	fixed_array<ClientInputs, MAX_PLAYERS>	   inputs;
+	uint32_t								   skipped_snapshots;
+	uint32_t								   dropped_shots;
+	uint64_t								   tick_us_total;
+	uint32_t								   tick_us_max;
+	uint32_t								   ticks_measured;
+
+	/*
+	 * Sim thread only, checkpoints
+	 */
+	Tick	 checkpoint_interval; /* 0 = off */
+	char	 checkpoint_path[64];
+	char	 checkpoint_temp_path[72];
+	int		 checkpoint_pid; /* the child writing one, 0 = none */
+	uint32_t checkpoint_pause_us_max;
+	uint32_t checkpoints_written;
+	uint32_t checkpoints_skipped;
+	uint32_t checkpoints_failed;
+
+	/*
+	 * Sim thread only, how far each tick's start is from tick_time after the last one's
+	 */
+	TimePoint last_tick_start;
+	uint64_t  jitter_us_total;
+	uint32_t  jitter_us_max;
+	uint32_t  jitter_samples;
+	char	  placement[96]; /* for the report, so runs with and without pinning can be told apart */
+
+	/*
+	 * Sim thread only, the flight recorder. The record is filled in as the tick goes and written at
+	 * its end, the totals are the network counters as they were then, to take this tick's share from
+	 */
+	TelemetryFile	telemetry; /* no header when it's off */
+	TelemetryRecord telemetry_record;
+	uint64_t		telemetry_packets_in;
+	uint64_t		telemetry_bytes_in;
+	uint64_t		telemetry_duplicates;
+	uint64_t		telemetry_packets_out;
+	uint64_t		telemetry_bytes_out;
+	uint64_t		telemetry_retransmits;
 } SERVER = {};
 
+/* Only ever written by a checkpoint child, the parent's copy stays untouched (and unpaged) */
+static uint8_t CHECKPOINT_BUFFER[CHECKPOINT_MAX_SIZE];
+
 Player *
 get_player(int8_t player_idx)
 {
 	assert(player_idx >= 0 && player_idx < MAX_PLAYERS);
-	Player *p = &SERVER.frame.players[player_idx];
+	Player *p = &SERVER.tick_state->frame.players[player_idx];
 	return p;
 }
 
-ClientConnection *
-get_client(int8_t player_idx)
+ClientInputs *
+get_inputs(int8_t player_idx)
 {
 	assert(player_idx >= 0 && player_idx < MAX_PLAYERS);
-	ClientConnection *c = &SERVER.clients[player_idx];
+	ClientInputs *c = &SERVER.inputs[player_idx];
 	return c;
 }
 
@@ -112,29 +327,43 @@ find_player_index_for_peer(uint32_t peer_id)
 	return -1;
 }
 
-float
-get_time()
+/*
+ * Everyone reliable events go to: the players, and the relay to pass on. Call under net_mutex,
+ * peer_ids needs room for MAX_PLAYERS + 1
+ */
+uint32_t
+gather_active_peers(uint32_t *peer_ids)
 {
-	return time_elapsed_seconds(SERVER.start_time);
+	uint32_t count = 0;
+	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	{
+		if (SERVER.clients[i].active())
+		{
+			peer_ids[count++] = SERVER.clients[i].peer_id;
+		}
+	}
+	if (SERVER.relay_peer)
+	{
+		peer_ids[count++] = SERVER.relay_peer;
+	}
+	return count;
 }
 
 bool
-history_get_frame_at_time(float time, Snapshot **out)
+history_get_frame_at_tick(Tick tick, Snapshot **out)
 {
-	for (size_t i = SERVER.history.size(); i > 0; i--)
+	/* Either in the future (a confused client) or older than we keep */
+	Snapshot *frame = SERVER.tick_state->history.get(tick);
+	if (!frame)
 	{
-		Snapshot *frame = SERVER.history.at(i - 1);
-		if (frame->timestamp <= time)
-		{
-			*out = frame;
-			return true;
-		}
+		return false;
 	}
-	return false;
+	*out = frame;
+	return true;
 }
 
 void
-update_respawns(float current_time)
+update_respawns(Tick current_tick)
 {
 
 	while (!SERVER.dead_players.empty())
@@ -142,7 +371,7 @@ update_respawns(float current_time)
 		Respawn *respawn = SERVER.dead_players.front();
 
 		/* A queue, so we can exit */
-		if (respawn->respawn_time > current_time)
+		if (respawn->respawn_tick > current_tick)
 		{
 			break;
 		}
@@ -152,43 +381,74 @@ update_respawns(float current_time)
 		{
 			entity->position = get_spawn_point(SERVER.map);
 			entity->health = STARTING_HEALTH;
-			printf("Respawned player %d\n", respawn->player_index);
+			LOG("Respawned player %d\n", respawn->player_index);
 		}
 
 		SERVER.dead_players.pop();
 	}
 }
 
+/*
+ * Everyone as a client saw them. It renders between two ticks, so the frames either side are blended
+ * by how far between them it was. Anyone dead or respawned in one of the two stays where the earlier
+ * frame has them rather than sliding across the map
+ */
 void
-perform_lag_compensated_shot(Player *shooter, int8_t shooter_idx, float shot_time)
+history_get_players_at(Tick tick, uint8_t fraction, Snapshot *out)
 {
-	/*
-	 * We could get the exact position by interpolating, but because each shot has a different
-	 * time step, we'd have to calculate it anew for each shot.
-	 *
-	 * This test will be the least accurate when a player is moving at high speed in a single
-	 * direction.
-	 */
-	Snapshot *historical;
-	if (!history_get_frame_at_time(shot_time, &historical))
+	Snapshot *before;
+	if (!history_get_frame_at_tick(tick, &before))
 	{
-		historical = &SERVER.frame;
+		*out = SERVER.tick_state->frame;
+		return;
 	}
+	*out = *before;
 
-	Player *historical_shooter = &historical->players[shooter_idx];
-
-	if (!historical_shooter->active())
+	Snapshot *after;
+	if (fraction == 0 || !history_get_frame_at_tick(tick + 1, &after))
 	{
 		return;
 	}
 
-	Shot	  shot = create_shot(historical_shooter);
+	float t = subtick_to_fraction(fraction);
+	for (uint32_t i = 0; i < out->players.size(); i++)
+	{
+		Player &player = out->players[i];
+		Player &next = after->players[i];
+		if (player.active() && next.player_idx == player.player_idx && player.alive() && next.alive())
+		{
+			player.position = glm::mix(player.position, next.position, t);
+		}
+	}
+}
+
+void
+perform_lag_compensated_shot(Player *shooter, int8_t shooter_idx, InputMessage *input)
+{
+	/*
+	 * The shooter fires from where they are now, which is where their prediction had them, along the
+	 * look they had the moment they clicked. Everyone else is where the shooter saw them: rewound to
+	 * the render time at the click, between ticks included, so a fast strafe is hit where it was drawn
+	 */
+	Snapshot *rewound = &SERVER.tick_state->shot_rewind;
+	history_get_players_at(input->shot_tick, input->shot_fraction, rewound);
+
+	Player aim = *shooter;
+	aim.yaw = input->press_yaw;
+	aim.pitch = input->press_pitch;
+
+	Shot	  shot = create_shot(&aim);
 	glm::vec3 hit_point;
 	int8_t	  hit_player = -1;
 
-	trace_shot(shot, SERVER.map, SERVER.frame.players, &hit_player, &hit_point);
+	trace_shot(shot, SERVER.map, rewound->players, &hit_player, &hit_point);
 
-	SERVER.new_shots.push(shot);
+	if (!SERVER.shot_events.try_push(shot))
+	{
+		/* Send thread is far behind, it's only a trail */
+		SERVER.dropped_shots++;
+		SERVER.telemetry_record.flags |= TELEMETRY_SHOTS_DROPPED;
+	}
 
 	if (hit_player == -1)
 	{
@@ -196,6 +456,11 @@ perform_lag_compensated_shot(Player *shooter, int8_t shooter_idx, float shot_tim
 	}
 
 	Player *target = get_player(hit_player);
+	if (!target->alive())
+	{
+		/* Died between then and now, to someone else */
+		return;
+	}
 	target->health = std::max(target->health - BULLET_DAMAGE, 0);
 
 	if (target->alive())
@@ -203,31 +468,29 @@ perform_lag_compensated_shot(Player *shooter, int8_t shooter_idx, float shot_tim
 		return;
 	}
 
-	Respawn respawn = {.player_index = hit_player, .respawn_time = SERVER.time + RESPAWN_TIME};
+	Respawn respawn = {.player_index = hit_player, .respawn_tick = SERVER.tick + SERVER.respawn_ticks};
 	SERVER.dead_players.push(respawn);
 
-	SendPacket<PlayerKilledEvent> evt = {.payload = make_kill_event(shooter_idx, hit_player)};
-
-	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	/* Broadcast by the send thread */
+	if (!SERVER.kill_events.try_push(make_kill_event(shooter_idx, hit_player)))
 	{
-		if (SERVER.clients[i].active())
-		{
-			network_send_reliable(&SERVER.network, SERVER.clients[i].peer_id, evt);
-		}
+		LOG("Kill event queue full, dropping kill of player %d\n", hit_player);
 	}
 }
 
 void
 tick(float dt)
 {
+	TelemetryRecord *record = &SERVER.telemetry_record;
 
 	for (int8_t player_idx = 0; player_idx < MAX_PLAYERS; player_idx++)
 	{
-		ClientConnection *client = get_client(player_idx);
-		if (!client->active())
+		ClientInputs *client = get_inputs(player_idx);
+		if (!client->active)
 		{
 			continue;
 		}
+		record->player_count++;
 
 		Player *entity = get_player(player_idx);
 		if (!entity->alive())
@@ -240,56 +503,317 @@ tick(float dt)
 		 * and 2 the next. Only processing ones with a larger sequence number
 		 * stops this buffer from processing stale data.
 		 */
-		while (client->input_buffer.size())
+		RoutedInput routed;
+		while (SERVER.input_rings[player_idx].try_pop(routed))
 		{
-			auto input = client->input_buffer.pop();
+			InputMessage *input = &routed.input;
 
-			if (input->sequence_num <= client->last_processed)
+			if (routed.peer_id != client->peer_id || input->sequence_num <= client->last_processed)
 			{
+				record->stale_inputs++;
 				continue;
 			}
 
 			client->last_processed = input->sequence_num;
+			record->inputs++;
+
+			/* Move up to the press first, so the shot leaves from where the player was when they clicked */
+			InputMessage *previous = client->last_input.type ? &client->last_input : nullptr;
+			float rest = apply_held_input(entity, previous, input, SERVER.map, SERVER.tick_state->frame.players, dt);
 
 			if ((input->buttons & INPUT_BUTTON_SHOOT))
 			{
-				perform_lag_compensated_shot(entity, player_idx, input->shot_time);
+				perform_lag_compensated_shot(entity, player_idx, input);
 			}
 
-			apply_player_input(entity, input, dt);
-			apply_player_physics(entity, SERVER.map, SERVER.frame.players, dt);
+			apply_player_input(entity, input, rest);
+			apply_player_physics(entity, SERVER.map, SERVER.tick_state->frame.players, rest);
+			client->last_input = *input;
 		}
 	}
 
-	SERVER.frame.timestamp = get_time();
-	SERVER.history.push(SERVER.frame);
+	SERVER.tick_state->frame.tick = SERVER.tick;
+	SERVER.tick_state->history.put(SERVER.tick, SERVER.tick_state->frame);
 }
 
+/*
+ * Sim thread: apply what the network thread handed over since last tick
+ */
 void
-remove_client(uint32_t peer_id)
+process_sim_events()
 {
-	int8_t player_idx = find_player_index_for_peer(peer_id);
-	if (player_idx < 0)
+	SimEvent event;
+	while (SERVER.sim_events.try_pop(event))
+	{
+		ClientInputs *client = get_inputs(event.player_idx);
+		Player		 *entity = get_player(event.player_idx);
+
+		switch (event.type)
+		{
+		case SIM_EVENT_JOIN:
+			client->last_processed = 0;
+			client->last_input = {};
+			client->peer_id = event.peer_id;
+			client->active = true;
+
+			memset(entity, 0, sizeof(Player));
+			entity->player_idx = event.player_idx;
+			entity->position = get_spawn_point(SERVER.map);
+			entity->health = STARTING_HEALTH;
+			break;
+
+		case SIM_EVENT_LEAVE:
+			client->peer_id = 0;
+			client->active = false;
+			entity->player_idx = -1;
+			entity->health = 0;
+			break;
+		}
+	}
+}
+
+/*
+ * Sim thread: copy what the snapshot needs into a free frame for the send thread
+ */
+void
+publish_snapshot()
+{
+	uint8_t frame_idx;
+	if (!SERVER.free_frames.try_pop(frame_idx))
 	{
+		/* Send thread is behind, the shots are in the stream and go out with the next snapshot */
+		SERVER.skipped_snapshots++;
+		SERVER.telemetry_record.flags |= TELEMETRY_SNAPSHOT_SKIPPED;
 		return;
 	}
 
-	memset(&SERVER.clients[player_idx], 0, sizeof(ClientConnection));
+	SnapshotFrame *out = &SERVER.tick_state->frames[frame_idx];
+	out->tick = SERVER.tick;
+	out->players.clear();
+	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	{
+		Player entity = SERVER.tick_state->frame.players[i];
+		entity.last_processed_seq = SERVER.inputs[i].last_processed;
+		out->players.push(entity);
+	}
 
-	Player *p = &SERVER.frame.players[player_idx];
-	p->player_idx = -1;
-	p->health = 0;
+	SERVER.ready_frames.try_push(frame_idx);
+}
 
-	SendPacket<PlayerLeftEvent> event = {.payload = make_leave_event(player_idx)};
+/*
+ * Sim thread: checkpoints
+ *
+ * fork() at a tick boundary gives the child a copy of the whole process exactly as it is between ticks,
+ * without copying anything up front: parent and child share every page copy-on-write, so the parent
+ * pays for duplicating the page tables during fork() and then for a page copy the first time it writes
+ * to each page while the child is alive (all 2MB of it, for the tick state in huge pages). The child
+ * serializes and writes at its own pace, the sim never waits on the disk.
+ *
+ * Only the forking thread exists in the child. Anything another thread could have been holding at the
+ * time (stdio's lock, the allocator's, net_mutex) may be locked forever there, so the child sticks to
+ * plain memory and system calls, and leaves with _exit().
+ */
+static uint8_t *
+put_bytes(uint8_t *at, const void *data, size_t size)
+{
+	memcpy(at, data, size);
+	return at + size;
+}
+
+/*
+ * Runs in the child. clients[] belongs to the network thread, which could have been part way through
+ * a connect when we forked, so a name may be torn. Everything the sim owns is consistent
+ */
+static size_t
+serialize_checkpoint(uint8_t *out)
+{
+	CheckpointHeader header = {};
+	memcpy(header.magic, "CODC", 4);
+	header.version = CHECKPOINT_VERSION;
+	header.max_players = MAX_PLAYERS;
+	header.tick = SERVER.tick;
+	header.tick_rate = SERVER.tick_rate;
+	header.respawn_count = SERVER.dead_players.size();
+
+	uint8_t *at = out + sizeof(header);
 	for (int8_t i = 0; i < MAX_PLAYERS; i++)
 	{
-		if (SERVER.clients[i].active())
+		CheckpointClient client = {};
+		client.active = SERVER.inputs[i].active;
+		strncpy(client.name, SERVER.clients[i].player_name.c_str(), sizeof(client.name) - 1);
+		client.last_processed_input = SERVER.inputs[i].last_processed;
+		at = put_bytes(at, &client, sizeof(client));
+	}
+
+	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	{
+		CheckpointPlayer player = checkpoint_player(SERVER.tick_state->frame.players[i]);
+		at = put_bytes(at, &player, sizeof(player));
+	}
+
+	/* Oldest first */
+	Tick first = SERVER.tick >= HISTORY_SIZE ? SERVER.tick - HISTORY_SIZE + 1 : 0;
+	for (Tick tick = first; tick <= SERVER.tick; tick++)
+	{
+		Snapshot *snapshot = SERVER.tick_state->history.get(tick);
+		if (!snapshot)
 		{
-			network_send_reliable(&SERVER.network, SERVER.clients[i].peer_id, event);
+			continue;
+		}
+
+		CheckpointFrame frame = {tick, (uint8_t)snapshot->players.size()};
+		at = put_bytes(at, &frame, sizeof(frame));
+		for (Player &p : snapshot->players)
+		{
+			CheckpointPlayer player = checkpoint_player(p);
+			at = put_bytes(at, &player, sizeof(player));
 		}
+		header.history_count++;
+	}
+
+	for (Respawn &respawn : SERVER.dead_players)
+	{
+		CheckpointRespawn entry = {respawn.player_index, respawn.respawn_tick};
+		at = put_bytes(at, &entry, sizeof(entry));
+	}
+
+	memcpy(out, &header, sizeof(header));
+	return at - out;
+}
+
+#ifndef _WIN32
+static bool
+write_checkpoint_file()
+{
+	size_t size = serialize_checkpoint(CHECKPOINT_BUFFER);
+
+	int fd = open(SERVER.checkpoint_temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	size_t written = 0;
+	while (written < size)
+	{
+		ssize_t result = write(fd, CHECKPOINT_BUFFER + written, size - written);
+		if (result <= 0)
+		{
+			close(fd);
+			return false;
+		}
+		written += result;
+	}
+
+	/* It's for crash recovery, so make sure it's on disk before it replaces the last good one */
+	bool ok = fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	return ok && rename(SERVER.checkpoint_temp_path, SERVER.checkpoint_path) == 0;
+}
+#endif
+
+void
+checkpoint_match()
+{
+#ifndef _WIN32
+	if (SERVER.checkpoint_pid > 0)
+	{
+		int status;
+		if (waitpid(SERVER.checkpoint_pid, &status, WNOHANG) == SERVER.checkpoint_pid)
+		{
+			bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			SERVER.checkpoints_written += ok;
+			SERVER.checkpoints_failed += !ok;
+			SERVER.checkpoint_pid = 0;
+		}
+	}
+
+	if (SERVER.tick % SERVER.checkpoint_interval != 0)
+	{
+		return;
+	}
+
+	/* The last one is still being written, the disk is slower than the interval */
+	if (SERVER.checkpoint_pid > 0)
+	{
+		SERVER.checkpoints_skipped++;
+		return;
+	}
+
+	TimePoint start = time_now();
+	pid_t	  pid = fork();
+	if (pid == 0)
+	{
+		_exit(write_checkpoint_file() ? 0 : 1);
+	}
+
+	uint32_t pause_us = (uint32_t)(time_elapsed_seconds(start) * 1e6f);
+	SERVER.checkpoint_pause_us_max = pause_us > SERVER.checkpoint_pause_us_max ? pause_us : SERVER.checkpoint_pause_us_max;
+
+	if (pid < 0)
+	{
+		SERVER.checkpoints_failed++;
+		return;
+	}
+	SERVER.checkpoint_pid = pid;
+	SERVER.telemetry_record.flags |= TELEMETRY_CHECKPOINT;
+#endif
+}
+
+/*
+ * Network or send thread, with net_mutex held
+ */
+static void
+publish_send_stats()
+{
+	SERVER.sent_packets.store(SERVER.network.stats.packets_sent, std::memory_order_relaxed);
+	SERVER.sent_bytes.store(SERVER.network.stats.bytes_sent, std::memory_order_relaxed);
+	SERVER.sent_retransmits.store(SERVER.network.stats.retransmits, std::memory_order_relaxed);
+}
+
+/*
+ * Network thread from here on, with net_mutex held
+ */
+static void
+push_sim_event(const SimEvent &event)
+{
+	/* Joins and leaves can't be dropped, the sim is always draining so this won't wait long */
+	while (!SERVER.sim_events.try_push(event))
+	{
+		sleep_microseconds(THREAD_IDLE_SLEEP_US);
+	}
+}
+
+void
+remove_client(uint32_t peer_id)
+{
+	if (peer_id == SERVER.relay_peer)
+	{
+		SERVER.relay_peer = 0;
+		LOG("Relay disconnected (peer_id: %u)\n", peer_id);
+		return;
+	}
+
+	int8_t player_idx = find_player_index_for_peer(peer_id);
+	if (player_idx < 0)
+	{
+		return;
 	}
 
-	printf("Player %d disconnected (peer_id: %u)\n", player_idx, peer_id);
+	SERVER.clients[player_idx] = {};
+	SERVER.slot_peers[player_idx].store(0, std::memory_order_release);
+
+	SimEvent leave = {};
+	leave.type = SIM_EVENT_LEAVE;
+	leave.player_idx = player_idx;
+	push_sim_event(leave);
+
+	SendPacket<PlayerLeftEvent> event = {.payload = make_leave_event(player_idx)};
+	uint32_t					peer_ids[MAX_PLAYERS + 1];
+	uint32_t					peer_count = gather_active_peers(peer_ids);
+	network_broadcast_reliable(&SERVER.network, peer_ids, peer_count, event, CHANNEL_CONTROL);
+
+	LOG("Player %d disconnected (peer_id: %u)\n", player_idx, peer_id);
 }
 
 void
@@ -303,49 +827,94 @@ handle_connect_request(uint32_t peer_id, ConnectRequest *req)
 	int8_t player_idx = find_player_index_for_peer(0); /*  find free */
 	if (player_idx < 0)
 	{
-		printf("No free player slots\n");
+		LOG("No free player slots\n");
 		return;
 	}
 
 	ClientConnection *client = &SERVER.clients[player_idx];
 	client->peer_id = peer_id;
-	client->last_processed = 0;
 	client->player_name.set(req->player_name);
 
-	Player *entity = &SERVER.frame.players[player_idx];
-	memset(entity, 0, sizeof(Player));
-	entity->player_idx = player_idx;
-	entity->position = get_spawn_point(SERVER.map);
-	entity->health = STARTING_HEALTH;
+	SimEvent join = {};
+	join.type = SIM_EVENT_JOIN;
+	join.player_idx = player_idx;
+	join.peer_id = peer_id;
+	memcpy(join.player_name, req->player_name, sizeof(join.player_name));
+	push_sim_event(join);
+
+	/* Inputs route from here on, the sim drops any that beat the join event */
+	SERVER.slot_peers[player_idx].store(peer_id, std::memory_order_release);
 
-	printf("Player %d connected (peer_id: %u, name: %s)\n", player_idx, peer_id, req->player_name);
+	LOG("Player %d connected (peer_id: %u, name: %s)\n", player_idx, peer_id, client->player_name.c_str());
 
-	SendPacket<ConnectAccept> msg = {.payload = make_connect_accept(peer_id, get_time(), player_idx)};
+	Tick					 tick = SERVER.current_tick.load(std::memory_order_relaxed);
+	SendPacket<ConnectAccept> msg = {};
+	msg.payload = make_connect_accept(peer_id, tick, player_idx, SERVER.tick_rate);
 
-	network_send_reliable(&SERVER.network, peer_id, msg);
+	network_send_reliable(&SERVER.network, peer_id, msg, CHANNEL_CONTROL);
 }
 
 void
-handle_client_input(int8_t player_idx, InputMessage *input)
+handle_relay_connect(uint32_t peer_id)
 {
-	ClientConnection *client = get_client(player_idx);
-	if (!client->active())
+	if (find_player_index_for_peer(peer_id) >= 0 || peer_id == SERVER.relay_peer)
+	{
+		return;
+	}
+	if (SERVER.relay_peer)
 	{
+		LOG("Already have a relay, ignoring peer %u\n", peer_id);
 		return;
 	}
 
-	Player *player = get_player(player_idx);
+	SERVER.relay_peer = peer_id;
+	LOG("Relay connected (peer_id: %u)\n", peer_id);
 
-	client->input_buffer.push(*input);
+	Tick					 tick = SERVER.current_tick.load(std::memory_order_relaxed);
+	SendPacket<ConnectAccept> msg = {};
+	msg.payload = make_connect_accept(peer_id, tick, -1, SERVER.tick_rate);
+	network_send_reliable(&SERVER.network, peer_id, msg, CHANNEL_CONTROL);
 }
 
-void
+/*
+ * Receive thread: inputs from a connected player go straight into that player's ring, anything
+ * else is left for the network thread
+ */
+bool
+route_client_input(uint32_t peer_id, const uint8_t *payload, uint16_t size)
+{
+	if (size < sizeof(InputMessage) || payload[0] != MSG_CLIENT_INPUT)
+	{
+		return false;
+	}
+
+	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	{
+		if (SERVER.slot_peers[i].load(std::memory_order_acquire) != peer_id)
+		{
+			continue;
+		}
+
+		RoutedInput routed;
+		routed.peer_id = peer_id;
+		memcpy(&routed.input, payload, sizeof(InputMessage));
+
+		/* Full means the sim is far behind on this player, newest input is dropped */
+		SERVER.input_rings[i].try_push(routed);
+		return true;
+	}
+	return false;
+}
+
+uint32_t
 server_process_packets()
 {
-	Polled polled;
+	Polled	 polled;
+	uint32_t processed = 0;
 
 	while (network_poll(&SERVER.network, polled))
 	{
+		processed++;
 
 		assert(polled.size >= 1);
 		uint8_t msg_type = polled.buffer[0];
@@ -356,123 +925,414 @@ server_process_packets()
 			handle_connect_request(polled.from, (ConnectRequest *)polled.buffer);
 			break;
 
-		case MSG_CLIENT_INPUT: {
-			int8_t player_idx = find_player_index_for_peer(polled.from);
-			if (player_idx >= 0)
-			{
-				handle_client_input(player_idx, (InputMessage *)polled.buffer);
-			}
+		case MSG_RELAY_CONNECT:
+			handle_relay_connect(polled.from);
 			break;
-		}
+
+		case MSG_KEEPALIVE:
+			break;
+
+		case MSG_CLIENT_INPUT:
+			/* Connected players' inputs were routed on the receive thread, this one has no slot */
+			break;
+
 		default:
 			assert(false && "Unhandled Message\n");
 		}
 
 		network_release_buffer(&SERVER.network, polled.buffer_index);
 	}
+
+	return processed;
+}
+
+void
+send_load_report()
+{
+	ServerLoad load = {};
+	load.type = MSG_SERVER_LOAD;
+	load.port = SERVER.port;
+	load.max_players = MAX_PLAYERS;
+	for (ClientConnection &client : SERVER.clients)
+	{
+		load.player_count += client.active();
+	}
+	load.tick_us_avg = SERVER.load_tick_us_avg.load(std::memory_order_relaxed);
+	load.tick_us_max = SERVER.load_tick_us_max.load(std::memory_order_relaxed);
+	load.tick_rate = SERVER.tick_rate;
+
+	udp_send(&SERVER.load_socket, &load, sizeof(load), &SERVER.load_address);
 }
 
 void
-broadcast_snapshot()
+network_thread_func()
 {
-	SendPacket<SnapshotMessage> msg = {};
-	msg.payload.type = MSG_SERVER_SNAPSHOT;
-	msg.payload.server_time = get_time();
-	msg.payload.player_count = 0;
+	Profiler profiler;
+	profiler_init(&profiler);
 
-	for (int8_t i = 0; i < MAX_PLAYERS; i++)
+	TimePoint last_update = time_now();
+	TimePoint last_report = time_now();
+	TimePoint last_load_report = time_now();
+
+	while (SERVER.running)
 	{
-		Player *entity = &SERVER.frame.players[i];
-		if (!entity->active())
+		profiler_begin_frame(&profiler);
+		uint32_t processed;
+
 		{
-			continue;
+			std::lock_guard<std::mutex> lock(SERVER.net_mutex);
+			{
+				PROFILE_ZONE(&profiler, "net/process_packets");
+				processed = server_process_packets();
+				PROFILE_ZONE_END(profiler);
+			}
+
+			/* The measured time, a slow pass under the lock would otherwise put the timers behind */
+			float since_update = time_elapsed_seconds(last_update);
+			if (since_update >= NETWORK_UPDATE_SECONDS)
+			{
+				PROFILE_ZONE(&profiler, "net/network_update");
+				network_update(&SERVER.network, since_update);
+				last_update = time_now();
+				PROFILE_ZONE_END(profiler);
+			}
+
+			if (SERVER.reporting_load && time_elapsed_seconds(last_load_report) >= LOAD_REPORT_SECONDS)
+			{
+				send_load_report();
+				last_load_report = time_now();
+			}
+
+			publish_send_stats();
 		}
 
-		ClientConnection *client = get_client(i);
-		if (client)
+		if (time_elapsed_seconds(last_report) >= PROFILE_REPORT_SECONDS)
 		{
-			entity->last_processed_seq = client->last_processed;
+			profiler_print_report(&profiler);
+			profiler_reset_stats(&profiler);
+			last_report = time_now();
 		}
 
-		msg.payload.players[msg.payload.player_count++] = quantize(*entity);
+		if (processed == 0)
+		{
+			sleep_microseconds(THREAD_IDLE_SLEEP_US);
+		}
 	}
+}
 
-	msg.payload.shot_count = std::min((uint32_t)MAX_SHOTS, SERVER.new_shots.size());
-	for (uint8_t i = 0; i < msg.payload.shot_count; i++)
+/*
+ * Send thread
+ */
+void
+broadcast_kill_events()
+{
+	PlayerKilledEvent kill;
+	while (SERVER.kill_events.try_pop(kill))
+	{
+		SendPacket<PlayerKilledEvent> evt = {.payload = kill};
+		uint32_t					  peer_ids[MAX_PLAYERS + 1];
+
+		/* One copy of the kill for the whole server, each client's window only holds its header */
+		std::lock_guard<std::mutex> lock(SERVER.net_mutex);
+		uint32_t					peer_count = gather_active_peers(peer_ids);
+		network_broadcast_reliable(&SERVER.network, peer_ids, peer_count, evt, CHANNEL_EVENTS);
+	}
+}
+
+void
+drain_shot_events()
+{
+	Shot shot;
+	while (SERVER.shot_events.try_pop(shot))
 	{
-		msg.payload.shots[i] = quantize(SERVER.new_shots[i]);
+		SERVER.shot_stream.put(SERVER.next_shot_sequence++, shot);
 	}
+}
 
+/*
+ * Carries on through the shot stream from where this client's last snapshot stopped, skipping shots
+ * it doesn't need, until the snapshot is full. Whatever is left carries over to the next one.
+ * No viewer means nothing is culled, which is what the relay gets
+ */
+uint8_t
+write_client_shots(ShotCursor *cursor, uint32_t peer_id, Player *viewer, SnapshotMessage *msg)
+{
+	if (cursor->peer_id != peer_id)
+	{
+		cursor->peer_id = peer_id;
+		cursor->next_sequence = SERVER.next_shot_sequence;
+	}
+
+	/* So far behind the oldest shots have been overwritten */
+	if (SERVER.next_shot_sequence - cursor->next_sequence > SHOT_STREAM_SIZE)
+	{
+		cursor->next_sequence = SERVER.next_shot_sequence - SHOT_STREAM_SIZE;
+	}
+
+	QuantizedShot *shots = snapshot_shots(msg);
+	uint8_t		   count = 0;
+	msg->first_shot_sequence = cursor->next_sequence;
+
+	while (cursor->next_sequence != SERVER.next_shot_sequence && count < MAX_SNAPSHOT_SHOTS)
+	{
+		Shot *shot = SERVER.shot_stream.get(cursor->next_sequence++);
+		if (shot && (!viewer || shot_relevant_to(*shot, *viewer)))
+		{
+			shots[count++] = quantize(*shot);
+		}
+	}
+
+	msg->next_shot_sequence = cursor->next_sequence;
+	return count;
+}
+
+void
+broadcast_snapshot(SnapshotFrame *frame)
+{
+	drain_shot_events();
+
+	uint8_t			 packet[sizeof(PacketHeader) + SNAPSHOT_BUDGET];
+	SnapshotMessage *msg = (SnapshotMessage *)(packet + sizeof(PacketHeader));
+	msg->type = MSG_SERVER_SNAPSHOT;
+	msg->server_tick = frame->tick;
+	msg->player_count = 0;
+
+	QuantizedPlayer *players = snapshot_players(msg);
+	for (Player &entity : frame->players)
+	{
+		if (!entity.active())
+		{
+			continue;
+		}
+
+		players[msg->player_count++] = quantize(entity);
+	}
+
+	/* Players are encoded outside the lock, shots depend on the client so they're done per send */
+	std::lock_guard<std::mutex> lock(SERVER.net_mutex);
 	for (int8_t i = 0; i < MAX_PLAYERS; i++)
 	{
-		if (SERVER.clients[i].peer_id != 0)
+		uint32_t peer_id = SERVER.clients[i].peer_id;
+		if (peer_id == 0)
 		{
-			network_send_unreliable(&SERVER.network, SERVER.clients[i].peer_id, msg);
+			continue;
 		}
+
+		msg->shot_count = write_client_shots(&SERVER.shot_cursors[i], peer_id, &frame->players[i], msg);
+		uint16_t size = sizeof(PacketHeader) + snapshot_size(msg->player_count, msg->shot_count);
+		network_send_packet(&SERVER.network, peer_id, packet, size, false);
 	}
 
-	SERVER.new_shots.clear();
+	if (SERVER.relay_peer)
+	{
+		msg->shot_count = write_client_shots(&SERVER.relay_cursor, SERVER.relay_peer, nullptr, msg);
+		uint16_t size = sizeof(PacketHeader) + snapshot_size(msg->player_count, msg->shot_count);
+		network_send_packet(&SERVER.network, SERVER.relay_peer, packet, size, false);
+	}
+
+	publish_send_stats();
 }
+
 void
-server_loop()
+send_thread_func()
 {
 	Profiler profiler;
 	profiler_init(&profiler);
+	TimePoint last_report = time_now();
 
-	float update_accumulator = 0.0f;
-	float respawn_accumulator = 0.0f;
-	float snapshot_accumulator = 0.0f;
+	while (SERVER.running)
+	{
+		/* Kills first, they happened during ticks up to and including the frame about to go out */
+		broadcast_kill_events();
 
-	while (1)
+		uint8_t frame_idx;
+		if (!SERVER.ready_frames.try_pop(frame_idx))
+		{
+			sleep_microseconds(THREAD_IDLE_SLEEP_US);
+			continue;
+		}
+
+		profiler_begin_frame(&profiler);
+		{
+			PROFILE_ZONE(&profiler, "send/broadcast_snapshot");
+			broadcast_snapshot(&SERVER.tick_state->frames[frame_idx]);
+			PROFILE_ZONE_END(profiler);
+		}
+		SERVER.free_frames.try_push(frame_idx);
+
+		if (time_elapsed_seconds(last_report) >= PROFILE_REPORT_SECONDS)
+		{
+			profiler_print_report(&profiler);
+			profiler_reset_stats(&profiler);
+			last_report = time_now();
+		}
+	}
+}
+
+/*
+ * Sim thread, which is the thread run_server was called on
+ */
+
+/* Microseconds from 'since' to now, and moves 'since' on to now for the next phase */
+static uint32_t
+phase_us(TimePoint *since)
+{
+	TimePoint now = time_now();
+	uint32_t  us = (uint32_t)(time_delta_seconds(*since, now) * 1e6f);
+	*since = now;
+	return us;
+}
+
+static uint16_t
+telemetry_count(uint64_t total, uint64_t *last)
+{
+	uint64_t count = total - *last;
+	*last = total;
+	return (uint16_t)std::min<uint64_t>(count, UINT16_MAX);
+}
+
+/* Finishes this tick's record with what went through the network since the last one, and writes it */
+static void
+record_telemetry(uint32_t tick_us)
+{
+	TelemetryRecord *record = &SERVER.telemetry_record;
+	record->tick = SERVER.tick;
+	record->unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+						  std::chrono::system_clock::now().time_since_epoch())
+						  .count();
+	record->tick_us = tick_us;
+
+	uint64_t bytes_in = SERVER.network.rx_bytes.load(std::memory_order_relaxed);
+	uint64_t bytes_out = SERVER.sent_bytes.load(std::memory_order_relaxed);
+	record->bytes_in = (uint32_t)(bytes_in - SERVER.telemetry_bytes_in);
+	record->bytes_out = (uint32_t)(bytes_out - SERVER.telemetry_bytes_out);
+	SERVER.telemetry_bytes_in = bytes_in;
+	SERVER.telemetry_bytes_out = bytes_out;
+
+	record->packets_in =
+		telemetry_count(SERVER.network.rx_packets.load(std::memory_order_relaxed), &SERVER.telemetry_packets_in);
+	record->packets_out =
+		telemetry_count(SERVER.sent_packets.load(std::memory_order_relaxed), &SERVER.telemetry_packets_out);
+	record->retransmits =
+		telemetry_count(SERVER.sent_retransmits.load(std::memory_order_relaxed), &SERVER.telemetry_retransmits);
+	record->duplicates =
+		telemetry_count(SERVER.network.rx_duplicates.load(std::memory_order_relaxed), &SERVER.telemetry_duplicates);
+
+	telemetry_write(&SERVER.telemetry, *record);
+	*record = {};
+}
+
+void
+server_loop()
+{
+	Profiler profiler;
+	profiler_init(&profiler);
+
+	while (SERVER.running)
 	{
 		profiler_begin_frame(&profiler);
 		TimePoint frame_start = time_now();
-		SERVER.time += TICK_TIME;
+		SERVER.tick++;
 
+		if (SERVER.tick > 1)
 		{
-			PROFILE_ZONE(&profiler, "process_packets");
-			server_process_packets();
+			float	 late = time_delta_seconds(SERVER.last_tick_start, frame_start) - SERVER.tick_time;
+			uint32_t jitter_us = (uint32_t)((late < 0.0f ? -late : late) * 1e6f);
+			SERVER.telemetry_record.jitter_us = jitter_us;
+			SERVER.jitter_us_total += jitter_us;
+			SERVER.jitter_us_max = jitter_us > SERVER.jitter_us_max ? jitter_us : SERVER.jitter_us_max;
+			SERVER.jitter_samples++;
+		}
+		SERVER.last_tick_start = frame_start;
+		TelemetryRecord *record = &SERVER.telemetry_record;
+		TimePoint		 phase_start = frame_start;
+
+		{
+			PROFILE_ZONE(&profiler, "process_events");
+			process_sim_events();
 			PROFILE_ZONE_END(profiler);
 		}
+		record->events_us = phase_us(&phase_start);
 
 		{
 			PROFILE_ZONE(&profiler, "simulation_tick");
-			tick(TICK_TIME);
+			tick(SERVER.tick_time);
 			PROFILE_ZONE_END(profiler);
 		}
+		record->simulation_us = phase_us(&phase_start);
 
-		snapshot_accumulator += TICK_TIME;
-		if (snapshot_accumulator >= SNAPSHOT_TIME)
+		if (SERVER.tick % SERVER.snapshot_interval == 0)
 		{
-			PROFILE_ZONE(&profiler, "broadcast_snapshot");
-			broadcast_snapshot();
-			snapshot_accumulator = 0.0f;
+			PROFILE_ZONE(&profiler, "publish_snapshot");
+			publish_snapshot();
 			PROFILE_ZONE_END(profiler);
 		}
+		record->snapshot_us = phase_us(&phase_start);
+
+		update_respawns(SERVER.tick);
+		SERVER.current_tick.store(SERVER.tick, std::memory_order_relaxed);
 
-		update_accumulator += TICK_TIME;
-		if (update_accumulator >= NETWORK_UPDATE_INTERVAL)
+		if (SERVER.checkpoint_interval)
 		{
-			PROFILE_ZONE(&profiler, "network_update");
-			network_update(&SERVER.network, update_accumulator);
-			update_accumulator = 0.0f;
+			PROFILE_ZONE(&profiler, "checkpoint");
+			checkpoint_match();
 			PROFILE_ZONE_END(profiler);
 		}
+		record->checkpoint_us = phase_us(&phase_start);
 
-		respawn_accumulator += TICK_TIME;
-		if (respawn_accumulator >= RESPAWN_INTERVAL)
+		uint32_t tick_us = (uint32_t)(time_elapsed_seconds(frame_start) * 1e6f);
+		if (SERVER.telemetry.header)
 		{
-			update_respawns(SERVER.time);
-			respawn_accumulator = 0.0f;
+			record_telemetry(tick_us);
+		}
+		SERVER.tick_us_total += tick_us;
+		SERVER.tick_us_max = tick_us > SERVER.tick_us_max ? tick_us : SERVER.tick_us_max;
+		if (++SERVER.ticks_measured == SERVER.tick_rate)
+		{
+			SERVER.load_tick_us_avg.store(SERVER.tick_us_total / SERVER.ticks_measured, std::memory_order_relaxed);
+			SERVER.load_tick_us_max.store(SERVER.tick_us_max, std::memory_order_relaxed);
+			SERVER.tick_us_total = 0;
+			SERVER.tick_us_max = 0;
+			SERVER.ticks_measured = 0;
 		}
 
 		if (profiler.frame_count % 300 == 0)
 		{
 			profiler_print_report(&profiler);
 			profiler_reset_stats(&profiler);
+			if (SERVER.jitter_samples)
+			{
+				LOG("Tick jitter: %lluus avg, %uus max (%s)\n",
+					(unsigned long long)(SERVER.jitter_us_total / SERVER.jitter_samples), SERVER.jitter_us_max,
+					SERVER.placement);
+				SERVER.jitter_us_total = 0;
+				SERVER.jitter_us_max = 0;
+				SERVER.jitter_samples = 0;
+			}
+			if (SERVER.skipped_snapshots)
+			{
+				LOG("Skipped %u snapshots, send thread fell behind\n", SERVER.skipped_snapshots);
+				SERVER.skipped_snapshots = 0;
+			}
+			if (SERVER.dropped_shots)
+			{
+				LOG("Dropped %u shots, send thread fell behind\n", SERVER.dropped_shots);
+				SERVER.dropped_shots = 0;
+			}
+			if (SERVER.checkpoints_written || SERVER.checkpoints_skipped || SERVER.checkpoints_failed)
+			{
+				LOG("Checkpoints: %u written, %u skipped, %u failed, fork pause %uus max%s\n",
+					SERVER.checkpoints_written, SERVER.checkpoints_skipped, SERVER.checkpoints_failed,
+					SERVER.checkpoint_pause_us_max,
+					SERVER.checkpoint_pause_us_max > CHECKPOINT_PAUSE_BUDGET_US ? " (over budget)" : "");
+				SERVER.checkpoints_written = 0;
+				SERVER.checkpoints_skipped = 0;
+				SERVER.checkpoints_failed = 0;
+				SERVER.checkpoint_pause_us_max = 0;
+			}
 		}
 		float frame_time = time_elapsed_seconds(frame_start);
-		float sleep_time = TICK_TIME - frame_time;
+		float sleep_time = SERVER.tick_time - frame_time;
 		if (sleep_time > 0.001f)
 		{
 			sleep_seconds(sleep_time);
@@ -480,6 +1340,59 @@ server_loop()
 	}
 }
 
+/*
+ * Pins the calling thread (the tick thread) and places the server's memory, before any other thread
+ * exists so that they start out under the same memory policy
+ */
+static void
+place_tick_thread(const ServerConfig &config)
+{
+	int length = 0;
+	if (config.tick_cpu != THREAD_ANY_CPU && thread_pin_current(config.tick_cpu))
+	{
+		length += snprintf(SERVER.placement + length, sizeof(SERVER.placement) - length, "tick on cpu %d",
+						   config.tick_cpu);
+	}
+
+	/*
+	 * SERVER holds the queues and rings the threads share, and being static its pages don't exist
+	 * until something writes them. Touch them all now, from the pinned tick thread, so they land on
+	 * its node rather than on whichever thread gets there first. The tick state and the packet pool
+	 * are allocated after this, on this thread, which touches them as it does
+	 */
+	if (config.local_numa && memory_prefer_local_node())
+	{
+		memory_prefault(&SERVER, sizeof(SERVER));
+		length += snprintf(SERVER.placement + length, sizeof(SERVER.placement) - length, "%slocal numa",
+						   length ? ", " : "");
+	}
+
+	if (config.realtime && memory_lock_all())
+	{
+		length += snprintf(SERVER.placement + length, sizeof(SERVER.placement) - length, "%smemory locked",
+						   length ? ", " : "");
+	}
+
+	if (!length)
+	{
+		snprintf(SERVER.placement, sizeof(SERVER.placement), "unpinned");
+	}
+}
+
+ServerConfig
+server_default_config()
+{
+	ServerConfig config = {};
+	config.port = SERVER_PORT;
+	config.tick_rate = DEFAULT_TICK_RATE;
+	config.tick_cpu = THREAD_ANY_CPU;
+	config.receive_cpu = THREAD_ANY_CPU;
+	config.net_cpu = THREAD_ANY_CPU;
+	config.send_cpu = THREAD_ANY_CPU;
+	config.telemetry_hours = TELEMETRY_DEFAULT_HOURS;
+	return config;
+}
+
 bool
 add_unrecognised(sockaddr_in address)
 {
@@ -487,32 +1400,153 @@ add_unrecognised(sockaddr_in address)
 }
 
 void
-run_server()
+run_server(const ServerConfig &config)
 {
+	StartupTimer startup;
+	startup_begin(&startup);
+
+	uint16_t port = config.port;
+	uint16_t report_port = config.report_port;
+	SERVER.port = port;
+
+	/*
+	 * Snapshots go out at about SNAPSHOT_RATE whatever the tick rate, on the nearest whole number of
+	 * ticks. Everything else that's timed in ticks is converted once here
+	 */
+	SERVER.tick_rate = std::clamp(config.tick_rate, (uint16_t)MIN_TICK_RATE, (uint16_t)MAX_TICK_RATE);
+	SERVER.tick_time = 1.0f / SERVER.tick_rate;
+	SERVER.snapshot_interval = std::max<Tick>(1, (Tick)roundf(SERVER.tick_rate / SNAPSHOT_RATE));
+	SERVER.respawn_ticks = seconds_to_ticks(RESPAWN_TIME, SERVER.tick_rate);
+
+	if (config.checkpoint_seconds > 0.0f)
+	{
+#ifdef _WIN32
+		printf("Checkpoints need fork(), not available on Windows\n");
+#else
+		SERVER.checkpoint_interval = seconds_to_ticks(config.checkpoint_seconds, SERVER.tick_rate);
+		SERVER.checkpoint_interval = SERVER.checkpoint_interval ? SERVER.checkpoint_interval : 1;
+		snprintf(SERVER.checkpoint_path, sizeof(SERVER.checkpoint_path), "checkpoint_%u.bin", port);
+		snprintf(SERVER.checkpoint_temp_path, sizeof(SERVER.checkpoint_temp_path), "%s.tmp", SERVER.checkpoint_path);
+		printf("Checkpointing to %s every %.1fs\n", SERVER.checkpoint_path, config.checkpoint_seconds);
+#endif
+	}
+
+	place_tick_thread(config);
+	startup_phase(&startup, "thread placement");
+
+	/* Created here so the file's pages land with the rest of the tick thread's memory */
+	if (config.telemetry_hours > 0.0f)
+	{
+		char	 path[64];
+		char	 previous_path[64];
+		uint32_t capacity = (uint32_t)std::min(config.telemetry_hours * 3600.0f * SERVER.tick_rate, (float)UINT32_MAX);
+		snprintf(path, sizeof(path), "telemetry_%u.bin", port);
+		snprintf(previous_path, sizeof(previous_path), "telemetry_%u.prev.bin", port);
+
+		/*
+		 * The last run's recording is what's wanted after a crash and a restart, keep it aside rather
+		 * than truncating it. Only the one before, a second restart replaces it
+		 */
+		remove(previous_path);
+		if (rename(path, previous_path) == 0)
+		{
+			printf("Kept the last run's telemetry as %s\n", previous_path);
+		}
+		if (telemetry_create(&SERVER.telemetry, path, capacity ? capacity : 1, SERVER.tick_rate, port))
+		{
+			printf("Telemetry to %s, the last %.1f hours in %lluMB\n", path, config.telemetry_hours,
+				   (unsigned long long)(SERVER.telemetry.size >> 20));
+		}
+	}
+	startup_phase(&startup, "telemetry file");
+
+	large_pages_set_enabled(config.huge_pages);
+	if (!large_block_alloc(&SERVER.tick_block, sizeof(TickState)))
+	{
+		printf("Failed to allocate tick state\n");
+		return;
+	}
+	SERVER.tick_state = new (SERVER.tick_block.data) TickState();
 
 	for (int8_t i = 0; i < MAX_PLAYERS; i++)
 	{
 		Player p = {};
 		p.player_idx = -1;
-		SERVER.frame.players.push(p);
+		SERVER.tick_state->frame.players.push(p);
+		SERVER.inputs.push({});
+		SERVER.clients.push({});
 	}
 
-	if (!network_init(&SERVER.network, "0.0.0.0", SERVER_PORT))
+	SERVER.free_frames.try_push(0);
+	SERVER.free_frames.try_push(1);
+	startup_phase(&startup, "tick state");
+
+	if (!network_init(&SERVER.network, "0.0.0.0", port, route_client_input))
 	{
-		printf("Failed to initialize network on port %u\n", SERVER_PORT);
+		printf("Failed to initialize network on port %u\n", port);
 		return;
 	}
+	thread_pin(SERVER.network.recv_thread, config.receive_cpu);
+	startup_phase(&startup, "network");
+
+	printf("Tick state %zuKB in %s, packet pool %zuKB in %s\n", sizeof(TickState) / 1024,
+		   page_kind_name(SERVER.tick_block.kind), PACKET_POOL_SIZE * sizeof(PacketBuffer) / 1024,
+		   page_kind_name(SERVER.network.packet_block.kind));
+
+	if (report_port)
+	{
+		if (udp_create(&SERVER.load_socket, "127.0.0.1", 0) == 0)
+		{
+			SERVER.load_address = create_address("127.0.0.1", report_port);
+			SERVER.reporting_load = true;
+		}
+		else
+		{
+			printf("Failed to open load report socket, running unreported\n");
+		}
+	}
+
+	network_set_channel_mode(&SERVER.network, CHANNEL_CONTROL, DELIVERY_ORDERED);
 
 	SERVER.map = generate_map();
-	SERVER.start_time = time_now();
+	startup_phase(&startup, "map");
 
 	SERVER.network.on_peer_removed = remove_client;
 	SERVER.network.on_unrecognised = add_unrecognised;
 
-	printf("Started on port %u\n", SERVER_PORT);
+	printf("Started on port %u at %u ticks a second, a snapshot every %llu\n", port, SERVER.tick_rate,
+		   (unsigned long long)SERVER.snapshot_interval);
+
+	SERVER.running = true;
+	SERVER.net_thread = std::thread(network_thread_func);
+	SERVER.send_thread = std::thread(send_thread_func);
+	thread_pin(SERVER.net_thread, config.net_cpu);
+	thread_pin(SERVER.send_thread, config.send_cpu);
+
+	/* Last, threads started after it would inherit it */
+	if (config.realtime && thread_set_realtime_current(THREAD_REALTIME_PRIORITY))
+	{
+		size_t length = strlen(SERVER.placement);
+		snprintf(SERVER.placement + length, sizeof(SERVER.placement) - length, ", SCHED_FIFO %d",
+				 THREAD_REALTIME_PRIORITY);
+	}
+	startup_phase(&startup, "threads");
+	startup_milestone(&startup, "listening");
+	startup_print_report(&startup, 1, "server");
+
+	/* Measuring only, shut straight down */
+	if (!config.measure_startup)
+	{
+		server_loop();
+	}
 
-	server_loop();
+	SERVER.running = false;
+	SERVER.net_thread.join();
+	SERVER.send_thread.join();
 
 	network_shutdown(&SERVER.network);
+	udp_close(&SERVER.load_socket);
+	large_block_free(&SERVER.tick_block);
+	telemetry_close(&SERVER.telemetry);
 	printf("Shutdown complete\n");
 }
@@ -1 +1,28 @@
-void run_server();
+#pragma once
+#include <cstdint>
+
+struct ServerConfig
+{
+	uint16_t port;
+	uint16_t tick_rate;			 /* MIN_TICK_RATE..MAX_TICK_RATE */
+	uint16_t report_port;		 /* where to send load reports, 0 when nobody is listening (see matchmaker.cpp) */
+	float	 checkpoint_seconds; /* 0 = no checkpoints (see checkpoint.hpp) */
+	float	 telemetry_hours;	 /* how much the flight recorder keeps, 0 = off (see telemetry.hpp) */
+
+	/* Thread placement, THREAD_ANY_CPU leaves a thread to the OS (see threads.hpp) */
+	int16_t tick_cpu;
+	int16_t receive_cpu;
+	int16_t net_cpu;
+	int16_t send_cpu;
+	bool	realtime;	/* SCHED_FIFO for the tick thread, with all memory locked */
+	bool	local_numa; /* the server's pools on the tick thread's NUMA node */
+	bool	huge_pages; /* the tick state and packet pool in 2MB pages (see large_pages.hpp) */
+
+	bool measure_startup; /* print how long it took to start listening, then exit (see startup.hpp) */
+};
+
+ServerConfig
+server_default_config();
+
+void
+run_server(const ServerConfig &config);
@@ -5,6 +5,9 @@
 #include "game_types.hpp"
 #include "map.hpp"
 
+#define SHOT_RELEVANCE_DISTANCE 40.0f /* half the map */
+#define SHOT_NEAR_DISTANCE		10.0f
+
 inline Shot
 create_shot(Player *shooter)
 {
@@ -21,6 +24,36 @@ create_shot(Player *shooter)
 	return shot;
 }
 
+/*
+ * Shot trails are only visuals, so a client doesn't need shots nowhere near it or entirely behind it.
+ * Its own shots and anything passing close by are always kept
+ */
+inline bool
+shot_relevant_to(Shot &shot, Player &viewer)
+{
+	if (!viewer.active() || shot.shooter_idx == viewer.player_idx)
+	{
+		return true;
+	}
+
+	glm::vec3 eye = viewer.position + glm::vec3(0, PLAYER_EYE_HEIGHT, 0);
+	float	  along = glm::clamp(glm::dot(eye - shot.ray.origin, shot.ray.direction), 0.0f, shot.ray.length);
+	float	  distance = glm::length(eye - (shot.ray.origin + shot.ray.direction * along));
+
+	if (distance > SHOT_RELEVANCE_DISTANCE)
+	{
+		return false;
+	}
+	if (distance <= SHOT_NEAR_DISTANCE)
+	{
+		return true;
+	}
+
+	glm::vec3 forward(cos(viewer.yaw), 0, sin(viewer.yaw));
+	glm::vec3 end = shot.ray.origin + shot.ray.direction * shot.ray.length;
+	return glm::dot(shot.ray.origin - eye, forward) > 0 || glm::dot(end - eye, forward) > 0;
+}
+
 inline bool
 trace_shot(Shot &shot, Map &map, fixed_array<Player, MAX_PLAYERS> &players, int8_t *hit_player_idx,
 		   glm::vec3 *hit_point)
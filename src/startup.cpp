@@ -0,0 +1,94 @@
+#include "startup.hpp"
+#include "log.hpp"
+
+static void
+add_mark(StartupTimer *t, const char *name, bool milestone)
+{
+	TimePoint now = time_now();
+	if (t->phase_count < STARTUP_MAX_PHASES)
+	{
+		StartupPhase *phase = &t->phases[t->phase_count++];
+		phase->name = name;
+		phase->ms = time_delta_seconds(milestone ? t->start : t->last, now) * 1000.0f;
+		phase->milestone = milestone;
+	}
+	if (!milestone)
+	{
+		t->last = now;
+	}
+}
+
+void
+startup_begin(StartupTimer *t)
+{
+	*t = {};
+	t->start = time_now();
+	t->last = t->start;
+}
+
+void
+startup_phase(StartupTimer *t, const char *name)
+{
+	add_mark(t, name, false);
+}
+
+void
+startup_milestone(StartupTimer *t, const char *name)
+{
+	add_mark(t, name, true);
+}
+
+float
+startup_elapsed_ms(const StartupTimer *t)
+{
+	return time_elapsed_seconds(t->start) * 1000.0f;
+}
+
+void
+startup_print_report(const StartupTimer *timers, uint32_t count, const char *what)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	LOG("\n========== STARTUP (%s, %u measured) ==========\n", what, count);
+	LOG("%-30s %8s %8s\n", "Phase", "Avg", "Max");
+	LOG("------------------------------------------------\n");
+
+	/* Phases line up by position, one that stopped early (an NPC that never connected) counts for fewer */
+	const StartupTimer *longest = &timers[0];
+	for (uint32_t t = 1; t < count; t++)
+	{
+		longest = timers[t].phase_count > longest->phase_count ? &timers[t] : longest;
+	}
+
+	for (uint32_t i = 0; i < longest->phase_count; i++)
+	{
+		float	 sum = 0.0f;
+		float	 max = 0.0f;
+		uint32_t samples = 0;
+		for (uint32_t t = 0; t < count; t++)
+		{
+			if (i < timers[t].phase_count)
+			{
+				float ms = timers[t].phases[i].ms;
+				sum += ms;
+				max = ms > max ? ms : max;
+				samples++;
+			}
+		}
+
+		const StartupPhase &phase = longest->phases[i];
+		if (phase.milestone)
+		{
+			LOG("-> %-27s %7.2fms %7.2fms\n", phase.name, sum / samples, max);
+		}
+		else
+		{
+			LOG("%-30s %7.2fms %7.2fms\n", phase.name, sum / samples, max);
+		}
+	}
+
+	LOG("================================================\n\n");
+}
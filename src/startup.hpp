@@ -0,0 +1,53 @@
+#pragma once
+/*
+ * Startup phase timing
+ *
+ * Where the time goes between a process starting and it doing its job: the server listening, a client
+ * connected and its first frame shown, an NPC connected. Each phase is marked when it ends and takes
+ * the time since the previous mark. Milestones are marked the same way but keep the time since the
+ * start. It's a clock read per mark, so it's always on and every start prints its report.
+ * With --measure-startup the process exits after the report instead of running on, so startups can
+ * be timed in a loop.
+ *
+ * A StartupTimer belongs to one thread, NPCs have one each and their reports are combined.
+ */
+
+#include "time.hpp"
+#include <cstdint>
+
+#define STARTUP_MAX_PHASES 16
+
+struct StartupPhase
+{
+	const char *name; /* a literal, only the pointer is kept */
+	float		ms;
+	bool		milestone; /* ms is since the start rather than since the last mark */
+};
+
+struct StartupTimer
+{
+	TimePoint	 start;
+	TimePoint	 last;
+	StartupPhase phases[STARTUP_MAX_PHASES];
+	uint32_t	 phase_count;
+};
+
+void
+startup_begin(StartupTimer *t);
+
+/* Ends the phase that's been running since the last mark, past STARTUP_MAX_PHASES they're dropped */
+void
+startup_phase(StartupTimer *t, const char *name);
+
+void
+startup_milestone(StartupTimer *t, const char *name);
+
+float
+startup_elapsed_ms(const StartupTimer *t);
+
+/*
+ * Prints the phases and milestones. Given several timers (one per NPC) that marked the same phases,
+ * prints the average and worst of each
+ */
+void
+startup_print_report(const StartupTimer *timers, uint32_t count, const char *what);
@@ -0,0 +1,177 @@
+#include "telemetry.hpp"
+#include <cinttypes>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TELEMETRY_MAGIC "CODT"
+
+static bool
+map_file(TelemetryFile *t, const char *path, uint64_t create_size)
+{
+	bool create = create_size != 0;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, create ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+							  FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)create_size;
+	HANDLE mapping = nullptr;
+	if ((!create && (!GetFileSizeEx(file, &size) || size.QuadPart == 0)) ||
+		!(mapping = CreateFileMappingA(file, nullptr, create ? PAGE_READWRITE : PAGE_READONLY, size.HighPart,
+									   size.LowPart, nullptr)))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void *data = MapViewOfFile(mapping, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	t->size = (uint64_t)size.QuadPart;
+	t->file_handle = file;
+	t->mapping = mapping;
+#else
+	int fd = create ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (create ? ftruncate(fd, create_size) != 0 : (fstat(fd, &info) != 0 || info.st_size == 0))
+	{
+		close(fd);
+		return false;
+	}
+	uint64_t size = create ? create_size : (uint64_t)info.st_size;
+
+	void *data = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+	t->size = size;
+	t->fd = fd;
+#endif
+
+	t->header = (TelemetryHeader *)data;
+	t->records = (TelemetryRecord *)((uint8_t *)data + sizeof(TelemetryHeader));
+	t->writable = create;
+	return true;
+}
+
+bool
+telemetry_create(TelemetryFile *t, const char *path, uint32_t capacity, uint16_t tick_rate, uint16_t port)
+{
+	*t = {};
+	if (!map_file(t, path, sizeof(TelemetryHeader) + (uint64_t)capacity * sizeof(TelemetryRecord)))
+	{
+		printf("Failed to create telemetry file %s\n", path);
+		return false;
+	}
+
+	TelemetryHeader *header = new (t->header) TelemetryHeader();
+	memcpy(header->magic, TELEMETRY_MAGIC, 4);
+	header->version = TELEMETRY_VERSION;
+	header->record_size = sizeof(TelemetryRecord);
+	header->capacity = capacity;
+	header->tick_rate = tick_rate;
+	header->port = port;
+	header->written.store(0, std::memory_order_release);
+	return true;
+}
+
+bool
+telemetry_open(TelemetryFile *t, const char *path)
+{
+	*t = {};
+	if (!map_file(t, path, 0))
+	{
+		printf("Failed to open telemetry file %s\n", path);
+		return false;
+	}
+
+	TelemetryHeader *header = t->header;
+	if (t->size < sizeof(TelemetryHeader) || memcmp(header->magic, TELEMETRY_MAGIC, 4) != 0 ||
+		header->version != TELEMETRY_VERSION || header->record_size != sizeof(TelemetryRecord) ||
+		header->capacity == 0 || t->size < sizeof(TelemetryHeader) + (uint64_t)header->capacity * sizeof(TelemetryRecord))
+	{
+		printf("%s is not a telemetry file, or a different version\n", path);
+		telemetry_close(t);
+		return false;
+	}
+	return true;
+}
+
+void
+telemetry_close(TelemetryFile *t)
+{
+	if (!t->header)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(t->header);
+	CloseHandle(t->mapping);
+	CloseHandle(t->file_handle);
+#else
+	munmap(t->header, t->size);
+	close(t->fd);
+#endif
+	*t = {};
+}
+
+uint64_t
+telemetry_export_csv(TelemetryFile *t, uint64_t first_tick, uint64_t last_tick, FILE *out)
+{
+	uint64_t written = t->header->written.load(std::memory_order_acquire);
+	uint32_t capacity = t->header->capacity;
+	uint64_t oldest = written > capacity ? written - capacity : 0;
+
+	fprintf(out, "tick,unix_ms,tick_us,jitter_us,events_us,simulation_us,snapshot_us,checkpoint_us,bytes_in,"
+				 "bytes_out,packets_in,packets_out,retransmits,duplicates,inputs,stale_inputs,players,"
+				 "snapshot_skipped,shots_dropped,checkpoint\n");
+
+	uint64_t exported = 0;
+	for (uint64_t i = oldest; i < written; i++)
+	{
+		/* Copied out first, a live server may be overwriting the oldest while we read */
+		TelemetryRecord r = t->records[i % capacity];
+		if (r.tick < first_tick || r.tick > last_tick)
+		{
+			continue;
+		}
+
+		fprintf(out,
+				"%" PRIu64 ",%" PRId64 ",%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%d,%d,%d\n",
+				r.tick, r.unix_ms, r.tick_us, r.jitter_us, r.events_us, r.simulation_us, r.snapshot_us,
+				r.checkpoint_us, r.bytes_in, r.bytes_out, r.packets_in, r.packets_out, r.retransmits, r.duplicates,
+				r.inputs, r.stale_inputs, r.player_count, (r.flags & TELEMETRY_SNAPSHOT_SKIPPED) != 0,
+				(r.flags & TELEMETRY_SHOTS_DROPPED) != 0, (r.flags & TELEMETRY_CHECKPOINT) != 0);
+		exported++;
+	}
+	return exported;
+}
@@ -0,0 +1,109 @@
+#pragma once
+/*
+ * Telemetry flight recorder
+ *
+ * One fixed size record per tick, what the tick cost and what went through the network, written into a
+ * file mapped ring. Writing one is a memcpy into memory that's already mapped, there's no system call
+ * and nothing to format, so it's always on. The kernel writes the pages back in its own time, and they
+ * survive the server crashing, so after a lag spike the ticks around it are still there to look at,
+ * hours later, with 'COD telemetry <file>' turning a range of them into CSV.
+ *
+ * File layout:
+ *   TelemetryHeader		   one cache line
+ *   TelemetryRecord[capacity] record i holds the i'th tick written modulo capacity
+ *
+ * Once full, each record overwrites the oldest, so the file always holds the last 'capacity' ticks.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#define TELEMETRY_VERSION		1
+#define TELEMETRY_DEFAULT_HOURS 1.0f /* 14MB at 60Hz */
+
+/* Flags */
+#define TELEMETRY_SNAPSHOT_SKIPPED 0x01 /* the send thread was still busy with the last one */
+#define TELEMETRY_SHOTS_DROPPED	   0x02
+#define TELEMETRY_CHECKPOINT	   0x04 /* forked a checkpoint this tick, see checkpoint_us */
+
+struct alignas(64) TelemetryHeader
+{
+	char				  magic[4];
+	uint16_t			  version;
+	uint16_t			  record_size;
+	uint32_t			  capacity;
+	uint16_t			  tick_rate;
+	uint16_t			  port;
+	std::atomic<uint64_t> written; /* records ever written, the newest is at (written - 1) % capacity */
+};
+
+/* Counts are for this tick only, times in microseconds */
+struct alignas(64) TelemetryRecord
+{
+	uint64_t tick;
+	int64_t	 unix_ms; /* wall clock, to find the tick someone reported lag at */
+
+	uint32_t tick_us;
+	uint32_t jitter_us; /* how far from on time the tick started */
+	uint32_t events_us;
+	uint32_t simulation_us;
+	uint32_t snapshot_us;
+	uint32_t checkpoint_us;
+
+	uint32_t bytes_in;
+	uint32_t bytes_out;
+	uint16_t packets_in;
+	uint16_t packets_out;
+	uint16_t retransmits;
+	uint16_t duplicates;
+
+	uint16_t inputs;	   /* applied */
+	uint16_t stale_inputs; /* arrived after a later one, each is a correction on that client */
+	uint8_t	 player_count;
+	uint8_t	 flags;
+};
+
+static_assert(sizeof(TelemetryHeader) == 64, "TelemetryHeader should be one cache line");
+static_assert(sizeof(TelemetryRecord) == 64, "TelemetryRecord should be one cache line");
+
+struct TelemetryFile
+{
+	TelemetryHeader *header;
+	TelemetryRecord *records;
+	uint64_t		 size;
+	bool			 writable;
+
+#ifdef _WIN32
+	void *file_handle;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+/* Creates or replaces 'path', sized for 'capacity' records */
+bool
+telemetry_create(TelemetryFile *t, const char *path, uint32_t capacity, uint16_t tick_rate, uint16_t port);
+
+inline void
+telemetry_write(TelemetryFile *t, const TelemetryRecord &record)
+{
+	uint64_t written = t->header->written.load(std::memory_order_relaxed);
+	t->records[written % t->header->capacity] = record;
+	t->header->written.store(written + 1, std::memory_order_release);
+}
+
+/* Read only, a server can still be writing it */
+bool
+telemetry_open(TelemetryFile *t, const char *path);
+
+void
+telemetry_close(TelemetryFile *t);
+
+/*
+ * Writes the records for ticks first to last that are still in the ring as CSV, oldest first, returns how
+ * many. 0 and UINT64_MAX for everything
+ */
+uint64_t
+telemetry_export_csv(TelemetryFile *t, uint64_t first_tick, uint64_t last_tick, FILE *out);
@@ -0,0 +1,182 @@
+#include "threads.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4 /* numaif.h has it, but that's libnuma's, the syscall is all we need */
+#endif
+#endif
+
+#define PREFAULT_STRIDE 4096
+
+static bool
+pin(std::thread::native_handle_type handle, int cpu)
+{
+	if (cpu < 0)
+	{
+		return true;
+	}
+
+#if defined(_WIN32)
+	if (cpu >= 64 || !SetThreadAffinityMask((HANDLE)handle, 1ull << cpu))
+	{
+		printf("Failed to pin thread to cpu %d\n", cpu);
+		return false;
+	}
+	return true;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int error = pthread_setaffinity_np(handle, sizeof(set), &set);
+	if (error != 0)
+	{
+		printf("Failed to pin thread to cpu %d: %s\n", cpu, strerror(error));
+		return false;
+	}
+	return true;
+#else
+	printf("Pinning threads isn't supported on this platform\n");
+	return false;
+#endif
+}
+
+bool
+thread_pin(std::thread &thread, int cpu)
+{
+	return pin(thread.native_handle(), cpu);
+}
+
+bool
+thread_pin_current(int cpu)
+{
+#ifdef _WIN32
+	return pin(GetCurrentThread(), cpu);
+#else
+	return pin(pthread_self(), cpu);
+#endif
+}
+
+bool
+thread_set_realtime_current(int priority)
+{
+#ifdef _WIN32
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+	{
+		printf("Failed to raise thread priority\n");
+		return false;
+	}
+	return true;
+#else
+	sched_param param = {};
+	param.sched_priority = priority;
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error != 0)
+	{
+		/* Needs root or CAP_SYS_NICE, or an rtprio limit in limits.conf */
+		printf("Failed to set SCHED_FIFO priority %d: %s\n", priority, strerror(error));
+		return false;
+	}
+	return true;
+#endif
+}
+
+bool
+memory_lock_all()
+{
+#ifdef _WIN32
+	printf("Locking all memory isn't supported on Windows\n");
+	return false;
+#else
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		/* Needs CAP_IPC_LOCK or a memlock limit above the process size, see ulimit -l */
+		printf("Failed to lock memory: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+#endif
+}
+
+bool
+memory_prefer_local_node()
+{
+#if defined(__linux__)
+	if (syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0)
+	{
+		printf("Failed to set local NUMA policy: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	/* Windows already allocates on the node of the thread's ideal processor */
+	return true;
+#endif
+}
+
+void
+memory_prefault(void *data, size_t size)
+{
+	/* Writing back what's there is harmless, and a read alone would only map the shared zero page */
+	volatile uint8_t *bytes = (volatile uint8_t *)data;
+	for (size_t i = 0; i < size; i += PREFAULT_STRIDE)
+	{
+		bytes[i] = bytes[i];
+	}
+}
+
+uint32_t
+parse_cpu_list(const char *list, int16_t *cpus, uint32_t max_cpus)
+{
+	uint32_t count = 0;
+	while (*list)
+	{
+		char *end;
+		long  first = strtol(list, &end, 10);
+		long  last = first;
+		if (end == list || first < 0)
+		{
+			return 0;
+		}
+		if (*end == '-')
+		{
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list || last < first)
+			{
+				return 0;
+			}
+		}
+
+		for (long cpu = first; cpu <= last && count < max_cpus; cpu++)
+		{
+			cpus[count++] = (int16_t)cpu;
+		}
+
+		if (*end == ',')
+		{
+			end++;
+		}
+		else if (*end)
+		{
+			return 0;
+		}
+		list = end;
+	}
+	return count;
+}
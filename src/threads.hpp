@@ -0,0 +1,52 @@
+#pragma once
+/*
+ * Thread placement
+ *
+ * Left alone, the OS moves threads between cores as it sees fit and lets anything else on the machine
+ * preempt them. For the tick thread that shows up as ticks that start late: a migration costs the
+ * caches it had warmed, and a preemption costs however long the other thing runs. Pinning each thread
+ * to its own core avoids the first, a real-time priority the second.
+ *
+ * Memory goes on the NUMA node of the thread that first writes to it, so pools are touched by the
+ * thread that will use them once it's pinned, rather than wherever the process happened to start.
+ *
+ * Everything here is best effort, failures are reported and the caller carries on unpinned.
+ * Linux has all of it, Windows has affinity and priority, macOS has none.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#define THREAD_ANY_CPU			  -1
+#define THREAD_REALTIME_PRIORITY 50 /* SCHED_FIFO, 1-99, above the kernel's default for threaded irqs */
+
+bool
+thread_pin(std::thread &thread, int cpu);
+
+bool
+thread_pin_current(int cpu);
+
+/*
+ * SCHED_FIFO, so the thread runs until it blocks or something of a higher priority wants the core.
+ * Only for threads that sleep every iteration, a spinning one would have the core to itself.
+ * Threads created afterwards inherit it, so call it after starting the others
+ */
+bool
+thread_set_realtime_current(int priority);
+
+/* Keeps every page, current and future, in RAM, so a tick never waits on a page fault */
+bool
+memory_lock_all();
+
+/* Later allocations by the calling thread go on its own NUMA node, even when that node is short */
+bool
+memory_prefer_local_node();
+
+/* Writes each page so it's allocated now, on the calling thread's node, instead of on first use */
+void
+memory_prefault(void *data, size_t size);
+
+/* Parses "2,3,5-7" into cpus, returns how many, 0 on a malformed list */
+uint32_t
+parse_cpu_list(const char *list, int16_t *cpus, uint32_t max_cpus);
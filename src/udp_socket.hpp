@@ -19,6 +19,8 @@ typedef SOCKET SocketHandle;
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 typedef int SocketHandle;
 #define INVALID_SOCKET_HANDLE -1
@@ -26,12 +28,14 @@ typedef int SocketHandle;
 #endif
 
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 
 struct UdpSocket
 {
 	SocketHandle sock_fd = INVALID_SOCKET_HANDLE;
 	sockaddr_in	 bound_address;
+	uint32_t	 loss_percent = 0; /* simulated link loss on send, for testing */
 };
 
 inline sockaddr_in
@@ -107,18 +111,46 @@ udp_create(UdpSocket *sock, const char *ip, uint16_t port, uint32_t timeout_ms =
 inline int
 udp_send(UdpSocket *socket, const void *data, size_t size, const sockaddr_in *dest)
 {
-
-// #define TEST_PACKET_LOSS
-#ifdef TEST_PACKET_LOSS
-	if ((rand() % 100) < 5)
+	/* Pretend the packet went out, the same as it being lost on the way */
+	if (socket->loss_percent && (uint32_t)(rand() % 100) < socket->loss_percent)
 	{
-		return size;
+		return (int)size;
 	}
-#endif
 
 	return sendto(socket->sock_fd, (const char *)data, (int)size, 0, (struct sockaddr *)dest, sizeof(*dest));
 }
 
+/*
+ * Sends 'head' followed by 'body' as one datagram, without copying them together first
+ */
+inline int
+udp_send_gather(UdpSocket *socket, const void *head, size_t head_size, const void *body, size_t body_size,
+				const sockaddr_in *dest)
+{
+	if (socket->loss_percent && (uint32_t)(rand() % 100) < socket->loss_percent)
+	{
+		return (int)(head_size + body_size);
+	}
+
+#ifdef _WIN32
+	WSABUF buffers[2] = {{(ULONG)head_size, (CHAR *)head}, {(ULONG)body_size, (CHAR *)body}};
+	DWORD  sent = 0;
+	if (WSASendTo(socket->sock_fd, buffers, 2, &sent, 0, (const sockaddr *)dest, sizeof(*dest), nullptr, nullptr) != 0)
+	{
+		return -1;
+	}
+	return (int)sent;
+#else
+	iovec  buffers[2] = {{(void *)head, head_size}, {(void *)body, body_size}};
+	msghdr msg = {};
+	msg.msg_name = (void *)dest;
+	msg.msg_namelen = sizeof(*dest);
+	msg.msg_iov = buffers;
+	msg.msg_iovlen = 2;
+	return (int)sendmsg(socket->sock_fd, &msg, 0);
+#endif
+}
+
 inline int
 udp_receive(UdpSocket *socket, void *buffer, size_t buffer_size, sockaddr_in *sender)
 {
@@ -6,6 +6,17 @@
 #include <cstring>
 #include <stdio.h>
 
+static void
+note_change(Window *w)
+{
+	if (w->change_time == 0.0)
+	{
+		w->change_time = glfwGetTime();
+		w->press_mouse_dx = w->mouse_dx;
+		w->press_mouse_dy = w->mouse_dy;
+	}
+}
+
 static void
 key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
@@ -19,11 +30,13 @@ key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 	{
 		w->keys.set(key);
 		w->keys_pressed.set(key);
+		note_change(w);
 	}
 	else if (action == GLFW_RELEASE)
 	{
 		w->keys.reset(key);
 		w->keys_released.set(key);
+		note_change(w);
 	}
 }
 
@@ -40,11 +53,13 @@ mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 	{
 		w->mouse_buttons |= (1 << button);
 		w->mouse_buttons_pressed |= (1 << button);
+		note_change(w);
 	}
 	else if (action == GLFW_RELEASE)
 	{
 		w->mouse_buttons &= ~(1 << button);
 		w->mouse_buttons_released |= (1 << button);
+		note_change(w);
 	}
 }
 
@@ -67,8 +82,9 @@ cursor_position_callback(GLFWwindow *window, double xpos, double ypos)
 		w->first_mouse = false;
 	}
 
-	w->mouse_dx = (x - w->last_mouse_x) * w->mouse_sensitivity;
-	w->mouse_dy = (y - w->last_mouse_y) * w->mouse_sensitivity;
+	/* Added up, there can be several moves a frame when events are handled as they come */
+	w->mouse_dx += (x - w->last_mouse_x) * w->mouse_sensitivity;
+	w->mouse_dy += (y - w->last_mouse_y) * w->mouse_sensitivity;
 
 	w->last_mouse_x = x;
 	w->last_mouse_y = y;
@@ -200,6 +216,17 @@ window_poll_events(Window *w)
 	glfwPollEvents();
 }
 
+void
+window_wait_events(Window *w, float seconds)
+{
+	/* Returns on each event, so wait again for whatever's left */
+	double until = glfwGetTime() + seconds;
+	for (double now = glfwGetTime(); now < until; now = glfwGetTime())
+	{
+		glfwWaitEventsTimeout(until - now);
+	}
+}
+
 void
 window_swap_buffers(Window *w)
 {
@@ -218,6 +245,11 @@ window_begin_frame(Window *w)
 	w->mouse_dy = 0.0f;
 	w->scroll_x = 0.0f;
 	w->scroll_y = 0.0f;
+
+	w->frame_begin_time = glfwGetTime();
+	w->change_time = 0.0;
+	w->press_mouse_dx = 0.0f;
+	w->press_mouse_dy = 0.0f;
 }
 
 uint32_t
@@ -375,3 +407,28 @@ window_set_position(Window *w, int x, int y)
 	}
 	glfwSetWindowPos(w->handle, x, y);
 }
+
+float
+window_change_fraction(Window *w)
+{
+	double span = glfwGetTime() - w->frame_begin_time;
+	if (w->change_time == 0.0 || span <= 0.0)
+	{
+		return 0.0f;
+	}
+	float fraction = (float)((w->change_time - w->frame_begin_time) / span);
+	return fraction < 0.0f ? 0.0f : (fraction > 1.0f ? 1.0f : fraction);
+}
+
+void
+window_get_press_mouse_delta(Window *w, float *dx, float *dy)
+{
+	if (dx)
+	{
+		*dx = w->press_mouse_dx;
+	}
+	if (dy)
+	{
+		*dy = w->press_mouse_dy;
+	}
+}
@@ -40,6 +40,15 @@ struct Window
 
 	bool  cursor_locked;
 	float mouse_sensitivity;
+
+	/*
+	 * When in the frame input changed, for sub-tick timing. glfwGetTime of the frame's start, of the
+	 * first press or release since (0 = none), and how far the mouse had moved by then
+	 */
+	double frame_begin_time;
+	double change_time;
+	float  press_mouse_dx;
+	float  press_mouse_dy;
 };
 
 bool
@@ -50,6 +59,13 @@ bool
 window_should_close(Window *w);
 void
 window_poll_events(Window *w);
+
+/*
+ * Sleeps for 'seconds' but handles events as they come, rather than all at once on the next poll,
+ * so they're timestamped when they arrived
+ */
+void
+window_wait_events(Window *w, float seconds);
 void
 window_swap_buffers(Window *w);
 
@@ -83,6 +99,12 @@ window_get_mouse_delta(Window *w, float *dx, float *dy);
 void
 window_get_scroll(Window *w, float *x, float *y);
 
+/* How far between the frame's start and now the first press or release came in, 0-1, 0 if none did */
+float
+window_change_fraction(Window *w);
+void
+window_get_press_mouse_delta(Window *w, float *dx, float *dy);
+
 void
 window_set_cursor_lock(Window *w, bool locked);
 void
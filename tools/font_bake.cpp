@@ -0,0 +1,132 @@
+/*
+ * Font atlas baker
+ *
+ * Rasterizes the first 128 characters of a TTF with FreeType, the same way the client's fallback does,
+ * and packs them into one atlas image with their metrics (see src/font_atlas.hpp). The client loads
+ * the result without FreeType.
+ *
+ *   cod_font_bake <font.ttf> <out.atlas> [pixel_size]
+ *
+ * Glyphs go on shelves left to right in character order, with a pixel of space around each so linear
+ * filtering never picks up a neighbour.
+ */
+
+#include "../src/font_atlas.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#define ATLAS_WIDTH		   512
+#define GLYPH_PADDING	   1
+#define DEFAULT_PIXEL_SIZE 48 /* what text_renderer_init used to render at */
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		printf("Usage: cod_font_bake <font.ttf> <out.atlas> [pixel_size]\n");
+		return 1;
+	}
+	int pixel_size = argc > 3 ? atoi(argv[3]) : DEFAULT_PIXEL_SIZE;
+	if (pixel_size <= 0 || pixel_size > 256)
+	{
+		printf("Pixel size should be 1 to 256\n");
+		return 1;
+	}
+
+	FT_Library ft;
+	FT_Face	   face;
+	if (FT_Init_FreeType(&ft))
+	{
+		printf("Could not initialize FreeType Library\n");
+		return 1;
+	}
+	if (FT_New_Face(ft, argv[1], 0, &face))
+	{
+		printf("Failed to load font from %s\n", argv[1]);
+		FT_Done_FreeType(ft);
+		return 1;
+	}
+	FT_Set_Pixel_Sizes(face, 0, pixel_size);
+
+	/* Render everything first, the atlas height isn't known until it's packed */
+	FontAtlasGlyph		 glyphs[FONT_ATLAS_GLYPHS] = {};
+	std::vector<uint8_t> bitmaps[FONT_ATLAS_GLYPHS];
+	uint32_t			 shelf_x = GLYPH_PADDING;
+	uint32_t			 shelf_y = GLYPH_PADDING;
+	uint32_t			 shelf_height = 0;
+
+	for (uint32_t c = 0; c < FONT_ATLAS_GLYPHS; c++)
+	{
+		if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+		{
+			printf("Failed to load Glyph %u\n", c);
+			continue;
+		}
+
+		FT_GlyphSlot	slot = face->glyph;
+		FontAtlasGlyph *glyph = &glyphs[c];
+		glyph->width = slot->bitmap.width;
+		glyph->height = slot->bitmap.rows;
+		glyph->bearing_x = slot->bitmap_left;
+		glyph->bearing_y = slot->bitmap_top;
+		glyph->advance = slot->advance.x;
+
+		if (glyph->width + 2 * GLYPH_PADDING > ATLAS_WIDTH)
+		{
+			printf("Glyph %u is wider than the atlas, use a smaller pixel size\n", c);
+			FT_Done_Face(face);
+			FT_Done_FreeType(ft);
+			return 1;
+		}
+
+		if (shelf_x + glyph->width + GLYPH_PADDING > ATLAS_WIDTH)
+		{
+			shelf_x = GLYPH_PADDING;
+			shelf_y += shelf_height + GLYPH_PADDING;
+			shelf_height = 0;
+		}
+		glyph->x = shelf_x;
+		glyph->y = shelf_y;
+		shelf_x += glyph->width + GLYPH_PADDING;
+		shelf_height = glyph->height > shelf_height ? glyph->height : shelf_height;
+
+		/* The bitmap's pitch can be wider than the glyph, keep just the glyph's rows */
+		bitmaps[c].resize((size_t)glyph->width * glyph->height);
+		for (uint32_t row = 0; row < glyph->height; row++)
+		{
+			memcpy(&bitmaps[c][(size_t)row * glyph->width], slot->bitmap.buffer + (size_t)row * slot->bitmap.pitch,
+				   glyph->width);
+		}
+	}
+
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+
+	FontAtlasHeader header = {};
+	header.pixel_size = pixel_size;
+	header.width = ATLAS_WIDTH;
+	header.height = shelf_y + shelf_height + GLYPH_PADDING;
+
+	std::vector<uint8_t> pixels((size_t)header.width * header.height, 0);
+	for (uint32_t c = 0; c < FONT_ATLAS_GLYPHS; c++)
+	{
+		const FontAtlasGlyph &glyph = glyphs[c];
+		for (uint32_t row = 0; row < glyph.height; row++)
+		{
+			memcpy(&pixels[(size_t)(glyph.y + row) * header.width + glyph.x], &bitmaps[c][(size_t)row * glyph.width],
+				   glyph.width);
+		}
+	}
+
+	if (!font_atlas_write(argv[2], header, glyphs, pixels.data()))
+	{
+		return 1;
+	}
+	printf("Baked %s at %dpx into %s, %ux%u\n", argv[1], pixel_size, argv[2], header.width, header.height);
+	return 0;
+}